@@ -0,0 +1,11 @@
+#!/bin/bash
+
+export WORKSPACE="$1"
+export THIRDPARTY="$2"
+
+rm -rf build-host
+mkdir build-host
+cd build-host
+cmake -DHOST_BUILD=ON ..
+make
+cd -
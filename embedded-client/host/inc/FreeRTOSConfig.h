@@ -0,0 +1,41 @@
+#ifndef FREERTOS_CONFIG_HOST_H
+#define FREERTOS_CONFIG_HOST_H
+
+/*
+ * The host build runs the firmware configuration on the FreeRTOS POSIX port,
+ * only the settings that port cannot take are changed here.
+ */
+#include_next "FreeRTOSConfig.h"
+
+/* the POSIX port has no tickless support */
+#undef configUSE_TICKLESS_IDLE
+#define configUSE_TICKLESS_IDLE 0
+
+/* one level above every application task for the task that plays the peripheral interrupts */
+#undef configMAX_PRIORITIES
+#define configMAX_PRIORITIES (6)
+#define HOST_IRQ_TASK_PRIO (configMAX_PRIORITIES - 1)
+
+/* the simulated interrupts are polled once per tick, raise it for load tests */
+#ifndef HOST_TICK_RATE_HZ
+#define HOST_TICK_RATE_HZ 1000
+#endif
+#undef configTICK_RATE_HZ
+#define configTICK_RATE_HZ ((TickType_t)HOST_TICK_RATE_HZ)
+
+void vAssertCalled(const char *file, unsigned long line);
+#undef configASSERT
+#define configASSERT(x)                                                        \
+  if ((x) == 0) {                                                              \
+    vAssertCalled(__FILE__, __LINE__);                                         \
+  }
+
+/* the POSIX port brings its own run time counter (process time, not cycles) in portmacro.h */
+#undef portCONFIGURE_TIMER_FOR_RUN_TIME_STATS
+#undef portGET_RUN_TIME_COUNTER_VALUE
+
+#undef vPortSVCHandler
+#undef xPortPendSVHandler
+#undef xPortSysTickHandler
+
+#endif /* FREERTOS_CONFIG_HOST_H */
@@ -0,0 +1,373 @@
+#ifndef STM32F1XX_HAL_HOST_H
+#define STM32F1XX_HAL_HOST_H
+
+/*
+ * Host stand-in for the STM32F1 HAL. Only the parts the application touches are
+ * here: bxCAN is backed by a SocketCAN interface (hal_can_host.c), USART3 TX DMA
+ * writes to stdout (hal_uart_host.c) and everything board related (clocks, GPIO,
+ * NVIC) is accepted and ignored. Interrupt handlers are run by the host_irq task
+ * in host_main.c.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef enum {
+    HAL_OK = 0x00U,
+    HAL_ERROR = 0x01U,
+    HAL_BUSY = 0x02U,
+    HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+#define ENABLE 1U
+#define DISABLE 0U
+#define __IO volatile
+
+/* ---------------------------------------------------------------- core */
+
+/* non zero while a simulated interrupt handler runs, stands in for IPSR */
+extern volatile uint32_t host_irq_active;
+/* runs the simulated interrupt handlers now instead of on the next tick, FreeRTOS tasks only */
+void host_irq_kick(void);
+
+static inline void __DMB(void) { __sync_synchronize(); }
+static inline void __DSB(void) { __sync_synchronize(); }
+static inline uint32_t __get_IPSR(void) { return host_irq_active; }
+static inline void __disable_irq(void) {}
+static inline void __enable_irq(void) {}
+
+typedef enum {
+    USB_HP_CAN1_TX_IRQn,
+    USB_LP_CAN1_RX0_IRQn,
+    CAN1_RX1_IRQn,
+    CAN1_SCE_IRQn,
+    USART3_IRQn,
+    DMA1_Channel1_IRQn,
+    DMA1_Channel2_IRQn,
+} IRQn_Type;
+
+static inline void HAL_NVIC_SetPriority(IRQn_Type irq, uint32_t prio, uint32_t sub) {
+    (void)irq;
+    (void)prio;
+    (void)sub;
+}
+static inline void NVIC_SetPriority(IRQn_Type irq, uint32_t prio) {
+    (void)irq;
+    (void)prio;
+}
+static inline void HAL_NVIC_EnableIRQ(IRQn_Type irq) { (void)irq; }
+static inline void HAL_NVIC_DisableIRQ(IRQn_Type irq) { (void)irq; }
+
+/* DWT cycle counter, reads the monotonic clock scaled to SystemCoreClock */
+typedef struct {
+    volatile uint32_t DEMCR;
+} CoreDebug_Type;
+
+typedef struct {
+    volatile uint32_t CTRL;
+    volatile uint32_t CYCCNT;
+} DWT_Type;
+
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+#define DWT_CTRL_CYCCNTENA_Msk (1UL << 0)
+
+extern CoreDebug_Type host_core_debug;
+extern DWT_Type host_dwt;
+extern uint32_t SystemCoreClock;
+
+uint32_t host_cycles(void);
+
+static inline DWT_Type *host_dwt_sample(void) {
+    host_dwt.CYCCNT = host_cycles();
+    return &host_dwt;
+}
+
+#define CoreDebug (&host_core_debug)
+#define DWT (host_dwt_sample())
+
+uint32_t HAL_GetTick(void);
+
+/* ---------------------------------------------------------------- gpio / rcc */
+
+typedef struct {
+    uint32_t Pin;
+    uint32_t Mode;
+    uint32_t Pull;
+    uint32_t Speed;
+} GPIO_InitTypeDef;
+
+typedef struct {
+    uint32_t unused;
+} GPIO_TypeDef;
+
+extern GPIO_TypeDef host_gpioa, host_gpiob;
+#define GPIOA (&host_gpioa)
+#define GPIOB (&host_gpiob)
+
+#define GPIO_PIN_1 ((uint16_t)0x0002)
+#define GPIO_PIN_5 ((uint16_t)0x0020)
+#define GPIO_PIN_10 ((uint16_t)0x0400)
+#define GPIO_PIN_11 ((uint16_t)0x0800)
+#define GPIO_PIN_12 ((uint16_t)0x1000)
+#define GPIO_PIN_13 ((uint16_t)0x2000)
+#define GPIO_PIN_14 ((uint16_t)0x4000)
+#define GPIO_PIN_15 ((uint16_t)0x8000)
+#define GPIO_PIN_RESET 0U
+#define GPIO_PIN_SET 1U
+#define GPIO_MODE_INPUT 0U
+#define GPIO_MODE_AF_PP 2U
+#define GPIO_NOPULL 0U
+#define GPIO_SPEED_FREQ_HIGH 3U
+
+static inline void HAL_GPIO_Init(GPIO_TypeDef *port, GPIO_InitTypeDef *init) {
+    (void)port;
+    (void)init;
+}
+static inline void HAL_GPIO_DeInit(GPIO_TypeDef *port, uint32_t pin) {
+    (void)port;
+    (void)pin;
+}
+
+#define __HAL_RCC_GPIOA_CLK_ENABLE() do { } while (0)
+#define __HAL_RCC_GPIOB_CLK_ENABLE() do { } while (0)
+#define __HAL_RCC_CAN1_CLK_ENABLE() do { } while (0)
+#define __HAL_RCC_CAN1_CLK_DISABLE() do { } while (0)
+#define __HAL_RCC_USART3_CLK_ENABLE() do { } while (0)
+#define __HAL_RCC_USART3_CLK_DISABLE() do { } while (0)
+#define __HAL_RCC_DMA1_CLK_ENABLE() do { } while (0)
+
+/* ---------------------------------------------------------------- dma */
+
+typedef struct {
+    uint32_t Direction;
+    uint32_t PeriphInc;
+    uint32_t MemInc;
+    uint32_t PeriphDataAlignment;
+    uint32_t MemDataAlignment;
+    uint32_t Mode;
+    uint32_t Priority;
+} DMA_InitTypeDef;
+
+typedef struct {
+    uint32_t unused;
+} DMA_Channel_TypeDef;
+
+extern DMA_Channel_TypeDef host_dma1_channel2;
+#define DMA1_Channel2 (&host_dma1_channel2)
+
+typedef struct __DMA_HandleTypeDef {
+    DMA_Channel_TypeDef *Instance;
+    DMA_InitTypeDef Init;
+    void *Parent;
+} DMA_HandleTypeDef;
+
+#define DMA_MEMORY_TO_PERIPH 0x10U
+#define DMA_PINC_DISABLE 0U
+#define DMA_MINC_ENABLE 0x80U
+#define DMA_PDATAALIGN_BYTE 0U
+#define DMA_MDATAALIGN_BYTE 0U
+#define DMA_NORMAL 0U
+#define DMA_PRIORITY_LOW 0U
+
+#define __HAL_LINKDMA(__HANDLE__, __PPP_DMA_FIELD__, __DMA_HANDLE__)                                              \
+    do {                                                                                                          \
+        (__HANDLE__)->__PPP_DMA_FIELD__ = &(__DMA_HANDLE__);                                                      \
+        (__DMA_HANDLE__).Parent = (__HANDLE__);                                                                   \
+    } while (0U)
+
+static inline HAL_StatusTypeDef HAL_DMA_Init(DMA_HandleTypeDef *hdma) {
+    (void)hdma;
+    return HAL_OK;
+}
+static inline HAL_StatusTypeDef HAL_DMA_DeInit(DMA_HandleTypeDef *hdma) {
+    (void)hdma;
+    return HAL_OK;
+}
+
+/* ---------------------------------------------------------------- uart */
+
+typedef struct {
+    uint32_t BaudRate;
+    uint32_t WordLength;
+    uint32_t StopBits;
+    uint32_t Parity;
+    uint32_t Mode;
+    uint32_t HwFlowCtl;
+    uint32_t OverSampling;
+} UART_InitTypeDef;
+
+typedef struct {
+    uint32_t unused;
+} USART_TypeDef;
+
+extern USART_TypeDef host_usart3;
+#define USART3 (&host_usart3)
+
+typedef struct __UART_HandleTypeDef {
+    USART_TypeDef *Instance;
+    UART_InitTypeDef Init;
+    DMA_HandleTypeDef *hdmatx;
+    DMA_HandleTypeDef *hdmarx;
+    volatile uint32_t tx_pending; /* DMA transfer done, completion interrupt not delivered yet */
+} UART_HandleTypeDef;
+
+#define UART_WORDLENGTH_8B 0U
+#define UART_STOPBITS_1 0U
+#define UART_PARITY_NONE 0U
+#define UART_MODE_TX_RX 0x0CU
+#define UART_HWCONTROL_NONE 0U
+#define UART_OVERSAMPLING_16 0U
+
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef *huart);
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size,
+                                    uint32_t timeout);
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size);
+void HAL_UART_IRQHandler(UART_HandleTypeDef *huart);
+void HAL_UART_MspInit(UART_HandleTypeDef *huart);
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart);
+
+/* ---------------------------------------------------------------- can */
+
+#define CAN_HOST_RX_FIFOS 2U
+#define CAN_HOST_TX_MAILBOXES 3U
+#define CAN_HOST_FILTER_BANKS 14U
+
+typedef struct {
+    uint32_t Prescaler;
+    uint32_t Mode;
+    uint32_t SyncJumpWidth;
+    uint32_t TimeSeg1;
+    uint32_t TimeSeg2;
+    uint32_t TimeTriggeredMode;
+    uint32_t AutoBusOff;
+    uint32_t AutoWakeUp;
+    uint32_t AutoRetransmission;
+    uint32_t ReceiveFifoLocked;
+    uint32_t TransmitFifoPriority;
+} CAN_InitTypeDef;
+
+typedef struct {
+    uint32_t unused;
+} CAN_TypeDef;
+
+extern CAN_TypeDef host_can1;
+#define CAN1 (&host_can1)
+
+typedef struct {
+    CAN_TypeDef *Instance;
+    CAN_InitTypeDef Init;
+    volatile uint32_t ErrorCode;
+    uint32_t notifications;
+    volatile uint32_t tx_busy;    /* CAN_TX_MAILBOXx bits of mailboxes holding a request */
+    volatile uint32_t tx_done;    /* requests sent, completion interrupt not delivered yet */
+    volatile uint32_t tx_failed;  /* requests the socket refused */
+    volatile uint32_t rx_overrun; /* CAN_RX_FIFOx bits that lost frames */
+} CAN_HandleTypeDef;
+
+typedef struct {
+    uint32_t StdId;
+    uint32_t ExtId;
+    uint32_t IDE;
+    uint32_t RTR;
+    uint32_t DLC;
+    uint32_t Timestamp;
+    uint32_t FilterMatchIndex;
+} CAN_RxHeaderTypeDef;
+
+typedef struct {
+    uint32_t StdId;
+    uint32_t ExtId;
+    uint32_t IDE;
+    uint32_t RTR;
+    uint32_t DLC;
+    uint32_t TransmitGlobalTime;
+} CAN_TxHeaderTypeDef;
+
+typedef struct {
+    uint32_t FilterIdHigh;
+    uint32_t FilterIdLow;
+    uint32_t FilterMaskIdHigh;
+    uint32_t FilterMaskIdLow;
+    uint32_t FilterFIFOAssignment;
+    uint32_t FilterBank;
+    uint32_t FilterMode;
+    uint32_t FilterScale;
+    uint32_t FilterActivation;
+    uint32_t SlaveStartFilterBank;
+} CAN_FilterTypeDef;
+
+#define CAN_MODE_NORMAL 0U
+#define CAN_SJW_1TQ 0U
+#define CAN_BS1_1TQ 0U
+#define CAN_BS2_1TQ 0U
+
+#define CAN_ID_STD 0x00000000U
+#define CAN_ID_EXT 0x00000004U
+#define CAN_RTR_DATA 0x00000000U
+#define CAN_RTR_REMOTE 0x00000002U
+
+#define CAN_RX_FIFO0 0x00000000U
+#define CAN_RX_FIFO1 0x00000001U
+#define CAN_FILTER_FIFO0 0x00000000U
+#define CAN_FILTER_FIFO1 0x00000001U
+#define CAN_FILTER_DISABLE 0x00000000U
+#define CAN_FILTER_ENABLE 0x00000001U
+#define CAN_FILTERMODE_IDMASK 0x00000000U
+#define CAN_FILTERSCALE_32BIT 0x00000001U
+
+#define CAN_TX_MAILBOX0 0x00000001U
+#define CAN_TX_MAILBOX1 0x00000002U
+#define CAN_TX_MAILBOX2 0x00000004U
+
+#define CAN_IT_TX_MAILBOX_EMPTY 0x00000001U
+#define CAN_IT_RX_FIFO0_MSG_PENDING 0x00000002U
+#define CAN_IT_RX_FIFO0_FULL 0x00000004U
+#define CAN_IT_RX_FIFO0_OVERRUN 0x00000008U
+#define CAN_IT_RX_FIFO1_MSG_PENDING 0x00000010U
+#define CAN_IT_RX_FIFO1_FULL 0x00000020U
+#define CAN_IT_RX_FIFO1_OVERRUN 0x00000040U
+#define CAN_IT_ERROR_WARNING 0x00000100U
+#define CAN_IT_ERROR_PASSIVE 0x00000200U
+#define CAN_IT_BUSOFF 0x00000400U
+#define CAN_IT_LAST_ERROR_CODE 0x00000800U
+#define CAN_IT_ERROR 0x00008000U
+
+#define HAL_CAN_ERROR_NONE 0x00000000U
+#define HAL_CAN_ERROR_RX_FOV0 0x00000200U
+#define HAL_CAN_ERROR_RX_FOV1 0x00000400U
+#define HAL_CAN_ERROR_TX_ALST0 0x00000800U
+#define HAL_CAN_ERROR_TX_TERR0 0x00001000U
+#define HAL_CAN_ERROR_TX_ALST1 0x00002000U
+#define HAL_CAN_ERROR_TX_TERR1 0x00004000U
+#define HAL_CAN_ERROR_TX_ALST2 0x00008000U
+#define HAL_CAN_ERROR_TX_TERR2 0x00010000U
+
+HAL_StatusTypeDef HAL_CAN_Init(CAN_HandleTypeDef *hcan);
+HAL_StatusTypeDef HAL_CAN_ConfigFilter(CAN_HandleTypeDef *hcan, const CAN_FilterTypeDef *filter);
+HAL_StatusTypeDef HAL_CAN_Start(CAN_HandleTypeDef *hcan);
+HAL_StatusTypeDef HAL_CAN_ActivateNotification(CAN_HandleTypeDef *hcan, uint32_t its);
+HAL_StatusTypeDef HAL_CAN_AddTxMessage(CAN_HandleTypeDef *hcan, const CAN_TxHeaderTypeDef *header,
+                                       const uint8_t data[], uint32_t *mailbox);
+uint32_t HAL_CAN_GetTxMailboxesFreeLevel(const CAN_HandleTypeDef *hcan);
+HAL_StatusTypeDef HAL_CAN_GetRxMessage(CAN_HandleTypeDef *hcan, uint32_t fifo, CAN_RxHeaderTypeDef *header,
+                                       uint8_t data[]);
+uint32_t HAL_CAN_GetRxFifoFillLevel(const CAN_HandleTypeDef *hcan, uint32_t fifo);
+uint32_t HAL_CAN_GetError(const CAN_HandleTypeDef *hcan);
+HAL_StatusTypeDef HAL_CAN_ResetError(CAN_HandleTypeDef *hcan);
+void HAL_CAN_IRQHandler(CAN_HandleTypeDef *hcan);
+void HAL_CAN_MspInit(CAN_HandleTypeDef *hcan);
+
+void HAL_CAN_TxMailbox0CompleteCallback(CAN_HandleTypeDef *hcan);
+void HAL_CAN_TxMailbox1CompleteCallback(CAN_HandleTypeDef *hcan);
+void HAL_CAN_TxMailbox2CompleteCallback(CAN_HandleTypeDef *hcan);
+void HAL_CAN_RxFifo0MsgPendingCallback(CAN_HandleTypeDef *hcan);
+void HAL_CAN_RxFifo1MsgPendingCallback(CAN_HandleTypeDef *hcan);
+void HAL_CAN_ErrorCallback(CAN_HandleTypeDef *hcan);
+
+/* SocketCAN interface HAL_CAN_Init() opens, set before MX_CAN_Init() */
+void hal_can_host_set_ifname(const char *ifname);
+/* 1 to 3, a single mailbox sends one frame at a time like the driver did before its tx queue */
+void hal_can_host_set_tx_mailboxes(uint32_t count);
+
+#endif // STM32F1XX_HAL_HOST_H
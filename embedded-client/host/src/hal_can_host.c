@@ -0,0 +1,342 @@
+#include "stm32f1xx_hal.h"
+#include <errno.h>
+#include <net/if.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+/*
+ * bxCAN on top of a SocketCAN interface. A plain pthread reads frames off the socket,
+ * runs them through the filter banks and queues them per FIFO. HAL_CAN_IRQHandler(),
+ * run once per tick by the host_irq task, presents at most three of them at a time
+ * like the hardware FIFOs do. Transmit requests go out on the socket right away and
+ * kick host_irq, so their completion interrupt follows as soon as the caller lets it
+ * run rather than on the next tick; received frames still wait for the tick.
+ */
+
+#define CAN_HOST_RX_RING (256) /* frames buffered per FIFO, must be a power of two */
+#define CAN_HOST_HW_FIFO_DEPTH (3)
+
+typedef struct {
+    uint32_t id;
+    uint32_t mask;
+    uint32_t fifo;
+    uint32_t active;
+} can_host_filter_s;
+
+typedef struct {
+    struct can_frame frames[CAN_HOST_RX_RING];
+    uint32_t head; /* reader thread */
+    uint32_t tail; /* interrupt context */
+} can_host_ring_s;
+
+static struct {
+    const char *ifname;
+    uint32_t tx_mailboxes; /* mailboxes offered to the driver, fewer than the hardware for A/B runs */
+    int sock;
+    pthread_t reader;
+    pthread_mutex_t filter_lock;
+    can_host_filter_s filters[CAN_HOST_FILTER_BANKS];
+    can_host_ring_s rx[CAN_HOST_RX_FIFOS];
+} can_host = {
+    .ifname = "vcan0",
+    .tx_mailboxes = CAN_HOST_TX_MAILBOXES,
+    .sock = -1,
+    .filter_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+CAN_TypeDef host_can1;
+
+static const uint32_t can_host_mailbox_bits[CAN_HOST_TX_MAILBOXES] = {
+    CAN_TX_MAILBOX0, CAN_TX_MAILBOX1, CAN_TX_MAILBOX2
+};
+static const uint32_t can_host_tx_err_bits[CAN_HOST_TX_MAILBOXES] = {
+    HAL_CAN_ERROR_TX_TERR0, HAL_CAN_ERROR_TX_TERR1, HAL_CAN_ERROR_TX_TERR2
+};
+
+void hal_can_host_set_ifname(const char *ifname) {
+    can_host.ifname = ifname;
+}
+
+void hal_can_host_set_tx_mailboxes(uint32_t count) {
+    if (count < 1) {
+        count = 1;
+    } else if (count > CAN_HOST_TX_MAILBOXES) {
+        count = CAN_HOST_TX_MAILBOXES;
+    }
+    can_host.tx_mailboxes = count;
+}
+
+// same layout as the bxCAN 32 bit filter registers: EXID << 3 | IDE | RTR, or STID << 21 | RTR
+static uint32_t can_host_filter_reg(const struct can_frame *frame) {
+    uint32_t rtr = (frame->can_id & CAN_RTR_FLAG) ? CAN_RTR_REMOTE : CAN_RTR_DATA;
+
+    if (frame->can_id & CAN_EFF_FLAG) {
+        return ((frame->can_id & CAN_EFF_MASK) << 3) | CAN_ID_EXT | rtr;
+    }
+    return ((frame->can_id & CAN_SFF_MASK) << 21) | rtr;
+}
+
+// lowest matching bank wins, -1 when the frame is rejected
+static int can_host_filter_match(const struct can_frame *frame) {
+    uint32_t reg = can_host_filter_reg(frame);
+    int fifo = -1;
+
+    pthread_mutex_lock(&can_host.filter_lock);
+    for (uint32_t bank = 0; bank < CAN_HOST_FILTER_BANKS; bank++) {
+        const can_host_filter_s *f = &can_host.filters[bank];
+        if (f->active && ((reg ^ f->id) & f->mask) == 0) {
+            fifo = (int)f->fifo;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&can_host.filter_lock);
+
+    return fifo;
+}
+
+static uint32_t can_host_ring_level(const can_host_ring_s *ring) {
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - ring->tail;
+}
+
+static void *can_host_reader(void *arg) {
+    CAN_HandleTypeDef *hcan = arg;
+    struct can_frame frame;
+
+    while (1) {
+        ssize_t n = read(can_host.sock, &frame, sizeof(frame));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n != (ssize_t)sizeof(frame)) {
+            perror("can host read");
+            return NULL;
+        }
+
+        int fifo = can_host_filter_match(&frame);
+        if (fifo < 0) {
+            continue;
+        }
+
+        can_host_ring_s *ring = &can_host.rx[fifo];
+        uint32_t head = ring->head;
+        if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= CAN_HOST_RX_RING) {
+            __atomic_or_fetch(&hcan->rx_overrun, 1u << fifo, __ATOMIC_RELAXED);
+            continue;
+        }
+        ring->frames[head & (CAN_HOST_RX_RING - 1)] = frame;
+        __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    }
+}
+
+HAL_StatusTypeDef HAL_CAN_Init(CAN_HandleTypeDef *hcan) {
+    struct sockaddr_can addr = {0};
+
+    can_host.sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (can_host.sock < 0) {
+        perror("can host socket");
+        return HAL_ERROR;
+    }
+
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = (int)if_nametoindex(can_host.ifname);
+    if (addr.can_ifindex == 0 || bind(can_host.sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "can host: cannot bind to %s\n", can_host.ifname);
+        close(can_host.sock);
+        can_host.sock = -1;
+        return HAL_ERROR;
+    }
+
+    hcan->ErrorCode = HAL_CAN_ERROR_NONE;
+    HAL_CAN_MspInit(hcan);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_CAN_ConfigFilter(CAN_HandleTypeDef *hcan, const CAN_FilterTypeDef *filter) {
+    (void)hcan;
+
+    if (filter->FilterBank >= CAN_HOST_FILTER_BANKS || filter->FilterMode != CAN_FILTERMODE_IDMASK ||
+        filter->FilterScale != CAN_FILTERSCALE_32BIT) {
+        return HAL_ERROR;
+    }
+
+    pthread_mutex_lock(&can_host.filter_lock);
+    can_host_filter_s *f = &can_host.filters[filter->FilterBank];
+    f->id = (filter->FilterIdHigh << 16) | filter->FilterIdLow;
+    f->mask = (filter->FilterMaskIdHigh << 16) | filter->FilterMaskIdLow;
+    f->fifo = filter->FilterFIFOAssignment;
+    f->active = filter->FilterActivation;
+    pthread_mutex_unlock(&can_host.filter_lock);
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_CAN_Start(CAN_HandleTypeDef *hcan) {
+    sigset_t all, old;
+    int rc;
+
+    if (can_host.sock < 0) {
+        return HAL_ERROR;
+    }
+
+    // the POSIX port drives its scheduler with signals, keep them away from the reader
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    rc = pthread_create(&can_host.reader, NULL, can_host_reader, hcan);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    return (rc == 0) ? HAL_OK : HAL_ERROR;
+}
+
+HAL_StatusTypeDef HAL_CAN_ActivateNotification(CAN_HandleTypeDef *hcan, uint32_t its) {
+    hcan->notifications |= its;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_CAN_AddTxMessage(CAN_HandleTypeDef *hcan, const CAN_TxHeaderTypeDef *header,
+                                       const uint8_t data[], uint32_t *mailbox) {
+    struct can_frame frame = {0};
+    uint32_t busy = __atomic_load_n(&hcan->tx_busy, __ATOMIC_ACQUIRE);
+    uint32_t bit = 0;
+
+    for (uint32_t i = 0; i < can_host.tx_mailboxes; i++) {
+        if (!(busy & can_host_mailbox_bits[i])) {
+            bit = can_host_mailbox_bits[i];
+            break;
+        }
+    }
+    if (bit == 0 || header->DLC > CAN_MAX_DLEN) {
+        return HAL_ERROR;
+    }
+
+    if (header->IDE == CAN_ID_EXT) {
+        frame.can_id = (header->ExtId & CAN_EFF_MASK) | CAN_EFF_FLAG;
+    } else {
+        frame.can_id = header->StdId & CAN_SFF_MASK;
+    }
+    if (header->RTR == CAN_RTR_REMOTE) {
+        frame.can_id |= CAN_RTR_FLAG;
+    }
+    frame.can_dlc = (uint8_t)header->DLC;
+    memcpy(frame.data, data, header->DLC);
+
+    __atomic_or_fetch(&hcan->tx_busy, bit, __ATOMIC_ACQ_REL);
+    if (send(can_host.sock, &frame, sizeof(frame), MSG_DONTWAIT) != (ssize_t)sizeof(frame)) {
+        __atomic_or_fetch(&hcan->tx_failed, bit, __ATOMIC_RELEASE);
+    } else {
+        __atomic_or_fetch(&hcan->tx_done, bit, __ATOMIC_RELEASE);
+    }
+    // the frame is on the wire once send() returns, free the mailbox without waiting a tick
+    host_irq_kick();
+
+    if (mailbox) {
+        *mailbox = bit;
+    }
+    return HAL_OK;
+}
+
+uint32_t HAL_CAN_GetTxMailboxesFreeLevel(const CAN_HandleTypeDef *hcan) {
+    uint32_t busy = __atomic_load_n(&hcan->tx_busy, __ATOMIC_ACQUIRE);
+    uint32_t level = 0;
+
+    for (uint32_t i = 0; i < can_host.tx_mailboxes; i++) {
+        level += (busy & can_host_mailbox_bits[i]) ? 0 : 1;
+    }
+    return level;
+}
+
+uint32_t HAL_CAN_GetRxFifoFillLevel(const CAN_HandleTypeDef *hcan, uint32_t fifo) {
+    (void)hcan;
+
+    if (fifo >= CAN_HOST_RX_FIFOS) {
+        return 0;
+    }
+    uint32_t level = can_host_ring_level(&can_host.rx[fifo]);
+    return (level > CAN_HOST_HW_FIFO_DEPTH) ? CAN_HOST_HW_FIFO_DEPTH : level;
+}
+
+HAL_StatusTypeDef HAL_CAN_GetRxMessage(CAN_HandleTypeDef *hcan, uint32_t fifo, CAN_RxHeaderTypeDef *header,
+                                       uint8_t data[]) {
+    (void)hcan;
+
+    if (fifo >= CAN_HOST_RX_FIFOS || can_host_ring_level(&can_host.rx[fifo]) == 0) {
+        return HAL_ERROR;
+    }
+
+    can_host_ring_s *ring = &can_host.rx[fifo];
+    const struct can_frame *frame = &ring->frames[ring->tail & (CAN_HOST_RX_RING - 1)];
+
+    memset(header, 0, sizeof(*header));
+    if (frame->can_id & CAN_EFF_FLAG) {
+        header->IDE = CAN_ID_EXT;
+        header->ExtId = frame->can_id & CAN_EFF_MASK;
+    } else {
+        header->IDE = CAN_ID_STD;
+        header->StdId = frame->can_id & CAN_SFF_MASK;
+    }
+    header->RTR = (frame->can_id & CAN_RTR_FLAG) ? CAN_RTR_REMOTE : CAN_RTR_DATA;
+    header->DLC = (frame->can_dlc > CAN_MAX_DLEN) ? CAN_MAX_DLEN : frame->can_dlc;
+    memcpy(data, frame->data, header->DLC);
+
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+    return HAL_OK;
+}
+
+uint32_t HAL_CAN_GetError(const CAN_HandleTypeDef *hcan) {
+    return hcan->ErrorCode;
+}
+
+HAL_StatusTypeDef HAL_CAN_ResetError(CAN_HandleTypeDef *hcan) {
+    hcan->ErrorCode = HAL_CAN_ERROR_NONE;
+    return HAL_OK;
+}
+
+void HAL_CAN_IRQHandler(CAN_HandleTypeDef *hcan) {
+    uint32_t done = __atomic_exchange_n(&hcan->tx_done, 0, __ATOMIC_ACQ_REL);
+    uint32_t failed = __atomic_exchange_n(&hcan->tx_failed, 0, __ATOMIC_ACQ_REL);
+    uint32_t overrun = __atomic_exchange_n(&hcan->rx_overrun, 0, __ATOMIC_ACQ_REL);
+    uint32_t errors = HAL_CAN_ERROR_NONE;
+
+    __atomic_and_fetch(&hcan->tx_busy, ~(done | failed), __ATOMIC_ACQ_REL);
+
+    if (hcan->notifications & CAN_IT_TX_MAILBOX_EMPTY) {
+        if (done & CAN_TX_MAILBOX0) {
+            HAL_CAN_TxMailbox0CompleteCallback(hcan);
+        }
+        if (done & CAN_TX_MAILBOX1) {
+            HAL_CAN_TxMailbox1CompleteCallback(hcan);
+        }
+        if (done & CAN_TX_MAILBOX2) {
+            HAL_CAN_TxMailbox2CompleteCallback(hcan);
+        }
+    }
+    for (uint32_t i = 0; i < CAN_HOST_TX_MAILBOXES; i++) {
+        if (failed & can_host_mailbox_bits[i]) {
+            errors |= can_host_tx_err_bits[i];
+        }
+    }
+
+    if ((overrun & (1u << CAN_RX_FIFO0)) && (hcan->notifications & CAN_IT_RX_FIFO0_OVERRUN)) {
+        errors |= HAL_CAN_ERROR_RX_FOV0;
+    }
+    if ((overrun & (1u << CAN_RX_FIFO1)) && (hcan->notifications & CAN_IT_RX_FIFO1_OVERRUN)) {
+        errors |= HAL_CAN_ERROR_RX_FOV1;
+    }
+
+    if ((hcan->notifications & CAN_IT_RX_FIFO0_MSG_PENDING) && HAL_CAN_GetRxFifoFillLevel(hcan, CAN_RX_FIFO0)) {
+        HAL_CAN_RxFifo0MsgPendingCallback(hcan);
+    }
+    if ((hcan->notifications & CAN_IT_RX_FIFO1_MSG_PENDING) && HAL_CAN_GetRxFifoFillLevel(hcan, CAN_RX_FIFO1)) {
+        HAL_CAN_RxFifo1MsgPendingCallback(hcan);
+    }
+
+    if (errors != HAL_CAN_ERROR_NONE && (hcan->notifications & CAN_IT_ERROR)) {
+        hcan->ErrorCode |= errors;
+        HAL_CAN_ErrorCallback(hcan);
+    }
+}
@@ -0,0 +1,173 @@
+#include "main.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "can.h"
+#include "usart.h"
+#include "cspcan.h"
+#include "cpu_load.h"
+#include "csp_dispatch.h"
+#include "status_share.h"
+#include "mem_health.h"
+#include "rx_latency.h"
+#include "uavcan_messages.h"
+#include "uart_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "csp/csp.h"
+
+/*
+ * Linux entry point of the host build, brings the application up the same way main()
+ * does on the board. Several instances with different node ids can share one vcan
+ * interface:
+ *
+ *   sudo ip link add dev vcan0 type vcan && sudo ip link set up vcan0
+ *   ./application_firmware_host -i vcan0 -n 11
+ */
+
+volatile uint32_t host_irq_active;
+uint32_t SystemCoreClock = 8000000;
+CoreDebug_Type host_core_debug;
+DWT_Type host_dwt;
+GPIO_TypeDef host_gpioa, host_gpiob;
+
+uint32_t host_cycles(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    return (uint32_t)((ns * (SystemCoreClock / 1000000u)) / 1000u);
+}
+
+uint32_t HAL_GetTick(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u);
+}
+
+/*
+ * Peripheral interrupts. FreeRTOS calls from foreign pthreads (the SocketCAN reader) are
+ * not allowed on the POSIX port and yielding from inside its tick handler is not safe
+ * either, so the handlers run once per tick from a task above every application task.
+ * Application critical sections keep it out just like they keep real interrupts out.
+ * A CAN transmit kicks the task right away, so sending is not bound to three frames
+ * (one per mailbox) per tick; reception is still polled once per tick.
+ */
+#define HOST_IRQ_TASK_DEPTH (256)
+
+static StaticTask_t host_irq_tcb;
+static StackType_t host_irq_stack[HOST_IRQ_TASK_DEPTH];
+static TaskHandle_t host_irq_task;
+static StaticTask_t csp_router_tcb;
+static StackType_t csp_router_stack[CSP_ROUTER_TASK_DEPTH];
+
+static void task_host_irq(void *data) {
+    (void)data;
+
+    while (1) {
+        host_irq_active = 1;
+        HAL_CAN_IRQHandler(&hcan);
+        HAL_UART_IRQHandler(&huart3);
+        host_irq_active = 0;
+
+        ulTaskNotifyTake(pdTRUE, 1);
+    }
+}
+
+void host_irq_kick(void) {
+    if (host_irq_task) {
+        xTaskNotifyGive(host_irq_task);
+    }
+}
+
+void vAssertCalled(const char *file, unsigned long line) {
+    fprintf(stderr, "assert failed at %s:%lu\n", file, line);
+    abort();
+}
+
+void Error_Handler(void) {
+    fprintf(stderr, "Error_Handler called\n");
+    abort();
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-i can_ifname] [-n node_id] [-m tx_mailboxes] [-b iterations]\n", prog);
+    fprintf(stderr, "    -i : SocketCAN interface (default is vcan0)\n");
+    fprintf(stderr, "    -n : CSP node id (default is %d)\n", LOCAL_NODE_ID);
+    fprintf(stderr, "    -m : tx mailboxes to use, 1 to 3 (default is 3), 1 for a before/after tx throughput run\n");
+    fprintf(stderr, "    -b : round trip every uavcan message this many times and exit\n");
+}
+
+static void bench_report(const char *name, int32_t size, uint32_t iterations, uint32_t encode_cycles,
+                         uint32_t decode_cycles, int ok) {
+    double ns_per_cycle = 1e9 / (double)SystemCoreClock;
+
+    printf("%-24s %4ld bytes  encode %8.1f ns  decode %8.1f ns  %s\n", name, (long)size,
+           encode_cycles * ns_per_cycle / iterations, decode_cycles * ns_per_cycle / iterations,
+           ok ? "ok" : "FAILED");
+}
+
+int main(int argc, char **argv) {
+    const char *ifname = "vcan0";
+    uint16_t node_id = LOCAL_NODE_ID;
+    uint32_t bench_iterations = 0;
+    uint32_t tx_mailboxes = CAN_HOST_TX_MAILBOXES;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:n:m:b:h")) != -1) {
+        switch (opt) {
+        case 'i':
+            ifname = optarg;
+            break;
+        case 'n':
+            node_id = (uint16_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            tx_mailboxes = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            bench_iterations = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    if (bench_iterations > 0) {
+        cpu_cycles_init();
+        return uavcan_messages_bench(bench_iterations, bench_report) == 0 ? 0 : 1;
+    }
+
+    hal_can_host_set_ifname(ifname);
+    hal_can_host_set_tx_mailboxes(tx_mailboxes);
+    MX_CAN_Init();
+    MX_USART3_UART_Init();
+    uart_log_init();
+
+    uart_log("application started on %s as node %u!\n", ifname, node_id);
+
+    cpu_cycles_init();
+    csp_init();
+    rx_latency_init();
+    csp_dispatch_init();
+    status_share_init("host-posix", STATUS_SHARE_PERIOD_MS);
+
+    host_irq_task = xTaskCreateStatic(task_host_irq, "host_irq", HOST_IRQ_TASK_DEPTH, NULL, HOST_IRQ_TASK_PRIO,
+                                      host_irq_stack, &host_irq_tcb);
+    mem_health_task(host_irq_task, HOST_IRQ_TASK_DEPTH);
+    xTaskCreateStatic(task_csp_router, "csp_router", CSP_ROUTER_TASK_DEPTH, NULL, CSP_ROUTER_TASK_PRIO,
+                      csp_router_stack, &csp_router_tcb);
+
+    if (can_add_interface(node_id, CSP_NETMASK) != 0) {
+        uart_log("Failed to add CSP CAN interface\r\n");
+    } else {
+        uart_log("CSP Initialised Succesfully\r\n");
+    }
+
+    vTaskStartScheduler();
+
+    return 1;
+}
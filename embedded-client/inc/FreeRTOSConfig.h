@@ -3,6 +3,7 @@
 #define FREERTOS_CONFIG_H
 
 #include <stdint.h>
+#include "mem_config.h"
 extern uint32_t SystemCoreClock;
 
 #define configUSE_PREEMPTION 1
@@ -13,7 +14,6 @@ extern uint32_t SystemCoreClock;
 #define configTICK_RATE_HZ ((TickType_t)1000)
 #define configMAX_PRIORITIES (5)
 #define configMINIMAL_STACK_SIZE ((uint16_t)128)
-#define configTOTAL_HEAP_SIZE ((size_t)(150 * 1024))
 #define configMAX_TASK_NAME_LEN (16)
 #define configUSE_TRACE_FACILITY 1
 #define configUSE_16_BIT_TICKS 0
@@ -25,7 +25,12 @@ extern uint32_t SystemCoreClock;
 #define configUSE_MALLOC_FAILED_HOOK 0
 #define configUSE_APPLICATION_TASK_TAG 0
 #define configUSE_COUNTING_SEMAPHORES 1
-#define configGENERATE_RUN_TIME_STATS 0
+/* task run time in DWT core cycles, see runtime_stats.h */
+#define configGENERATE_RUN_TIME_STATS 1
+void runtime_stats_timer_init(void);
+uint32_t runtime_stats_counter(void);
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS() runtime_stats_timer_init()
+#define portGET_RUN_TIME_COUNTER_VALUE() runtime_stats_counter()
 
 #define configUSE_CO_ROUTINES 0
 #define configMAX_CO_ROUTINE_PRIORITIES (2)
@@ -33,7 +38,7 @@ extern uint32_t SystemCoreClock;
 #define configUSE_TIMERS 1
 #define configTIMER_TASK_PRIORITY (2)
 #define configTIMER_QUEUE_LENGTH 10
-#define configTIMER_TASK_STACK_DEPTH (configMINIMAL_STACK_SIZE * 2)
+#define configTIMER_TASK_STACK_DEPTH (TIMER_TASK_DEPTH)
 
 #define INCLUDE_vTaskPrioritySet 1
 #define INCLUDE_uxTaskPriorityGet 1
@@ -43,9 +48,13 @@ extern uint32_t SystemCoreClock;
 #define INCLUDE_vTaskDelayUntil 1
 #define INCLUDE_vTaskDelay 1
 #define INCLUDE_xTaskGetHandle 1
+#define INCLUDE_xTimerGetTimerDaemonTaskHandle 1
+#define INCLUDE_xTaskGetIdleTaskHandle 1
+#define INCLUDE_uxTaskGetStackHighWaterMark 1
 #define configUSE_TASK_NOTIFICATIONS 1
 #define configUSE_QUEUE_SETS 1
-#define configSUPPORT_DYNAMIC_ALLOCATION 1
+/* everything is allocated statically, see mem_config.h */
+#define configSUPPORT_DYNAMIC_ALLOCATION 0
 #define configSUPPORT_STATIC_ALLOCATION 1
 
 #ifdef __NVIC_PRIO_BITS
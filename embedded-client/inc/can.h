@@ -9,7 +9,13 @@ extern "C" {
 
 extern CAN_HandleTypeDef hcan;
 
+/* stm32f103 has a single CAN, so all 14 filter banks belong to CAN1 */
+#define CAN_FILTER_BANKS (14)
+
 void MX_CAN_Init(void);
+HAL_StatusTypeDef can_filter_ext(uint32_t bank, uint32_t id, uint32_t mask, uint32_t fifo);
+HAL_StatusTypeDef can_filter_accept_all(uint32_t bank, uint32_t fifo);
+HAL_StatusTypeDef can_filter_disable(uint32_t bank);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,38 @@
+#ifndef CAN_REASM_H
+#define CAN_REASM_H
+
+#include <stdint.h>
+#include <csp/csp.h>
+#include "mem_config.h"
+
+#define CAN_REASM_TIMEOUT_MS (1000) /* a stream without a new fragment for this long is reclaimed */
+
+typedef struct {
+    uint32_t completed; /* packets handed to the router */
+    uint32_t evicted;   /* streams dropped for a new one while every slot was busy, oldest first */
+    uint32_t timed_out; /* streams reclaimed after CAN_REASM_TIMEOUT_MS without a fragment */
+    uint32_t aborted;   /* streams dropped for a missing fragment, overflow or a restart */
+    uint32_t orphans;   /* fragments without a stream, e.g. of an evicted one */
+    uint32_t no_buffer; /* complete packets dropped because the CSP buffer pool was empty */
+    uint32_t router_full; /* complete packets csp_qfifo_write() dropped on a full router fifo */
+    uint32_t peak;      /* most streams open at the same time */
+} can_reasm_stats_s;
+
+/*
+ * CFP2 reassembly into CAN_REASM_STREAMS slots with their own buffers, in place of the
+ * libcsp one that takes a pool buffer per stream. A CSP buffer is only taken once a
+ * packet is complete, so partial streams can never drain the pool. Only called from
+ * the CAN rx thread.
+ *
+ * stamp is the cpu_cycles() of the rx interrupt that took the frame, complete packets
+ * are handed to rx_latency.h with it.
+ *
+ * Returns 1 when the frame completed a packet and the router fifo took it, the caller
+ * owes the router one notification per 1.
+ */
+int can_reasm_rx(csp_iface_t *iface, uint32_t id, const uint8_t *data, uint8_t dlc, uint32_t stamp);
+void can_reasm_get_stats(can_reasm_stats_s *stats);
+/* logs the counters when a stream was completed or lost since the last report */
+void can_reasm_report(void);
+
+#endif // CAN_REASM_H
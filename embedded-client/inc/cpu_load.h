@@ -0,0 +1,58 @@
+#ifndef CPU_LOAD_H
+#define CPU_LOAD_H
+
+#include "stm32f1xx_hal.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include <stdint.h>
+
+/* DWT cycle counter, counts core clocks while the core runs (it stops in WFI sleep) */
+static inline void cpu_cycles_init(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+static inline uint32_t cpu_cycles(void) {
+    return DWT->CYCCNT;
+}
+
+/*
+ * Busy/blocked accounting for a task built around one blocking wait. Call
+ * task_load_block() right before the wait and task_load_wake() right after it.
+ * Busy time is the task's own FreeRTOS run time counter (see runtime_stats.h), so
+ * time it spends preempted by other tasks or interrupts is not charged to it. The
+ * window is measured in ticks, which keeps the share right across tickless sleep
+ * where the cycle counter is stopped. The counter is 32 bits, a window must stay
+ * under 2^32 cycles of the task (about 9 minutes at 8 MHz).
+ */
+typedef struct {
+    const char *name;
+    TaskHandle_t task;
+    uint32_t wakeups;
+    uint32_t blocked_ticks;
+    TickType_t window_start;
+    uint32_t run_mark;   /* run time counter of the task when the window started */
+#ifdef HOST_BUILD
+    uint32_t total_mark; /* the POSIX port counter is process time, the window is taken from it */
+#endif
+    TickType_t tick_mark;
+} task_load_s;
+
+static inline void task_load_block(task_load_s *load) {
+    load->tick_mark = xTaskGetTickCount();
+}
+
+static inline void task_load_wake(task_load_s *load) {
+    load->blocked_ticks += xTaskGetTickCount() - load->tick_mark;
+    load->wakeups++;
+}
+
+/* call it from the task that is measured */
+void task_load_start(task_load_s *load, const char *name);
+/* busy share of the wall time since task_load_start()/task_load_reset(), in 1/1000 */
+uint32_t task_load_permille(const task_load_s *load);
+void task_load_reset(task_load_s *load);
+void task_load_report(const task_load_s *load);
+
+#endif // CPU_LOAD_H
@@ -0,0 +1,48 @@
+#ifndef CSP_DISPATCH_H
+#define CSP_DISPATCH_H
+
+#include <stdint.h>
+#include <csp/csp.h>
+#include "cspcan.h"
+#include "mem_config.h"
+
+#define CSP_DISPATCH_HI_TASK_PRIO (CSP_SERVER_TASK_PRIO) /* below the router, above logging */
+#define CSP_DISPATCH_LO_TASK_PRIO (1)
+
+/* Handlers own the packet, they free it or send it on */
+typedef void (*csp_dispatch_handler_f)(csp_packet_t *packet);
+
+typedef enum {
+    CSP_DISPATCH_ROUTER = 0, /* called from the router through csp_bind_callback(), must not block */
+    CSP_DISPATCH_HI,         /* queued to the high priority handler task */
+    CSP_DISPATCH_LO,         /* queued to the low priority handler task */
+} csp_dispatch_target_e;
+
+#define CSP_DISPATCH_TASKS (2)
+
+typedef struct {
+    uint8_t port; /* CSP_ANY takes every port without an entry of its own */
+    csp_dispatch_target_e target;
+    csp_dispatch_handler_f handler;
+    const char *name;
+} csp_dispatch_entry_s;
+
+/* the router writes dropped and queue_peak, whoever runs the handler the rest */
+typedef struct {
+    uint32_t packets;          /* packets handled */
+    uint32_t dropped;          /* packets dropped on a full handler queue */
+    uint32_t queue_peak;       /* deepest handler queue seen when a packet for this port was queued */
+    uint32_t latency_max_us;   /* from the router to the handler returning */
+    uint64_t latency_total_us;
+} csp_dispatch_stats_s;
+
+/* Binds every port of the dispatch table in csp_dispatch.c and starts the handler
+ * tasks. Replaces the CSP_ANY socket and accept loop, so no connection can hold up
+ * another port. Call after csp_init() and before the router task runs. */
+int csp_dispatch_init(void);
+/* stats of the table entry serving port, the CSP_ANY one for ports without their own */
+int csp_dispatch_get_stats(uint8_t port, csp_dispatch_stats_s *stats);
+/* logs the stats of every entry that saw a packet */
+void csp_dispatch_report(void);
+
+#endif // CSP_DISPATCH_H
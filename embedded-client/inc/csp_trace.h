@@ -0,0 +1,53 @@
+#ifndef CSP_TRACE_H
+#define CSP_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <csp/csp.h>
+
+/* 1: fixed layout binary records, decoded on the host by rust-server/csp-trace
+ * 0: human readable lines plus packet_dump(), formatted on the MCU */
+#ifndef CSP_TRACE_BINARY
+#define CSP_TRACE_BINARY (1)
+#endif
+
+#define CSP_TRACE_PAYLOAD_MAX (16) /* payload bytes copied into a binary record */
+
+#define CSP_TRACE_SYNC0 (0xA5)
+#define CSP_TRACE_SYNC1 (0x5A)
+#define CSP_TRACE_VERSION (1)
+#define CSP_TRACE_NO_VIA (0xFFFF)
+
+typedef enum {
+    CSP_TRACE_DIR_IN = 0,
+    CSP_TRACE_DIR_OUT = 1,
+} csp_trace_dir_e;
+
+/* Wire layout, little endian. The record travels in the same USART3 stream as the text
+ * log, so it starts with a sync pair and ends its header with a checksum the decoder
+ * uses to resynchronise. Only payload_len payload bytes follow the header. */
+typedef struct __attribute__((packed)) {
+    uint8_t sync[2];
+    uint8_t version;
+    uint8_t dir;         /* csp_trace_dir_e */
+    uint32_t timestamp;  /* RTOS ticks (ms) */
+    uint16_t src;
+    uint16_t dst;
+    uint8_t dport;
+    uint8_t sport;
+    uint8_t pri;
+    uint8_t flags;
+    uint16_t length;     /* full CSP packet length */
+    uint16_t via;        /* CSP_TRACE_NO_VIA when sent directly */
+    char iface[4];       /* interface name, not terminated */
+    uint8_t payload_len; /* min(length, CSP_TRACE_PAYLOAD_MAX) */
+    uint8_t checksum;    /* sum of every header and payload byte after the sync pair */
+    uint8_t payload[CSP_TRACE_PAYLOAD_MAX];
+} csp_trace_record_s;
+
+#define CSP_TRACE_HEADER_SIZE (offsetof(csp_trace_record_s, payload))
+
+void csp_trace_packet(csp_trace_dir_e dir, const csp_id_t *id, const csp_packet_t *packet, const csp_iface_t *iface,
+                      uint16_t via);
+
+#endif // CSP_TRACE_H
@@ -2,11 +2,13 @@
 #define CSPCAN_H
 
 #include "main.h"
+#include "mem_config.h"
 #include "stm32f1xx_hal.h"
 #include <stdint.h>
 #include <csp/csp_interface.h>
 #include <csp/interfaces/csp_if_can.h>
 #include "semphr.h"
+#include "task.h"
 
 
 extern UART_HandleTypeDef huart3;
@@ -14,8 +16,17 @@ extern UART_HandleTypeDef huart3;
 #define LOCAL_NODE_ID 10
 #define BCAST_PORT   10
 
-#define RX_THREAD_TASK_DEPTH (1024)
-#define CSP_QUEUE_LENGTH (256)
+#define CSP_RX_TASK_PRIO (4)
+#define CSP_ROUTER_TASK_PRIO (3)
+#define CSP_SERVER_TASK_PRIO (2) /* high priority CSP handler task, see csp_dispatch.h */
+#define CSP_ROUTER_WORK_BUDGET (8)        /* packets routed per wakeup before yielding */
+#define CSP_ROUTER_IDLE_TIMEOUT_MS (1000) /* sweep for input that does not notify, e.g. loopback */
+#define CSP_LOAD_REPORT_MS (10000)        /* router/rx load log interval, 0 disables it */
+#define CSP_CAN_RX_FIFOS (2)
+#define CSP_CAN_TX_PRIOS (4)
+#define CSP_CAN_TX_TIMEOUT_MS (100)  /* how long a sender waits for room in a full tx queue */
+/* CFP2 frames for a packet of len bytes, the first frame holds 4 bytes of CSP header */
+#define CSP_CAN_CFP2_FRAMES(len) ((len) <= 4 ? 1 : 1 + ((len) - 4 + CAN_MAX_DLC - 1) / CAN_MAX_DLC)
 #define CSP_NETMASK (0xfff0)
 #define CSP_NETMASK_MAX_NUMBER_OF_BITS (-1)
 #define CSP_NO_VIA (0)
@@ -33,24 +44,108 @@ extern UART_HandleTypeDef huart3;
 #define CAN_EFF_MASK (0x1FFFFFFFU) /* extended frame format (EFF) */
 #define CAN_ERR_MASK (0x1FFFFFFFU) /* omit EFF, RTR, ERR flags */
 
+typedef struct {
+    uint32_t id;
+    uint8_t data[CAN_MAX_DLC];
+    uint8_t dlc;
+} csp_can_msg_s;
+
+/* single producer (CAN RX ISR) / single consumer (csp_rx_thread) ring, one per bxCAN fifo.
+ * head and tail are free running, the slot index is taken with the mask */
+typedef struct {
+    csp_can_msg_s *frames;
+    uint32_t *stamps;       /* cpu_cycles() of the ISR that took each frame, for rx_latency.h */
+    uint32_t mask;
+    volatile uint32_t head; /* written by the ISR only */
+    volatile uint32_t tail; /* written by the rx thread only */
+    uint32_t peak;          /* highest occupancy seen so far */
+    uint32_t dropped;       /* frames dropped because the ring was full */
+} csp_can_rx_ring_s;
+
+/* software tx queue of one CSP priority, filled by csp_can_tx_frame() and emptied into
+ * the three bxCAN mailboxes by csp_can_tx_pump(), always with the CAN interrupts masked */
+typedef struct {
+    csp_can_msg_s frames[CSP_CAN_TX_QUEUE_LENGTH];
+    uint32_t head;
+    uint32_t tail;
+    uint32_t discard_key; /* CFP2_ID_CONN_MASK bits of the packet whose remaining frames are dropped */
+    uint8_t discarding;   /* set from a failed fragment until the end of its packet */
+} csp_can_tx_queue_s;
+
+/* the upper CFP2 priority bit is clear for CSP_PRIO_CRITICAL and CSP_PRIO_HIGH,
+ * the filter banks use it to steer those frames into FIFO1 */
+#define CSP_CAN_PRIO_LOW_BIT ((uint32_t)0x2 << CFP2_PRIO_OFFSET)
+
+/* which CSP destinations the bxCAN filter banks let through */
+typedef enum {
+    CSP_CAN_FILTER_UNICAST = 0, /* frames addressed to this node only */
+    CSP_CAN_FILTER_BROADCAST,   /* this node plus global and subnet broadcast */
+    CSP_CAN_FILTER_BRIDGE,      /* every address of our subnet plus broadcast */
+    CSP_CAN_FILTER_PROMISC,     /* all frames on the bus */
+} csp_can_filter_mode_e;
+
+#define CSP_CAN_FILTER_MODE_DEFAULT (CSP_CAN_FILTER_BROADCAST)
+#define CSP_BROADCAST_ADDR (0x3FFF)
+
 typedef struct{
     csp_iface_t *iface;
     csp_can_interface_data_t ifdata;
-    xSemaphoreHandle tx_sem;
-    QueueHandle_t rx_queue;
+    xSemaphoreHandle tx_sem; /* given by the tx ISR whenever queue slots were freed */
+    csp_can_tx_queue_s tx_queue[CSP_CAN_TX_PRIOS]; /* indexed by CSP priority, 0 is CRITICAL */
+    uint32_t tx_queued;
+    uint32_t tx_frames;
+    uint32_t tx_errors;
+    uint32_t tx_dropped;
+    uint32_t tx_discarded;
+    uint32_t tx_full_waits;
+    uint32_t tx_queue_peak;
+    csp_can_rx_ring_s rx_ring[CSP_CAN_RX_FIFOS]; /* indexed by CAN_RX_FIFO0 / CAN_RX_FIFO1 */
+    TaskHandle_t rx_task;
+    csp_can_filter_mode_e filter_mode;
+    uint16_t filter_netmask;
+    uint32_t rx_frames;
+    uint32_t rx_isr_entries;
+    uint32_t rx_foreign_frames;
+    uint32_t rx_fifo_overruns[CSP_CAN_RX_FIFOS];
     uint32_t can_err_frames_tracker;
     uint32_t can_rtr_frames_tracker;
 } csp_can_s;
 
+typedef struct {
+    uint32_t rx_frames;
+    uint32_t rx_isr_entries;
+    uint32_t rx_foreign_frames; /* frames that reached the CPU but were not for us */
+    uint32_t rx_ring_peak[CSP_CAN_RX_FIFOS];
+    uint32_t rx_ring_dropped[CSP_CAN_RX_FIFOS];
+    uint32_t rx_fifo_overruns[CSP_CAN_RX_FIFOS]; /* frames lost in the 3 deep hw fifo */
+    uint32_t rx_err_frames;
+    uint32_t rx_rtr_frames;
+    uint32_t tx_queued;     /* frames accepted by csp_can_tx_frame() */
+    uint32_t tx_frames;     /* frames that left a mailbox successfully, sample twice for frames/s */
+    uint32_t tx_errors;     /* frames aborted, lost or refused by the controller */
+    uint32_t tx_dropped;    /* frames refused because the tx queue stayed full */
+    uint32_t tx_discarded;  /* later fragments of a packet that already lost a frame to tx_errors */
+    uint32_t tx_full_waits; /* times a sender had to wait for room */
+    uint32_t tx_queue_peak; /* highest number of frames waiting in all tx queues */
+} csp_can_stats_s;
 
 typedef struct {
-    uint32_t id;
-    uint8_t data[CAN_MAX_DLC];
-    uint8_t dlc;
-} csp_can_msg_s;
+    uint32_t wakeups;
+    uint32_t packets;          /* csp_route_work() calls that routed a packet */
+    uint32_t budget_exhausted; /* wakeups that left work for the next round */
+    uint32_t idle_sweeps;      /* wakeups on CSP_ROUTER_IDLE_TIMEOUT_MS without a notification */
+    uint32_t cpu_permille;     /* router busy share since the last load report */
+    uint32_t blocked_ticks;
+} csp_router_stats_s;
 
 int can_add_interface(uint16_t node_id, uint16_t netmask);
+void csp_router_get_stats(csp_router_stats_s *stats);
+int can_set_filter_mode(csp_can_filter_mode_e mode);
+void can_get_stats(csp_can_stats_s *stats);
+/* CSP address of the CAN interface, 0 before can_add_interface() */
+uint16_t can_get_address(void);
+/* free frame slots in the tx queue of CSP priority prio, 0 for an unknown priority */
+uint32_t can_tx_queue_free(uint8_t prio);
 void task_csp_router(void *data);
-void task_csp_server(void *data);
 
 #endif // CSPCAN_H
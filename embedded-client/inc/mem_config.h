@@ -0,0 +1,46 @@
+#ifndef MEM_CONFIG_H
+#define MEM_CONFIG_H
+
+/*
+ * Every statically allocated task stack, queue and pool of the firmware is sized here,
+ * nothing is allocated at run time (configSUPPORT_DYNAMIC_ALLOCATION is 0). The post-link
+ * step runs tools/mem_budget.py on the map file and fails the build when RAM or flash
+ * goes over MEM_RAM_BUDGET / MEM_FLASH_BUDGET.
+ *
+ * Only plain defines: FreeRTOSConfig.h and the libcsp build include this file, and cmake
+ * reads the CSP_CONF_ and MEM_ values with a regex, so keep those as (<number>).
+ */
+
+/* STM32F103C8: 20 KB RAM, 64 KB flash, see STM32F103C8Tx_FLASH.ld */
+#define MEM_RAM_BUDGET (20480)
+#define MEM_FLASH_BUDGET (65536)
+
+/* task stacks, in words */
+#define RX_THREAD_TASK_DEPTH (320)
+#define CSP_ROUTER_TASK_DEPTH (320)
+#define CSP_DISPATCH_HI_TASK_DEPTH (256)
+#define CSP_DISPATCH_LO_TASK_DEPTH (384) /* CSP_PS formats the task list on this stack */
+#define UART_LOG_TASK_DEPTH (256)
+#define TIMER_TASK_DEPTH (320)           /* StatusShare publishes through csp_sendto from the timer task */
+
+/* CAN frame rings, in frames, powers of two */
+#define CSP_QUEUE_LENGTH (64)        /* FIFO0 rx ring */
+#define CSP_QUEUE_LENGTH_HI (16)     /* FIFO1 (CRITICAL/HIGH) rx ring */
+#define CSP_CAN_TX_QUEUE_LENGTH (16) /* tx frames per CSP priority */
+
+#define CAN_REASM_STREAMS (3)         /* CFP packets reassembled at once, CSP_CONF_BUFFER_SIZE each */
+#define CSP_DISPATCH_QUEUE_LENGTH (8) /* packets waiting per handler task */
+#define RUNTIME_STATS_TASKS (10)      /* tasks the run time stats can list, idle and timer included */
+#define RX_LATENCY_BUCKETS (18)       /* log2 microsecond buckets per stage, the last one from 131 ms up */
+#define MEM_HEALTH_TASKS (8)          /* tasks whose stack high water mark is reported */
+#define UART_LOG_RING_SIZE (1024)     /* bytes, must be a power of two */
+
+/* libcsp pools, handed to waf as --with-buffer-count etc. The buffer size must match the
+ * other end of the bus */
+#define CSP_CONF_BUFFER_COUNT (8)
+#define CSP_CONF_BUFFER_SIZE (256)
+#define CSP_CONF_CONN_MAX (4)
+#define CSP_CONF_CONN_QUEUE_LENGTH (8)
+#define CSP_CONF_ROUTER_QUEUE_LENGTH (16)
+
+#endif // MEM_CONFIG_H
@@ -0,0 +1,32 @@
+#ifndef MEM_HEALTH_H
+#define MEM_HEALTH_H
+
+#include <stdint.h>
+#include <csp/csp.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "mem_config.h"
+#include "uavcan_messages.h"
+
+/* nodes/node2/22.MemHealth.uavcan */
+#define MEM_HEALTH_PORT (MEM_HEALTH_ID)
+
+/*
+ * Headroom of everything sized in mem_config.h, kept since boot. The CAN rings count
+ * their own peak and drops (see csp_can_rx_ring_s), this adds the csp buffer pool and
+ * the task stacks.
+ */
+
+/* Lists a task for its stack high water mark, call it once after xTaskCreateStatic().
+ * The idle and timer tasks are added by mem_health itself. */
+void mem_health_task(TaskHandle_t task, uint16_t depth);
+
+/* Samples the free csp buffers. Call it right after csp_buffer_get() with what it returned,
+ * NULL counts as the pool running dry, or with any packet that is being held. libcsp has
+ * no minimum-free figure of its own, so what it takes in between is never seen. */
+void mem_health_buffers(const csp_packet_t *packet);
+
+/* Answers MemHealth requests, bound to MEM_HEALTH_PORT by the csp_dispatch table */
+void mem_health_handler(csp_packet_t *packet);
+
+#endif // MEM_HEALTH_H
@@ -0,0 +1,22 @@
+#ifndef NODE_PING_H
+#define NODE_PING_H
+
+#include <stdint.h>
+#include <csp/csp.h>
+#include "uavcan_messages.h"
+
+/* nodes/node2/30.NodePing.uavcan and 31.NodePong.uavcan */
+#define NODE_PING_PORT (NODE_PING_ID)
+#define NODE_PONG_PORT (NODE_PONG_ID)
+
+typedef struct {
+    uint32_t pings;     /* pings answered */
+    uint32_t malformed; /* pings too short to carry a pinger_id and seq */
+} node_ping_stats_s;
+
+/* Answers NodePing straight from the CSP router, so the pong leaves without a trip
+ * through a handler task. Bound to NODE_PING_PORT by the csp_dispatch table. */
+void node_ping_handler(csp_packet_t *packet);
+void node_ping_get_stats(node_ping_stats_s *stats);
+
+#endif // NODE_PING_H
@@ -0,0 +1,95 @@
+#ifndef RUNTIME_STATS_H
+#define RUNTIME_STATS_H
+
+#include <stdint.h>
+#include <csp/csp.h>
+#include "cpu_load.h"
+#include "mem_config.h"
+#include "uavcan_messages.h"
+
+/* nodes/node2/20.RunTimeStats.uavcan */
+#define RUNTIME_STATS_PORT (RUN_TIME_STATS_ID)
+
+/* CAN vectors with their own time accounting, the order of the isr_ arrays of the answer */
+typedef enum {
+    RUNTIME_ISR_CAN_TX = 0,
+    RUNTIME_ISR_CAN_RX0,
+    RUNTIME_ISR_CAN_RX1,
+    RUNTIME_ISR_CAN_SCE,
+    RUNTIME_ISRS,
+} runtime_isr_e;
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_cycles;
+    uint64_t cycles;
+} runtime_isr_stats_s;
+
+typedef struct {
+    uint32_t depth; /* nesting of the critical sections below, only touched inside one */
+    uint32_t start;
+    uint32_t max_cycles;
+    const char *max_site;
+} runtime_critical_s;
+
+extern runtime_critical_s runtime_critical;
+
+/*
+ * FreeRTOS counts the run time of every task in DWT cycles (configGENERATE_RUN_TIME_STATS),
+ * these two are its portCONFIGURE_TIMER_FOR_RUN_TIME_STATS and portGET_RUN_TIME_COUNTER_VALUE.
+ */
+void runtime_stats_timer_init(void);
+uint32_t runtime_stats_counter(void);
+
+/* call at the end of a CAN interrupt handler with the cpu_cycles() taken at its start */
+void runtime_stats_isr(runtime_isr_e isr, uint32_t start);
+
+static inline void runtime_critical_enter(void) {
+    if (runtime_critical.depth++ == 0) {
+        runtime_critical.start = cpu_cycles();
+    }
+}
+
+static inline void runtime_critical_exit(const char *site) {
+    if (--runtime_critical.depth == 0) {
+        uint32_t cycles = cpu_cycles() - runtime_critical.start;
+        if (cycles > runtime_critical.max_cycles) {
+            runtime_critical.max_cycles = cycles;
+            runtime_critical.max_site = site;
+        }
+    }
+}
+
+/*
+ * taskENTER_CRITICAL()/taskEXIT_CRITICAL() of the application, timed from masking to
+ * unmasking. The longest one and the function it was in go into the run time stats.
+ */
+#define RUNTIME_CRITICAL_ENTER()                                               \
+    do {                                                                       \
+        taskENTER_CRITICAL();                                                  \
+        runtime_critical_enter();                                              \
+    } while (0)
+
+#define RUNTIME_CRITICAL_EXIT()                                                \
+    do {                                                                       \
+        runtime_critical_exit(__func__);                                       \
+        taskEXIT_CRITICAL();                                                   \
+    } while (0)
+
+#define RUNTIME_CRITICAL_ENTER_FROM_ISR(saved)                                 \
+    do {                                                                       \
+        (saved) = taskENTER_CRITICAL_FROM_ISR();                               \
+        runtime_critical_enter();                                              \
+    } while (0)
+
+#define RUNTIME_CRITICAL_EXIT_FROM_ISR(saved)                                  \
+    do {                                                                       \
+        runtime_critical_exit(__func__);                                       \
+        taskEXIT_CRITICAL_FROM_ISR(saved);                                     \
+    } while (0)
+
+/* Answers RunTimeStats requests, bound to RUNTIME_STATS_PORT by the csp_dispatch table.
+ * Walks the task list with the scheduler suspended, so it runs in a handler task. */
+void runtime_stats_handler(csp_packet_t *packet);
+
+#endif // RUNTIME_STATS_H
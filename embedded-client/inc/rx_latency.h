@@ -0,0 +1,60 @@
+#ifndef RX_LATENCY_H
+#define RX_LATENCY_H
+
+#include <stdint.h>
+#include <csp/csp.h>
+#include "mem_config.h"
+#include "csp_dispatch.h"
+#include "uavcan_messages.h"
+
+/* nodes/node2/21.RxLatency.uavcan */
+#define RX_LATENCY_PORT (RX_LATENCY_ID)
+
+/*
+ * Stages of a received packet, all taken with cpu_cycles(). The ring stage counts every
+ * frame, the others one per packet, timed from the frame that completed it.
+ */
+typedef enum {
+    RX_LATENCY_RING = 0, /* rx interrupt to the rx thread taking the frame off the ring */
+    RX_LATENCY_FRAMES,   /* rx interrupt of the first frame to the one of the last */
+    RX_LATENCY_REASM,    /* rx thread taking the last frame to csp_qfifo_write() */
+    RX_LATENCY_ROUTER,   /* csp_qfifo_write() to the router handing it to csp_dispatch */
+    RX_LATENCY_HANDLER,  /* csp_dispatch to the port handler starting, the handler queue wait */
+    RX_LATENCY_TOTAL,    /* rx interrupt of the last frame to the port handler starting */
+    RX_LATENCY_STAGES,
+} rx_latency_stage_e;
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint32_t buckets[RX_LATENCY_BUCKETS];
+} rx_latency_hist_s;
+
+/* Learns the csp buffer pool layout, call it after csp_init() while no buffer is taken */
+void rx_latency_init(void);
+
+/* Adds a ring, frames or reasm sample, only from the CAN rx thread. The other stages are
+ * recorded by the probes below. */
+void rx_latency_record(rx_latency_stage_e stage, uint32_t cycles);
+
+/*
+ * Per packet probes. can_reasm.c starts following a packet right before it goes to the
+ * router, csp_dispatch.c reports when the router hands it over and when its handler
+ * starts, from the task of the target that runs it. Packets that did not come in over
+ * CAN are not followed.
+ */
+void rx_latency_track(const csp_packet_t *packet, uint32_t isr_stamp);
+/* forgets a tracked packet that was dropped before it reached the router */
+void rx_latency_untrack(const csp_packet_t *packet);
+void rx_latency_routed(const csp_packet_t *packet);
+void rx_latency_delivered(const csp_packet_t *packet, csp_dispatch_target_e target);
+
+void rx_latency_get(rx_latency_stage_e stage, rx_latency_hist_s *hist);
+
+/* Answers RxLatency requests, bound to RX_LATENCY_PORT by the csp_dispatch table. A
+ * request with reset set clears the stage in the same step it is read. Must stay on
+ * the CSP_DISPATCH_LO task, see rx_latency_take(). */
+void rx_latency_handler(csp_packet_t *packet);
+
+#endif // RX_LATENCY_H
@@ -0,0 +1,27 @@
+#ifndef STATUS_SHARE_H
+#define STATUS_SHARE_H
+
+#include <stdint.h>
+#include "cspcan.h"
+#include "uavcan_messages.h"
+
+/* nodes/node1/100.StatusShare.uavcan, the request half is what gets broadcast. A CSP
+ * port is only 6 bits wide so the type id cannot be the port, it goes on BCAST_PORT */
+#define STATUS_SHARE_PORT (BCAST_PORT)
+#define STATUS_SHARE_PRIO (CSP_PRIO_LOW)
+#define STATUS_SHARE_PERIOD_MS (1000)
+#define STATUS_SHARE_BOARD_NAME "stm32f103c8"
+#define STATUS_SHARE_FRAMES (CSP_CAN_CFP2_FRAMES(STATUS_SHARE_REQUEST_MAX_SIZE))
+
+typedef struct {
+    uint32_t sent;    /* broadcasts handed to csp_sendto() */
+    uint32_t skipped; /* periods skipped because the tx queue had no room for a whole packet */
+} status_share_stats_s;
+
+/* Starts broadcasting StatusShare to CSP_BROADCAST_ADDR every period_ms from a FreeRTOS
+ * software timer. The packet is taken from the pool once here and reused for every
+ * broadcast, so publishing never allocates and never waits. Call after csp_init(). */
+int status_share_init(const char *board_name, uint32_t period_ms);
+void status_share_get_stats(status_share_stats_s *stats);
+
+#endif // STATUS_SHARE_H
@@ -15,6 +15,7 @@ void DebugMon_Handler(void);
 void RTC_IRQHandler(void);
 void RCC_IRQHandler(void);
 void DMA1_Channel1_IRQHandler(void);
+void DMA1_Channel2_IRQHandler(void);
 void ADC1_2_IRQHandler(void);
 void EXTI1_IRQHandler(void);
 void TIM1_UP_IRQHandler(void);
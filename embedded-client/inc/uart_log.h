@@ -0,0 +1,23 @@
+#ifndef UART_LOG_H
+#define UART_LOG_H
+
+#include <stdint.h>
+#include "mem_config.h"
+
+#define UART_LOG_LINE_MAX (128)   /* longest formatted uart_log() line */
+#define UART_LOG_TASK_PRIO (1)
+
+/* Formats into the log ring and returns immediately, safe to call from tasks and ISRs.
+ * The whole record is dropped, and counted, when the ring has no room for it. */
+void uart_log(const char *format, ...);
+
+/* Queues raw bytes as one record, same rules as uart_log() */
+int uart_log_write(const uint8_t *data, uint16_t len);
+
+/* Creates the low priority task that drains the ring over USART3 TX DMA.
+ * Records logged before the scheduler starts are kept and sent once it runs. */
+void uart_log_init(void);
+
+uint32_t uart_log_overflows(void);
+
+#endif // UART_LOG_H
@@ -8,6 +8,7 @@ extern "C" {
 #include "main.h"
 
 extern UART_HandleTypeDef huart3;
+extern DMA_HandleTypeDef hdma_usart3_tx;
 
 void MX_USART3_UART_Init(void);
 
@@ -14,33 +14,60 @@ void MX_CAN_Init(void) {
   hcan.Init.TimeTriggeredMode = DISABLE;
   hcan.Init.AutoBusOff = DISABLE;
   hcan.Init.AutoWakeUp = DISABLE;
-  hcan.Init.AutoRetransmission = DISABLE;
+  // a fragment that loses arbitration must be retried, otherwise the whole CSP packet is lost
+  hcan.Init.AutoRetransmission = ENABLE;
   hcan.Init.ReceiveFifoLocked = DISABLE;
-  hcan.Init.TransmitFifoPriority = DISABLE;
+  // all three mailboxes are kept busy, send them in request order so fragments do not overtake each other
+  hcan.Init.TransmitFifoPriority = ENABLE;
   if (HAL_CAN_Init(&hcan) != HAL_OK) {
     Error_Handler();
   }
-  // filters
-  CAN_FilterTypeDef canfilter = {0};
-  canfilter.FilterActivation = CAN_FILTER_ENABLE;
-  canfilter.SlaveStartFilterBank = 14;
-  canfilter.FilterBank = 0;
-  canfilter.FilterFIFOAssignment = CAN_FILTER_FIFO0;
-  canfilter.FilterIdHigh = 0x0000;
-  canfilter.FilterIdLow = 0x0000;
-  canfilter.FilterMaskIdHigh = 0x0000;
-  canfilter.FilterMaskIdLow = 0x0000;
-  canfilter.FilterMode = CAN_FILTERMODE_IDMASK;
-  canfilter.FilterScale = CAN_FILTERSCALE_32BIT;
-  HAL_CAN_ConfigFilter(&hcan, &canfilter);
+  // accept everything until can_add_interface() knows our address and narrows the filters down
+  can_filter_accept_all(0, CAN_FILTER_FIFO0);
 
   // enable interrupts
-  HAL_CAN_ActivateNotification(&hcan, CAN_IT_RX_FIFO0_MSG_PENDING | CAN_IT_ERROR | CAN_IT_ERROR_WARNING |
+  HAL_CAN_ActivateNotification(&hcan, CAN_IT_RX_FIFO0_MSG_PENDING | CAN_IT_RX_FIFO1_MSG_PENDING |
+                           CAN_IT_RX_FIFO0_OVERRUN | CAN_IT_RX_FIFO1_OVERRUN | CAN_IT_ERROR | CAN_IT_ERROR_WARNING |
                            CAN_IT_ERROR_PASSIVE | CAN_IT_BUSOFF | CAN_IT_LAST_ERROR_CODE |
                            CAN_IT_TX_MAILBOX_EMPTY | CAN_IT_TX_MAILBOX_EMPTY);
   HAL_CAN_Start(&hcan);
 }
 
+static HAL_StatusTypeDef can_filter_config(uint32_t bank, uint32_t id, uint32_t mask, uint32_t fifo,
+                                           uint32_t activation) {
+  CAN_FilterTypeDef canfilter = {0};
+
+  if (bank >= CAN_FILTER_BANKS) {
+    return HAL_ERROR;
+  }
+
+  canfilter.FilterActivation = activation;
+  canfilter.SlaveStartFilterBank = CAN_FILTER_BANKS;
+  canfilter.FilterBank = bank;
+  canfilter.FilterFIFOAssignment = fifo;
+  canfilter.FilterIdHigh = (id >> 16) & 0xFFFF;
+  canfilter.FilterIdLow = id & 0xFFFF;
+  canfilter.FilterMaskIdHigh = (mask >> 16) & 0xFFFF;
+  canfilter.FilterMaskIdLow = mask & 0xFFFF;
+  canfilter.FilterMode = CAN_FILTERMODE_IDMASK;
+  canfilter.FilterScale = CAN_FILTERSCALE_32BIT;
+  return HAL_CAN_ConfigFilter(&hcan, &canfilter);
+}
+
+HAL_StatusTypeDef can_filter_ext(uint32_t bank, uint32_t id, uint32_t mask, uint32_t fifo) {
+  // 32 bit filter register layout: EXID[28:0] << 3 | IDE | RTR, only extended data frames pass
+  return can_filter_config(bank, (id << 3) | CAN_ID_EXT | CAN_RTR_DATA,
+                           (mask << 3) | CAN_ID_EXT | CAN_RTR_REMOTE, fifo, CAN_FILTER_ENABLE);
+}
+
+HAL_StatusTypeDef can_filter_accept_all(uint32_t bank, uint32_t fifo) {
+  return can_filter_config(bank, 0, 0, fifo, CAN_FILTER_ENABLE);
+}
+
+HAL_StatusTypeDef can_filter_disable(uint32_t bank) {
+  return can_filter_config(bank, 0, 0, CAN_FILTER_FIFO0, CAN_FILTER_DISABLE);
+}
+
 void HAL_CAN_MspInit(CAN_HandleTypeDef *canHandle) {
 
   GPIO_InitTypeDef GPIO_InitStruct = {0};
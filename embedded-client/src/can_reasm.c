@@ -0,0 +1,204 @@
+#include "can_reasm.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "uart_log.h"
+#include "runtime_stats.h"
+#include "rx_latency.h"
+#include "mem_health.h"
+#include <string.h>
+#include <csp/csp_buffer.h>
+#include <csp/csp_interface.h>
+#include <csp/interfaces/csp_if_can.h>
+
+/*
+ * A stream is keyed by the CAN id bits that stay the same for all fragments of one
+ * packet: priority, destination, sender and source counter. The first fragment carries
+ * the rest of the CSP header in 4 bytes, the fragment counter counts modulo 8 and the
+ * END bit closes the packet. A BEGIN fragment takes a free slot, a timed out one or
+ * else the least recently used one; timeouts are only looked for then, an idle bus
+ * costs nothing.
+ */
+
+typedef struct {
+    uint8_t used;
+    uint8_t next_fc; /* fragment counter the next frame must carry */
+    uint16_t length;
+    uint32_t key;
+    TickType_t last_frame;
+    uint32_t first_stamp; /* rx interrupt of the BEGIN frame */
+    csp_id_t id;
+    uint8_t data[CSP_CONF_BUFFER_SIZE];
+} can_reasm_stream_s;
+
+static can_reasm_stream_s can_reasm_streams[CAN_REASM_STREAMS];
+static can_reasm_stats_s can_reasm_stats;
+static uint32_t can_reasm_reported;
+
+static uint32_t can_reasm_open(void) {
+    uint32_t open = 0;
+
+    for (uint32_t i = 0; i < CAN_REASM_STREAMS; i++) {
+        open += can_reasm_streams[i].used;
+    }
+    return open;
+}
+
+static can_reasm_stream_s *can_reasm_find(uint32_t key) {
+    for (uint32_t i = 0; i < CAN_REASM_STREAMS; i++) {
+        if (can_reasm_streams[i].used && can_reasm_streams[i].key == key) {
+            return &can_reasm_streams[i];
+        }
+    }
+    return NULL;
+}
+
+static can_reasm_stream_s *can_reasm_claim(TickType_t now) {
+    can_reasm_stream_s *free_slot = NULL;
+    can_reasm_stream_s *oldest = NULL;
+
+    for (uint32_t i = 0; i < CAN_REASM_STREAMS; i++) {
+        can_reasm_stream_s *stream = &can_reasm_streams[i];
+        if (stream->used && now - stream->last_frame >= pdMS_TO_TICKS(CAN_REASM_TIMEOUT_MS)) {
+            stream->used = 0;
+            can_reasm_stats.timed_out++;
+        }
+        if (!stream->used) {
+            if (!free_slot) {
+                free_slot = stream;
+            }
+        } else if (!oldest || now - stream->last_frame > now - oldest->last_frame) {
+            oldest = stream;
+        }
+    }
+
+    if (free_slot) {
+        return free_slot;
+    }
+    can_reasm_stats.evicted++;
+    return oldest;
+}
+
+static int can_reasm_deliver(csp_iface_t *iface, can_reasm_stream_s *stream, uint32_t stamp, uint32_t popped) {
+    stream->used = 0;
+
+    csp_packet_t *packet = csp_buffer_get(0);
+    mem_health_buffers(packet);
+    if (!packet) {
+        can_reasm_stats.no_buffer++;
+        iface->rx_error++;
+        return 0;
+    }
+
+    packet->id = stream->id;
+    packet->length = stream->length;
+    memcpy(packet->data, stream->data, stream->length);
+    rx_latency_record(RX_LATENCY_FRAMES, stamp - stream->first_stamp);
+    rx_latency_record(RX_LATENCY_REASM, cpu_cycles() - popped);
+    rx_latency_track(packet, stamp);
+
+    // csp_qfifo_write() frees the packet itself when the fifo is full, drop is the only trace
+    uint32_t drop = iface->drop;
+    csp_qfifo_write(packet, iface, NULL);
+    if (iface->drop != drop) {
+        rx_latency_untrack(packet);
+        can_reasm_stats.router_full++;
+        return 0;
+    }
+    can_reasm_stats.completed++;
+    return 1;
+}
+
+int can_reasm_rx(csp_iface_t *iface, uint32_t id, const uint8_t *data, uint8_t dlc, uint32_t stamp) {
+    uint32_t popped = cpu_cycles();
+    uint32_t key = id & CFP2_ID_CONN_MASK;
+    uint8_t fc = (id >> CFP2_FC_OFFSET) & CFP2_FC_MASK;
+    TickType_t now = xTaskGetTickCount();
+    can_reasm_stream_s *stream = can_reasm_find(key);
+
+    if (stream && now - stream->last_frame >= pdMS_TO_TICKS(CAN_REASM_TIMEOUT_MS)) {
+        stream->used = 0;
+        can_reasm_stats.timed_out++;
+        stream = NULL;
+    }
+
+    if (id & (CFP2_BEGIN_MASK << CFP2_BEGIN_OFFSET)) {
+        if (dlc < 4) {
+            iface->frame++;
+            return 0;
+        }
+        if (stream) {
+            // the sender gave up on the previous packet and started over
+            can_reasm_stats.aborted++;
+        } else {
+            stream = can_reasm_claim(now);
+        }
+
+        uint32_t header = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+        stream->used = 1;
+        stream->key = key;
+        stream->id.pri = (id >> CFP2_PRIO_OFFSET) & CFP2_PRIO_MASK;
+        stream->id.dst = (id >> CFP2_DST_OFFSET) & CFP2_DST_MASK;
+        stream->id.src = (header >> CFP2_SRC_OFFSET) & CFP2_SRC_MASK;
+        stream->id.dport = (header >> CFP2_DPORT_OFFSET) & CFP2_DPORT_MASK;
+        stream->id.sport = (header >> CFP2_SPORT_OFFSET) & CFP2_SPORT_MASK;
+        stream->id.flags = (header >> CFP2_FLAGS_OFFSET) & CFP2_FLAGS_MASK;
+        stream->length = 0;
+        stream->next_fc = fc;
+        stream->first_stamp = stamp;
+        data += 4;
+        dlc -= 4;
+
+        uint32_t open = can_reasm_open();
+        if (open > can_reasm_stats.peak) {
+            can_reasm_stats.peak = open;
+        }
+    } else if (!stream) {
+        can_reasm_stats.orphans++;
+        iface->frame++;
+        return 0;
+    }
+
+    if (fc != stream->next_fc || stream->length + dlc > sizeof(stream->data)) {
+        stream->used = 0;
+        can_reasm_stats.aborted++;
+        iface->frame++;
+        return 0;
+    }
+
+    memcpy(&stream->data[stream->length], data, dlc);
+    stream->length += dlc;
+    stream->next_fc = (fc + 1) & CFP2_FC_MASK;
+    stream->last_frame = now;
+
+    if (id & (CFP2_END_MASK << CFP2_END_OFFSET)) {
+        return can_reasm_deliver(iface, stream, stamp, popped);
+    }
+    return 0;
+}
+
+void can_reasm_get_stats(can_reasm_stats_s *stats) {
+    if (!stats) {
+        return;
+    }
+
+    RUNTIME_CRITICAL_ENTER();
+    *stats = can_reasm_stats;
+    RUNTIME_CRITICAL_EXIT();
+}
+
+void can_reasm_report(void) {
+    can_reasm_stats_s s;
+
+    can_reasm_get_stats(&s);
+    uint32_t total = s.completed + s.evicted + s.timed_out + s.aborted + s.orphans + s.no_buffer + s.router_full;
+    if (total == can_reasm_reported) {
+        return;
+    }
+    can_reasm_reported = total;
+
+    uart_log("reasm: completed %lu evicted %lu timed out %lu aborted %lu orphans %lu no buffer %lu router full %lu "
+             "peak %lu/%u\n",
+             (unsigned long)s.completed, (unsigned long)s.evicted, (unsigned long)s.timed_out,
+             (unsigned long)s.aborted, (unsigned long)s.orphans, (unsigned long)s.no_buffer,
+             (unsigned long)s.router_full, (unsigned long)s.peak, (unsigned)CAN_REASM_STREAMS);
+}
@@ -0,0 +1,52 @@
+#include "cpu_load.h"
+#include "uart_log.h"
+
+static uint32_t task_load_run_time(TaskHandle_t task) {
+    TaskStatus_t status;
+
+    vTaskGetInfo(task, &status, pdFALSE, eInvalid);
+    return status.ulRunTimeCounter;
+}
+
+void task_load_start(task_load_s *load, const char *name) {
+    load->name = name;
+    load->task = xTaskGetCurrentTaskHandle();
+    task_load_reset(load);
+}
+
+void task_load_reset(task_load_s *load) {
+    load->wakeups = 0;
+    load->blocked_ticks = 0;
+    load->window_start = xTaskGetTickCount();
+    load->tick_mark = load->window_start;
+    load->run_mark = task_load_run_time(load->task);
+#ifdef HOST_BUILD
+    load->total_mark = portGET_RUN_TIME_COUNTER_VALUE();
+#endif
+}
+
+uint32_t task_load_permille(const task_load_s *load) {
+    uint64_t busy = task_load_run_time(load->task) - load->run_mark;
+#ifdef HOST_BUILD
+    uint64_t window = (uint32_t)(portGET_RUN_TIME_COUNTER_VALUE() - load->total_mark);
+#else
+    uint64_t window = (uint64_t)(xTaskGetTickCount() - load->window_start) * (SystemCoreClock / configTICK_RATE_HZ);
+#endif
+
+    if (window == 0) {
+        return 0;
+    }
+
+    uint64_t permille = (busy * 1000u) / window;
+    return (permille > 1000u) ? 1000u : (uint32_t)permille;
+}
+
+void task_load_report(const task_load_s *load) {
+    uint32_t permille = task_load_permille(load);
+    uint32_t window_ticks = xTaskGetTickCount() - load->window_start;
+
+    uart_log("%s: cpu %lu.%lu%%, blocked %lu of %lu ms, %lu wakeups\n", load->name,
+             (unsigned long)(permille / 10), (unsigned long)(permille % 10),
+             (unsigned long)(load->blocked_ticks * portTICK_PERIOD_MS),
+             (unsigned long)(window_ticks * portTICK_PERIOD_MS), (unsigned long)load->wakeups);
+}
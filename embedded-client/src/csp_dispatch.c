@@ -0,0 +1,202 @@
+#include "csp_dispatch.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "cpu_load.h"
+#include "node_ping.h"
+#include "runtime_stats.h"
+#include "rx_latency.h"
+#include "mem_health.h"
+#include "uart_log.h"
+#include <csp/csp.h>
+#include <csp/csp_error.h>
+
+static void csp_dispatch_log_packet(csp_packet_t *packet);
+
+/*
+ * Cheap services answer straight from the router, anything that formats text or may
+ * take long goes to a handler task. Ports without an entry end up in the CSP_ANY one.
+ * A reply sent from the router is dropped rather than waited for when the CAN tx queue
+ * is full, a busy bus must not stop routing.
+ */
+static const csp_dispatch_entry_s csp_dispatch_table[] = {
+    {CSP_CMP,        CSP_DISPATCH_HI,     csp_service_handler,     "cmp"},
+    {CSP_PING,       CSP_DISPATCH_ROUTER, csp_service_handler,     "ping"},
+    {CSP_PS,         CSP_DISPATCH_LO,     csp_service_handler,     "ps"},
+    {CSP_MEMFREE,    CSP_DISPATCH_ROUTER, csp_service_handler,     "memfree"},
+    {CSP_REBOOT,     CSP_DISPATCH_HI,     csp_service_handler,     "reboot"},
+    {CSP_BUF_FREE,   CSP_DISPATCH_ROUTER, csp_service_handler,     "buf_free"},
+    {CSP_UPTIME,     CSP_DISPATCH_ROUTER, csp_service_handler,     "uptime"},
+    {NODE_PING_PORT, CSP_DISPATCH_ROUTER, node_ping_handler,       "node_ping"},
+    {RUNTIME_STATS_PORT, CSP_DISPATCH_LO, runtime_stats_handler,   "runtime_stats"},
+    {RX_LATENCY_PORT, CSP_DISPATCH_LO,    rx_latency_handler,      "rx_latency"},
+    {MEM_HEALTH_PORT, CSP_DISPATCH_LO,    mem_health_handler,      "mem_health"},
+    {CSP_ANY,        CSP_DISPATCH_LO,     csp_dispatch_log_packet, "any"},
+};
+
+#define CSP_DISPATCH_ENTRIES (sizeof(csp_dispatch_table) / sizeof(csp_dispatch_table[0]))
+#define CSP_DISPATCH_PORTS (64) /* 6 bit CSP port */
+
+typedef struct {
+    csp_packet_t *packet;
+    uint8_t entry;
+    uint32_t received; /* cpu_cycles() when the router handed it over */
+} csp_dispatch_item_s;
+
+typedef struct {
+    const char *name;
+    UBaseType_t prio;
+    uint16_t depth;
+    StackType_t *stack;
+    QueueHandle_t queue;
+    StaticTask_t tcb;
+    StaticQueue_t queue_buf;
+    uint8_t queue_storage[CSP_DISPATCH_QUEUE_LENGTH * sizeof(csp_dispatch_item_s)];
+} csp_dispatch_task_s;
+
+static StackType_t csp_dispatch_hi_stack[CSP_DISPATCH_HI_TASK_DEPTH];
+static StackType_t csp_dispatch_lo_stack[CSP_DISPATCH_LO_TASK_DEPTH];
+
+static csp_dispatch_task_s csp_dispatch_tasks[CSP_DISPATCH_TASKS] = {
+    [CSP_DISPATCH_HI - 1] = {"csp_handler_hi", CSP_DISPATCH_HI_TASK_PRIO, CSP_DISPATCH_HI_TASK_DEPTH,
+                             csp_dispatch_hi_stack},
+    [CSP_DISPATCH_LO - 1] = {"csp_handler_lo", CSP_DISPATCH_LO_TASK_PRIO, CSP_DISPATCH_LO_TASK_DEPTH,
+                             csp_dispatch_lo_stack},
+};
+
+static csp_dispatch_stats_s csp_dispatch_stats[CSP_DISPATCH_ENTRIES];
+static uint8_t csp_dispatch_port_entry[CSP_DISPATCH_PORTS]; /* table index per port */
+
+static void csp_dispatch_run(uint8_t entry, csp_packet_t *packet, uint32_t received) {
+    rx_latency_delivered(packet, csp_dispatch_table[entry].target);
+    csp_dispatch_table[entry].handler(packet);
+
+    csp_dispatch_stats_s *stats = &csp_dispatch_stats[entry];
+    uint32_t us = (cpu_cycles() - received) / (SystemCoreClock / 1000000U);
+    stats->packets++;
+    stats->latency_total_us += us;
+    if (us > stats->latency_max_us) {
+        stats->latency_max_us = us;
+    }
+}
+
+/* the one csp_bind_callback() of every port, runs in the router task */
+static void csp_dispatch_callback(csp_packet_t *packet) {
+    uint32_t received = cpu_cycles();
+    uint8_t entry = csp_dispatch_port_entry[packet->id.dport & (CSP_DISPATCH_PORTS - 1)];
+    const csp_dispatch_entry_s *e = &csp_dispatch_table[entry];
+
+    rx_latency_routed(packet);
+    mem_health_buffers(packet);
+    if (e->target == CSP_DISPATCH_ROUTER) {
+        csp_dispatch_run(entry, packet, received);
+        return;
+    }
+
+    csp_dispatch_task_s *task = &csp_dispatch_tasks[e->target - 1];
+    csp_dispatch_stats_s *stats = &csp_dispatch_stats[entry];
+    csp_dispatch_item_s item = {packet, entry, received};
+
+    if (xQueueSend(task->queue, &item, 0) != pdTRUE) {
+        stats->dropped++;
+        csp_buffer_free(packet);
+        return;
+    }
+
+    uint32_t depth = uxQueueMessagesWaiting(task->queue);
+    if (depth > stats->queue_peak) {
+        stats->queue_peak = depth;
+    }
+}
+
+static void csp_dispatch_task(void *data) {
+    csp_dispatch_task_s *task = data;
+    csp_dispatch_item_s item;
+
+    while (1) {
+        if (xQueueReceive(task->queue, &item, portMAX_DELAY) == pdTRUE) {
+            csp_dispatch_run(item.entry, item.packet, item.received);
+        }
+    }
+}
+
+static void csp_dispatch_log_packet(csp_packet_t *packet) {
+    uart_log("CSP Packet Received\n Incoming Port: %d\tSenderPort: %d\tSender ID: %u\tPacket Length: %d\n",
+             packet->id.dport, packet->id.sport, packet->id.src, packet->length);
+    csp_buffer_free(packet);
+}
+
+int csp_dispatch_init(void) {
+    uint8_t any = CSP_DISPATCH_ENTRIES;
+
+    for (uint8_t i = 0; i < CSP_DISPATCH_ENTRIES; i++) {
+        if (csp_dispatch_table[i].port == CSP_ANY) {
+            any = i;
+        }
+    }
+    if (any == CSP_DISPATCH_ENTRIES) {
+        uart_log("CSP dispatch table has no CSP_ANY entry\n");
+        return -1;
+    }
+
+    for (uint8_t port = 0; port < CSP_DISPATCH_PORTS; port++) {
+        csp_dispatch_port_entry[port] = any;
+    }
+    for (uint8_t i = 0; i < CSP_DISPATCH_ENTRIES; i++) {
+        if (i != any) {
+            csp_dispatch_port_entry[csp_dispatch_table[i].port] = i;
+        }
+    }
+
+    for (uint32_t i = 0; i < CSP_DISPATCH_TASKS; i++) {
+        csp_dispatch_task_s *task = &csp_dispatch_tasks[i];
+        task->queue = xQueueCreateStatic(CSP_DISPATCH_QUEUE_LENGTH, sizeof(csp_dispatch_item_s),
+                                         task->queue_storage, &task->queue_buf);
+        TaskHandle_t handle = NULL;
+        if (task->queue) {
+            handle = xTaskCreateStatic(csp_dispatch_task, task->name, task->depth, task, task->prio, task->stack,
+                                       &task->tcb);
+        }
+        if (!handle) {
+            uart_log("CSP dispatch cannot start %s\n", task->name);
+            return -1;
+        }
+        mem_health_task(handle, task->depth);
+    }
+
+    int ret = CSP_ERR_NONE;
+    for (uint8_t i = 0; i < CSP_DISPATCH_ENTRIES; i++) {
+        int err = csp_bind_callback(csp_dispatch_callback, csp_dispatch_table[i].port);
+        if (err != CSP_ERR_NONE) {
+            uart_log("CSP dispatch cannot bind %s port %d: %d\n", csp_dispatch_table[i].name,
+                     csp_dispatch_table[i].port, err);
+            ret = err;
+        }
+    }
+
+    return ret;
+}
+
+int csp_dispatch_get_stats(uint8_t port, csp_dispatch_stats_s *stats) {
+    if (!stats || port >= CSP_DISPATCH_PORTS) {
+        return -1;
+    }
+
+    *stats = csp_dispatch_stats[csp_dispatch_port_entry[port]];
+    return 0;
+}
+
+void csp_dispatch_report(void) {
+    for (uint8_t i = 0; i < CSP_DISPATCH_ENTRIES; i++) {
+        const csp_dispatch_stats_s *stats = &csp_dispatch_stats[i];
+        if (stats->packets == 0 && stats->dropped == 0) {
+            continue;
+        }
+
+        uart_log("CSP port %s: packets %lu dropped %lu queue peak %lu, us avg %lu max %lu\n",
+                 csp_dispatch_table[i].name, (unsigned long)stats->packets, (unsigned long)stats->dropped,
+                 (unsigned long)stats->queue_peak,
+                 (unsigned long)(stats->packets ? stats->latency_total_us / stats->packets : 0),
+                 (unsigned long)stats->latency_max_us);
+    }
+}
@@ -0,0 +1,49 @@
+#include "csp_trace.h"
+#include "uart_log.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "stm32f1xx_hal.h"
+#include <stddef.h>
+#include <string.h>
+
+_Static_assert(CSP_TRACE_HEADER_SIZE == 26, "decoder in rust-server/csp-trace expects a 26 byte header");
+
+void csp_trace_packet(csp_trace_dir_e dir, const csp_id_t *id, const csp_packet_t *packet, const csp_iface_t *iface,
+                      uint16_t via) {
+    csp_trace_record_s rec;
+
+    if (!id || !packet) {
+        return;
+    }
+
+    rec.sync[0] = CSP_TRACE_SYNC0;
+    rec.sync[1] = CSP_TRACE_SYNC1;
+    rec.version = CSP_TRACE_VERSION;
+    rec.dir = dir;
+    rec.timestamp = (__get_IPSR() != 0) ? xTaskGetTickCountFromISR() : xTaskGetTickCount();
+    rec.src = id->src;
+    rec.dst = id->dst;
+    rec.dport = id->dport;
+    rec.sport = id->sport;
+    rec.pri = id->pri;
+    rec.flags = id->flags;
+    rec.length = packet->length;
+    rec.via = via;
+    memset(rec.iface, 0, sizeof(rec.iface));
+    if (iface && iface->name) {
+        strncpy(rec.iface, iface->name, sizeof(rec.iface));
+    }
+    rec.payload_len = (packet->length > CSP_TRACE_PAYLOAD_MAX) ? CSP_TRACE_PAYLOAD_MAX : packet->length;
+    memcpy(rec.payload, packet->data, rec.payload_len);
+
+    uint8_t sum = 0;
+    rec.checksum = 0;
+    const uint8_t *raw = (const uint8_t *)&rec;
+    for (size_t i = sizeof(rec.sync); i < CSP_TRACE_HEADER_SIZE + rec.payload_len; i++) {
+        sum += raw[i];
+    }
+    rec.checksum = sum;
+
+    // one copy into the log ring, no formatting at all on the MCU
+    uart_log_write(raw, CSP_TRACE_HEADER_SIZE + rec.payload_len);
+}
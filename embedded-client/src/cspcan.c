@@ -4,10 +4,20 @@
 #include "task.h"
 #include "semphr.h"
 #include "queue.h"
+#include "timers.h"
 #include "main.h"
+#include "uart_log.h"
+#include "csp_trace.h"
+#include "cpu_load.h"
+#include "csp_dispatch.h"
+#include "can_reasm.h"
+#include "runtime_stats.h"
+#include "rx_latency.h"
+#include "mem_health.h"
 #include "stm32f1xx_hal.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <csp/csp.h>
 #include <csp/csp_interface.h>
 #include <csp/csp_error.h>
@@ -18,39 +28,125 @@ csp_iface_t csp_if_can1 = {
     .name = "CAN1"
 };
 
+static TaskHandle_t csp_router_task;
+static csp_router_stats_s csp_router_stats;
+static task_load_s csp_router_load;
+static task_load_s csp_rx_load;
+
+static StaticTask_t csp_rx_task_tcb;
+static StackType_t csp_rx_task_stack[RX_THREAD_TASK_DEPTH];
+static StaticSemaphore_t csp_can_tx_sem_buf;
+
+static csp_can_msg_s csp_can_rx_frames[CSP_QUEUE_LENGTH];
+static csp_can_msg_s csp_can_rx_frames_hi[CSP_QUEUE_LENGTH_HI];
+static uint32_t csp_can_rx_stamps[CSP_QUEUE_LENGTH];
+static uint32_t csp_can_rx_stamps_hi[CSP_QUEUE_LENGTH_HI];
+
 static csp_can_s csp_can_ctx = {
-    .iface = &csp_if_can1
+    .iface = &csp_if_can1,
+    .rx_ring = {
+        [CAN_RX_FIFO0] = { .frames = csp_can_rx_frames, .stamps = csp_can_rx_stamps,
+                           .mask = CSP_QUEUE_LENGTH - 1 },
+        [CAN_RX_FIFO1] = { .frames = csp_can_rx_frames_hi, .stamps = csp_can_rx_stamps_hi,
+                           .mask = CSP_QUEUE_LENGTH_HI - 1 },
+    },
 };
 
-extern void uart_log(const char *format, ...);
+_Static_assert((CSP_QUEUE_LENGTH & (CSP_QUEUE_LENGTH - 1)) == 0, "CSP_QUEUE_LENGTH must be a power of two");
+_Static_assert((CSP_CAN_TX_QUEUE_LENGTH & (CSP_CAN_TX_QUEUE_LENGTH - 1)) == 0,
+               "CSP_CAN_TX_QUEUE_LENGTH must be a power of two");
+_Static_assert((CSP_QUEUE_LENGTH_HI & (CSP_QUEUE_LENGTH_HI - 1)) == 0, "CSP_QUEUE_LENGTH_HI must be a power of two");
+
+/* cmake configures libcsp from mem_config.h, a mismatch means a stale libcsp build */
+_Static_assert(CSP_BUFFER_COUNT == CSP_CONF_BUFFER_COUNT, "libcsp CSP_BUFFER_COUNT differs from mem_config.h");
+_Static_assert(CSP_BUFFER_SIZE == CSP_CONF_BUFFER_SIZE, "libcsp CSP_BUFFER_SIZE differs from mem_config.h");
+_Static_assert(CSP_CONN_MAX == CSP_CONF_CONN_MAX, "libcsp CSP_CONN_MAX differs from mem_config.h");
+_Static_assert(CSP_CONN_RXQUEUE_LEN == CSP_CONF_CONN_QUEUE_LENGTH, "libcsp CSP_CONN_RXQUEUE_LEN differs from mem_config.h");
+_Static_assert(CSP_QFIFO_LEN == CSP_CONF_ROUTER_QUEUE_LENGTH, "libcsp CSP_QFIFO_LEN differs from mem_config.h");
 
 static void csp_can_tx_frame_cb(void); //
-static void csp_can_rx_frame_cb(uint32_t addr, uint8_t *data, uint8_t len); //
+static uint32_t csp_can_tx_pump(csp_can_s *csp_can); //
+static void csp_can_rx_fifo_drain(CAN_HandleTypeDef *hcan, uint32_t fifo); //
 static void csp_can_rx_thread(void* data); //
+static int csp_can_filter_apply(csp_can_s *csp_can); //
 static int csp_can_tx_frame(void *driver_data, uint32_t id, const uint8_t * data, uint8_t dlc);//
-uint8_t hal_can_write(CAN_HandleTypeDef *can, uint32_t addr, uint8_t *data, uint8_t len);//
+uint8_t hal_can_write(CAN_HandleTypeDef *can, uint32_t addr, const uint8_t *data, uint8_t len);//
 
 
+#ifdef __arm__
 /* Provide a simple implementation of GCC's __sync_synchronize()
    which acts as a full memory barrier on Cortex-M3 (dmb). */
 void __sync_synchronize(void) {
     __asm volatile ("dmb" ::: "memory");
 }
+#endif
 
 // interrupt callback functions
 void HAL_CAN_RxFifo0MsgPendingCallback(CAN_HandleTypeDef *hcan) {
-    CAN_RxHeaderTypeDef header;
-    uint8_t data[8];
-    if (HAL_CAN_GetRxMessage(hcan, CAN_RX_FIFO0, &header, data) == HAL_OK) {
-        // call our CSP related new callback here
-        csp_can_rx_frame_cb(header.ExtId, data, header.DLC);
+    // move everything pending in the hw fifo into the rx ring in one go
+    csp_can_rx_fifo_drain(hcan, CAN_RX_FIFO0);
+}
+
+void HAL_CAN_RxFifo1MsgPendingCallback(CAN_HandleTypeDef *hcan) {
+    // CRITICAL/HIGH priority frames, see csp_can_filter_apply()
+    csp_can_rx_fifo_drain(hcan, CAN_RX_FIFO1);
+}
+
+void HAL_CAN_ErrorCallback(CAN_HandleTypeDef *hcan) {
+    if (hcan->ErrorCode & HAL_CAN_ERROR_RX_FOV0) {
+        csp_can_ctx.rx_fifo_overruns[CAN_RX_FIFO0]++;
+    }
+    if (hcan->ErrorCode & HAL_CAN_ERROR_RX_FOV1) {
+        csp_can_ctx.rx_fifo_overruns[CAN_RX_FIFO1]++;
+    }
+    const uint32_t tx_failed = HAL_CAN_ERROR_TX_ALST0 | HAL_CAN_ERROR_TX_TERR0 | HAL_CAN_ERROR_TX_ALST1 |
+                               HAL_CAN_ERROR_TX_TERR1 | HAL_CAN_ERROR_TX_ALST2 | HAL_CAN_ERROR_TX_TERR2;
+    uint32_t tx_error = hcan->ErrorCode & tx_failed;
+
+    // overruns and failed mailboxes are counted here, do not let them fail the next transmit in hal_can_write()
+    hcan->ErrorCode &= ~(HAL_CAN_ERROR_RX_FOV0 | HAL_CAN_ERROR_RX_FOV1 | tx_failed);
+
+    if (tx_error) {
+        // a mailbox was released without sending, refill it
+        csp_can_ctx.tx_errors++;
+        csp_can_tx_frame_cb();
     }
 }
 
+// all three mailboxes complete into the same tx engine, assuming only one can here as well
 void HAL_CAN_TxMailbox0CompleteCallback(CAN_HandleTypeDef *hcan) {
-    // call our CSP related new callback here
-    // assuming only one can here as well
     (void)hcan;
+    csp_can_ctx.tx_frames++;
+    csp_can_tx_frame_cb();
+}
+
+void HAL_CAN_TxMailbox1CompleteCallback(CAN_HandleTypeDef *hcan) {
+    (void)hcan;
+    csp_can_ctx.tx_frames++;
+    csp_can_tx_frame_cb();
+}
+
+void HAL_CAN_TxMailbox2CompleteCallback(CAN_HandleTypeDef *hcan) {
+    (void)hcan;
+    csp_can_ctx.tx_frames++;
+    csp_can_tx_frame_cb();
+}
+
+void HAL_CAN_TxMailbox0AbortCallback(CAN_HandleTypeDef *hcan) {
+    (void)hcan;
+    csp_can_ctx.tx_errors++;
+    csp_can_tx_frame_cb();
+}
+
+void HAL_CAN_TxMailbox1AbortCallback(CAN_HandleTypeDef *hcan) {
+    (void)hcan;
+    csp_can_ctx.tx_errors++;
+    csp_can_tx_frame_cb();
+}
+
+void HAL_CAN_TxMailbox2AbortCallback(CAN_HandleTypeDef *hcan) {
+    (void)hcan;
+    csp_can_ctx.tx_errors++;
     csp_can_tx_frame_cb();
 }
 
@@ -58,52 +154,152 @@ int can_add_interface(uint16_t node_id, uint16_t netmask)
 {
     csp_can_s * csp_can = &csp_can_ctx;
 
-    csp_can->tx_sem = xSemaphoreCreateBinary();
-    xSemaphoreGive(csp_can->tx_sem);
+    csp_can->tx_sem = xSemaphoreCreateBinaryStatic(&csp_can_tx_sem_buf);
 
     csp_can->iface->interface_data = &csp_can->ifdata;
     csp_can->iface->addr = node_id;
     csp_can->iface->netmask = netmask;
     csp_can->iface->driver_data = csp_can;
     csp_can->ifdata.tx_func = csp_can_tx_frame;
-    csp_can->ifdata.pbufs = NULL;
+    csp_can->ifdata.pbufs = NULL; /* rx reassembly is can_reasm.c, libcsp only transmits */
+    csp_can->filter_mode = CSP_CAN_FILTER_MODE_DEFAULT;
+    csp_can->filter_netmask = netmask;
 
     if (csp_can_add_interface(csp_can->iface) != CSP_ERR_NONE) {
         return 1;
     }
     csp_rtable_set(node_id, CSP_NETMASK_MAX_NUMBER_OF_BITS, csp_can->iface, CSP_NO_VIA);
 
-    csp_can->rx_queue = xQueueCreate(CSP_QUEUE_LENGTH, sizeof(csp_can_msg_s));
-    xTaskCreate(csp_can_rx_thread, "csp_rx_thread", RX_THREAD_TASK_DEPTH, &csp_can_ctx, 3, NULL);
+    // from now on only frames for us reach the CPU
+    if (csp_can_filter_apply(csp_can) != 0) {
+        return 1;
+    }
+
+    csp_can->rx_task = xTaskCreateStatic(csp_can_rx_thread, "csp_rx_thread", RX_THREAD_TASK_DEPTH, &csp_can_ctx,
+                                         CSP_RX_TASK_PRIO, csp_rx_task_stack, &csp_rx_task_tcb);
+    mem_health_task(csp_can->rx_task, RX_THREAD_TASK_DEPTH);
 
     return 0;
 }
 
-static void csp_can_rx_frame_cb(uint32_t addr, uint8_t *data, uint8_t len) {
-    int task_woken = pdTRUE;
-    if (len > 8) {
-        return;
-    }
+static void csp_can_rx_fifo_drain(CAN_HandleTypeDef *hcan, uint32_t fifo) {
+    csp_can_rx_ring_s *ring = &csp_can_ctx.rx_ring[fifo];
+    CAN_RxHeaderTypeDef header;
+    BaseType_t task_woken = pdFALSE;
+    uint32_t received = 0;
+    // the hw fifo is only 3 deep, one stamp per ISR entry is close enough for every frame
+    uint32_t stamp = cpu_cycles();
+
+    csp_can_ctx.rx_isr_entries++;
+
+    while (HAL_CAN_GetRxFifoFillLevel(hcan, fifo) > 0) {
+        uint32_t head = ring->head;
+        uint32_t used = head - ring->tail;
+
+        if (used > ring->mask) {
+            // ring is full, release the hw fifo slot anyway so the ISR does not fire again
+            uint8_t discard[CAN_MAX_DLC];
+            HAL_CAN_GetRxMessage(hcan, fifo, &header, discard);
+            ring->dropped++;
+            continue;
+        }
+
+        // read straight into the ring slot, no intermediate copy
+        csp_can_msg_s *msg = &ring->frames[head & ring->mask];
+        if (HAL_CAN_GetRxMessage(hcan, fifo, &header, msg->data) != HAL_OK) {
+            break;
+        }
+        msg->id = header.ExtId;
+        if (header.RTR == CAN_RTR_REMOTE) {
+            msg->id |= CAN_RTR_FLAG;
+        }
+        msg->dlc = header.DLC;
+        ring->stamps[head & ring->mask] = stamp;
 
-    csp_can_msg_s msg = {
-        .id = addr,
-        .dlc = len,
-    };
+        // slot contents must be visible before the consumer sees the new head
+        __DMB();
+        ring->head = head + 1;
+        received++;
 
-    for (uint8_t i = 0; i<len; i++) {
-        msg.data[i] = *(data + i);
+        if (used + 1 > ring->peak) {
+            ring->peak = used + 1;
+        }
     }
 
-    csp_queue_enqueue_isr(csp_can_ctx.rx_queue, &msg, &task_woken);
+    csp_can_ctx.rx_frames += received;
 
+    // one notification per ISR entry, the thread drains everything that is in the ring
+    if (received && csp_can_ctx.rx_task != NULL) {
+        vTaskNotifyGiveFromISR(csp_can_ctx.rx_task, &task_woken);
+    }
     portYIELD_FROM_ISR(task_woken);
 }
 
 static void csp_can_tx_frame_cb(void) {
+    BaseType_t task_woken = pdFALSE;
+
+    UBaseType_t saved;
+    RUNTIME_CRITICAL_ENTER_FROM_ISR(saved);
+    uint32_t moved = csp_can_tx_pump(&csp_can_ctx);
+    RUNTIME_CRITICAL_EXIT_FROM_ISR(saved);
 
-    BaseType_t task_woken = 1;
-    xSemaphoreGiveFromISR(csp_can_ctx.tx_sem, &task_woken);
-    portYIELD_FROM_ISR (task_woken);
+    // queue slots were freed, a sender may be waiting for them
+    if (moved && csp_can_ctx.tx_sem != NULL) {
+        xSemaphoreGiveFromISR(csp_can_ctx.tx_sem, &task_woken);
+    }
+    portYIELD_FROM_ISR(task_woken);
+}
+
+/* Moves frames from the software queues into every free mailbox, highest CSP priority first.
+ * Once a fragment fails to load, the rest of its packet is dropped from the queue instead of sent.
+ * Must be called with the CAN interrupts masked. Returns the number of queue slots freed. */
+static uint32_t csp_can_tx_pump(csp_can_s *csp_can) {
+    uint32_t moved = 0;
+
+    while (HAL_CAN_GetTxMailboxesFreeLevel(&hcan) > 0) {
+        csp_can_tx_queue_s *queue = NULL;
+        for (uint32_t prio = 0; prio < CSP_CAN_TX_PRIOS; prio++) {
+            if (csp_can->tx_queue[prio].head != csp_can->tx_queue[prio].tail) {
+                queue = &csp_can->tx_queue[prio];
+                break;
+            }
+        }
+        if (queue == NULL) {
+            break;
+        }
+
+        csp_can_msg_s *msg = &queue->frames[queue->tail & (CSP_CAN_TX_QUEUE_LENGTH - 1)];
+        queue->tail++;
+        moved++;
+
+        uint32_t begin = msg->id & (CFP2_BEGIN_MASK << CFP2_BEGIN_OFFSET);
+        uint32_t end = msg->id & (CFP2_END_MASK << CFP2_END_OFFSET);
+        if (queue->discarding && (msg->id & CFP2_ID_CONN_MASK) == queue->discard_key) {
+            if (!begin) {
+                csp_can->tx_discarded++;
+                queue->discarding = !end;
+                continue;
+            }
+            // the next packet of the same sender, it goes out whole
+            queue->discarding = 0;
+        }
+
+        uint8_t result = hal_can_write(&hcan, msg->id, msg->data, msg->dlc);
+        if (result == 2) {
+            // a stale error flag was just cleared, the controller itself is fine
+            result = hal_can_write(&hcan, msg->id, msg->data, msg->dlc);
+        }
+        if (result != 0) {
+            csp_can->tx_errors++;
+            // the receiver aborts the packet at the gap, the rest of its train would only take bus time
+            if (!end) {
+                queue->discard_key = msg->id & CFP2_ID_CONN_MASK;
+                queue->discarding = 1;
+            }
+        }
+    }
+
+    return moved;
 }
 
 static int csp_can_tx_frame(void *driver_data, uint32_t id, const uint8_t * data, uint8_t dlc) {
@@ -116,25 +312,59 @@ static int csp_can_tx_frame(void *driver_data, uint32_t id, const uint8_t * data
         return 1;
     }
 
-    uint8_t local_data[CAN_MAX_DLC];
     if (dlc > CAN_MAX_DLC) {
         return 1;
     }
-    for(uint8_t i=0; i<dlc; i++) {
-        local_data[i] = data[i];
-    }
 
-    uint8_t result = 1;
-    if (xSemaphoreTake(csp_can->tx_sem, portMAX_DELAY) == pdTRUE) {
-        result = hal_can_write(&hcan, id, local_data, dlc);
-    } else {
-        uart_log("Failed to take CSP TX Semaphore");
-    }
+    // fragments of a packet share the priority, so per priority fifo order keeps them in sequence
+    csp_can_tx_queue_s *queue = &csp_can->tx_queue[(id >> CFP2_PRIO_OFFSET) & CFP2_PRIO_MASK];
 
-    return result;
+    while (1) {
+        RUNTIME_CRITICAL_ENTER();
+        if (queue->head - queue->tail < CSP_CAN_TX_QUEUE_LENGTH) {
+            csp_can_msg_s *msg = &queue->frames[queue->head & (CSP_CAN_TX_QUEUE_LENGTH - 1)];
+            msg->id = id;
+            msg->dlc = dlc;
+            for (uint8_t i = 0; i < dlc; i++) {
+                msg->data[i] = data[i];
+            }
+            queue->head++;
+            csp_can->tx_queued++;
+
+            uint32_t waiting = 0;
+            for (uint32_t prio = 0; prio < CSP_CAN_TX_PRIOS; prio++) {
+                waiting += csp_can->tx_queue[prio].head - csp_can->tx_queue[prio].tail;
+            }
+            if (waiting > csp_can->tx_queue_peak) {
+                csp_can->tx_queue_peak = waiting;
+            }
+
+            // mailboxes may be idle, in that case nobody else is going to start them
+            csp_can_tx_pump(csp_can);
+            RUNTIME_CRITICAL_EXIT();
+            return 0;
+        }
+
+        // every software timer callback runs in the timer service task, and the CSP_DISPATCH_ROUTER
+        // services and forwarded packets are sent from the router: neither may wait for the bus
+        TaskHandle_t self = xTaskGetCurrentTaskHandle();
+        if (self == xTimerGetTimerDaemonTaskHandle() || self == csp_router_task) {
+            csp_can->tx_dropped++;
+            RUNTIME_CRITICAL_EXIT();
+            return 1;
+        }
+        csp_can->tx_full_waits++;
+        RUNTIME_CRITICAL_EXIT();
+
+        if (xSemaphoreTake(csp_can->tx_sem, pdMS_TO_TICKS(CSP_CAN_TX_TIMEOUT_MS)) != pdTRUE) {
+            csp_can->tx_dropped++;
+            uart_log("CSP TX queue full, frame dropped\n");
+            return 1;
+        }
+    }
 }
 
-uint8_t hal_can_write(CAN_HandleTypeDef *can, uint32_t addr, uint8_t *data, uint8_t len) {
+uint8_t hal_can_write(CAN_HandleTypeDef *can, uint32_t addr, const uint8_t *data, uint8_t len) {
     uint8_t rc;
     CAN_TxHeaderTypeDef header = {0};
     uint32_t mailbox;
@@ -174,100 +404,291 @@ uint8_t hal_can_write(CAN_HandleTypeDef *can, uint32_t addr, uint8_t *data, uint
     return 0;
 }
 
-static void csp_can_rx_thread(void* data) {
-    csp_can_s * csp_can = data;
+typedef struct {
+    uint32_t id;
+    uint32_t mask;
+} csp_can_filter_s;
+
+static int csp_can_filter_apply(csp_can_s *csp_can) {
+    const uint32_t dst_mask = (uint32_t)CFP2_DST_MASK << CFP2_DST_OFFSET;
+    // netmask is a mask of the network bits of the 14 bit CSP address
+    uint16_t hostmask = ~csp_can->filter_netmask & CFP2_DST_MASK;
+    uint16_t addr = csp_can->iface->addr & CFP2_DST_MASK;
+    uint16_t subnet_bcast = addr | hostmask;
+    csp_can_filter_s filters[CAN_FILTER_BANKS / 2];
+    uint32_t count = 0;
+    uint32_t bank = 0;
+
+    switch (csp_can->filter_mode) {
+    case CSP_CAN_FILTER_PROMISC:
+        break;
+    case CSP_CAN_FILTER_BRIDGE:
+        filters[count++] = (csp_can_filter_s){(uint32_t)(addr & ~hostmask) << CFP2_DST_OFFSET,
+                                              (uint32_t)(CFP2_DST_MASK & ~hostmask) << CFP2_DST_OFFSET};
+        filters[count++] = (csp_can_filter_s){(uint32_t)CSP_BROADCAST_ADDR << CFP2_DST_OFFSET, dst_mask};
+        break;
+    case CSP_CAN_FILTER_BROADCAST:
+        filters[count++] = (csp_can_filter_s){(uint32_t)addr << CFP2_DST_OFFSET, dst_mask};
+        filters[count++] = (csp_can_filter_s){(uint32_t)CSP_BROADCAST_ADDR << CFP2_DST_OFFSET, dst_mask};
+        if (hostmask != 0 && subnet_bcast != CSP_BROADCAST_ADDR) {
+            filters[count++] = (csp_can_filter_s){(uint32_t)subnet_bcast << CFP2_DST_OFFSET, dst_mask};
+        }
+        break;
+    case CSP_CAN_FILTER_UNICAST:
+        filters[count++] = (csp_can_filter_s){(uint32_t)addr << CFP2_DST_OFFSET, dst_mask};
+        break;
+    default:
+        return 1;
+    }
 
-    while (1) {
-        csp_can_msg_s msg;
-        if (csp_queue_dequeue(csp_can->rx_queue, &msg, portMAX_DELAY) == CSP_QUEUE_OK){
-            if (msg.dlc > CAN_MAX_DLC) {
-                /*Too long*/
-                uart_log("\n[CSP ERROR] CAN frame Longer than MAX Length\n");
-            }
+    // every destination gets two banks: CRITICAL/HIGH priority into FIFO1, NORM/LOW into FIFO0,
+    // so bulk traffic filling FIFO0 can not push out the urgent frames
+    if (count == 0) {
+        // lower bank numbers win when a frame matches several banks, so FIFO1 goes first
+        if (can_filter_ext(bank++, 0, CSP_CAN_PRIO_LOW_BIT, CAN_FILTER_FIFO1) != HAL_OK ||
+            can_filter_accept_all(bank++, CAN_FILTER_FIFO0) != HAL_OK) {
+            return 1;
+        }
+    }
 
-            else if(msg.id & (CAN_ERR_FLAG)) {
-                /*Error Frame*/
-                uart_log("\n[CSP ERROR] Error CAN Frame Received\n");
-                csp_can->can_err_frames_tracker++;
-            }
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t mask = filters[i].mask | CSP_CAN_PRIO_LOW_BIT;
+        if (can_filter_ext(bank++, filters[i].id, mask, CAN_FILTER_FIFO1) != HAL_OK ||
+            can_filter_ext(bank++, filters[i].id | CSP_CAN_PRIO_LOW_BIT, mask, CAN_FILTER_FIFO0) != HAL_OK) {
+            return 1;
+        }
+    }
 
-            else if(msg.id & (CAN_RTR_FLAG)) {
-                /*RTR Frame*/
-                uart_log("\n[CSP ERROR] Remote Transmission Request (RTR) CAN Frame Received\n");
-                csp_can->can_rtr_frames_tracker++;
-            }
+    // banks left over from a wider mode would keep letting frames through
+    for (; bank < CAN_FILTER_BANKS; bank++) {
+        can_filter_disable(bank);
+    }
 
-            else {
-                /* Frames that can be processed */
-                msg.id &= CAN_EFF_MASK;
-                csp_can_rx(csp_can->iface, msg.id, msg.data, msg.dlc, NULL);
-            }
+    return 0;
+}
+
+int can_set_filter_mode(csp_can_filter_mode_e mode) {
+    if (mode > CSP_CAN_FILTER_PROMISC) {
+        return 1;
+    }
+
+    csp_can_ctx.filter_mode = mode;
+    if (csp_can_ctx.iface->interface_data == NULL) {
+        // interface is not added yet, can_add_interface() will program the banks
+        return 0;
+    }
+
+    return csp_can_filter_apply(&csp_can_ctx);
+}
+
+static int csp_can_frame_is_ours(csp_can_s *csp_can, uint32_t id) {
+    uint16_t dst = (id >> CFP2_DST_OFFSET) & CFP2_DST_MASK;
+    uint16_t hostmask = ~csp_can->filter_netmask & CFP2_DST_MASK;
+    uint16_t addr = csp_can->iface->addr & CFP2_DST_MASK;
+
+    return (dst == addr) || (dst == CSP_BROADCAST_ADDR) || (hostmask != 0 && dst == (addr | hostmask));
+}
+
+/* returns 1 when the frame closed a CSP packet, i.e. the router has work to do */
+static int csp_can_rx_process(csp_can_s *csp_can, csp_can_msg_s *msg, uint32_t stamp) {
+    if (msg->dlc > CAN_MAX_DLC) {
+        /*Too long*/
+        uart_log("\n[CSP ERROR] CAN frame Longer than MAX Length\n");
+    }
+
+    else if(msg->id & (CAN_ERR_FLAG)) {
+        /*Error Frame*/
+        uart_log("\n[CSP ERROR] Error CAN Frame Received\n");
+        csp_can->can_err_frames_tracker++;
+    }
+
+    else if(msg->id & (CAN_RTR_FLAG)) {
+        /*RTR Frame*/
+        uart_log("\n[CSP ERROR] Remote Transmission Request (RTR) CAN Frame Received\n");
+        csp_can->can_rtr_frames_tracker++;
+    }
+
+    else {
+        /* Frames that can be processed */
+        if (!csp_can_frame_is_ours(csp_can, msg->id)) {
+            // with the hw filters in place this only grows in bridge and promisc mode
+            csp_can->rx_foreign_frames++;
         }
+        return can_reasm_rx(csp_can->iface, msg->id & CAN_EFF_MASK, msg->data, msg->dlc, stamp);
     }
+
+    return 0;
 }
 
-static void broadcast_csp_packet(uint8_t *data, uint32_t len)
-{
-    if (!data) {
-        return;
+static int csp_can_rx_ring_pop(csp_can_s *csp_can, csp_can_rx_ring_s *ring) {
+    uint32_t tail = ring->tail;
+    if (tail == ring->head) {
+        return 0;
+    }
+
+    // do not read the slot before the head update is observed
+    __DMB();
+    uint32_t stamp = ring->stamps[tail & ring->mask];
+    rx_latency_record(RX_LATENCY_RING, cpu_cycles() - stamp);
+    if (csp_can_rx_process(csp_can, &ring->frames[tail & ring->mask], stamp) && csp_router_task != NULL) {
+        // one notification per reassembled packet, the router blocks on exactly this count
+        xTaskNotifyGive(csp_router_task);
     }
-    csp_transaction(CSP_PRIO_NORM,
-                    0x3FFF,
-                    BCAST_PORT,
-                    1000,
-                    (void *)data,
-                    len,
-                    NULL,
-                    0);
+
+    // slot is consumed, hand it back to the ISR
+    __DMB();
+    ring->tail = tail + 1;
+    return 1;
 }
 
-void task_csp_router(void *data) {
-    (void)data;
+static void csp_can_rx_thread(void* data) {
+    csp_can_s * csp_can = data;
+    csp_can_rx_ring_s *ring_hi = &csp_can->rx_ring[CAN_RX_FIFO1];
+    csp_can_rx_ring_s *ring = &csp_can->rx_ring[CAN_RX_FIFO0];
+
+    task_load_start(&csp_rx_load, "csp_rx_thread");
+
     while (1) {
-        csp_route_work();
+        // the ISRs give one notification per burst, so clear them all and drain the rings
+        task_load_block(&csp_rx_load);
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        task_load_wake(&csp_rx_load);
+
+        // high priority frames always go first, and are rechecked between every normal frame.
+        // all fragments of one packet carry the same priority, so reassembly order is kept
+        do {
+            while (csp_can_rx_ring_pop(csp_can, ring_hi)) {
+            }
+        } while (csp_can_rx_ring_pop(csp_can, ring));
     }
 }
 
-void task_csp_server(void *data) {
-    (void)data;
+uint16_t can_get_address(void) {
+    return csp_can_ctx.iface ? csp_can_ctx.iface->addr : 0;
+}
 
-    // send hi first
-    char *bcast_data = "hi bcast\n\0";
-    broadcast_csp_packet((uint8_t *)bcast_data, strlen(bcast_data));
+void can_get_stats(csp_can_stats_s *stats) {
+    if (!stats) {
+        return;
+    }
 
-    /* Create socket with no specific socket options, e.g. accepts CRC32, HMAC, etc. if enabled during
-     * compilation */
-    csp_socket_t sock = {0};
+    stats->rx_frames = csp_can_ctx.rx_frames;
+    stats->rx_isr_entries = csp_can_ctx.rx_isr_entries;
+    stats->rx_foreign_frames = csp_can_ctx.rx_foreign_frames;
+    for (uint32_t fifo = 0; fifo < CSP_CAN_RX_FIFOS; fifo++) {
+        stats->rx_ring_peak[fifo] = csp_can_ctx.rx_ring[fifo].peak;
+        stats->rx_ring_dropped[fifo] = csp_can_ctx.rx_ring[fifo].dropped;
+        stats->rx_fifo_overruns[fifo] = csp_can_ctx.rx_fifo_overruns[fifo];
+    }
+    stats->rx_err_frames = csp_can_ctx.can_err_frames_tracker;
+    stats->rx_rtr_frames = csp_can_ctx.can_rtr_frames_tracker;
+    stats->tx_queued = csp_can_ctx.tx_queued;
+    stats->tx_frames = csp_can_ctx.tx_frames;
+    stats->tx_errors = csp_can_ctx.tx_errors;
+    stats->tx_dropped = csp_can_ctx.tx_dropped;
+    stats->tx_discarded = csp_can_ctx.tx_discarded;
+    stats->tx_full_waits = csp_can_ctx.tx_full_waits;
+    stats->tx_queue_peak = csp_can_ctx.tx_queue_peak;
+}
 
-    /* Bind socket to all ports, e.g. all incoming connections will be handled here */
-    csp_bind(&sock, CSP_ANY);
+uint32_t can_tx_queue_free(uint8_t prio) {
+    if (prio >= CSP_CAN_TX_PRIOS) {
+        return 0;
+    }
+
+    csp_can_tx_queue_s *queue = &csp_can_ctx.tx_queue[prio];
+    RUNTIME_CRITICAL_ENTER();
+    uint32_t used = queue->head - queue->tail;
+    RUNTIME_CRITICAL_EXIT();
+    return CSP_CAN_TX_QUEUE_LENGTH - used;
+}
+
+/*
+ * The router sleeps on its task notification, which the rx thread gives once per
+ * reassembled packet, so the notification value is the number of packets waiting in
+ * the libcsp input fifo. Each wakeup routes at most CSP_ROUTER_WORK_BUDGET of them.
+ * csp_route_work() is never called on an empty fifo (it would block there for its
+ * internal timeout) except for a sweep when CSP_ROUTER_IDLE_TIMEOUT_MS passes without
+ * a notification, which picks up loopback packets and lets libcsp run its connection
+ * timeouts. In between the MCU is free to enter tickless idle.
+ *
+ * A sweep can route a notified packet that came in while it waited, so every packet it
+ * routes settles one pending notification; the count never goes above what is in the
+ * fifo. A sweep that keeps finding packets goes on the next round without waiting.
+ */
+void task_csp_router(void *data) {
+    (void)data;
+    uint32_t backlog = 0;
+    int sweeping = 0;
+    TickType_t last_report;
 
-    /* Create a backlog of 10 connections, i.e. up to 10 new connections can be queued */
-    csp_listen(&sock, 10);
+    csp_router_task = xTaskGetCurrentTaskHandle();
+    mem_health_task(csp_router_task, CSP_ROUTER_TASK_DEPTH);
+    task_load_start(&csp_router_load, "csp_router");
+    last_report = xTaskGetTickCount();
 
     while (1) {
-        /* Wait for a new connection, 1000 mS timeout */
-        csp_conn_t *conn;
-        if ((conn = csp_accept(&sock, 1000)) == NULL) {
-            /* timeout */
-            continue;
+        task_load_block(&csp_router_load);
+        if (backlog == 0 && !sweeping) {
+            backlog = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CSP_ROUTER_IDLE_TIMEOUT_MS));
+        } else {
+            backlog += ulTaskNotifyTake(pdTRUE, 0);
+        }
+        task_load_wake(&csp_router_load);
+        csp_router_stats.wakeups++;
+
+        if (backlog == 0) {
+            csp_router_stats.idle_sweeps++;
+            sweeping = 0;
+            for (uint32_t budget = CSP_ROUTER_WORK_BUDGET; budget > 0; budget--) {
+                if (csp_route_work() != 0) {
+                    // the fifo stayed empty for the libcsp timeout, back to waiting
+                    break;
+                }
+                csp_router_stats.packets++;
+                ulTaskNotifyTake(pdFALSE, 0);
+                sweeping = (budget == 1);
+            }
         }
 
-        /* Read packets on connection, timout is 100 mS */
-        csp_packet_t *packet;
-        while ((packet = csp_read(conn, 100)) != NULL) {
-            if (csp_conn_dport(conn) > CSP_UPTIME) {
-                uart_log("CSP Packet Received\n Incoming Port: %d\tSenderPort: %d\tSender ID: %u\tPacket Length: %d\n",
-                        csp_conn_dport(conn), csp_conn_sport(conn), packet->id.src, packet->length);
-                csp_buffer_free(packet);
-            } else {
-                /* Call the default CSP service handler, handle pings, buffer use, etc. */
-                csp_service_handler(packet);
+        for (uint32_t budget = CSP_ROUTER_WORK_BUDGET; backlog > 0 && budget > 0; budget--) {
+            if (csp_route_work() != 0) {
+                // the packet was dropped before reaching the fifo, nothing left to route
+                backlog = 0;
+                break;
             }
+            csp_router_stats.packets++;
+            backlog--;
+        }
+
+        if (backlog > 0 || sweeping) {
+            csp_router_stats.budget_exhausted++;
+            taskYIELD();
         }
 
-        /* Close current connection */
-        csp_close(conn);
+        if (CSP_LOAD_REPORT_MS && xTaskGetTickCount() - last_report >= pdMS_TO_TICKS(CSP_LOAD_REPORT_MS)) {
+            csp_router_stats.cpu_permille = task_load_permille(&csp_router_load);
+            csp_router_stats.blocked_ticks = csp_router_load.blocked_ticks;
+            task_load_report(&csp_router_load);
+            task_load_report(&csp_rx_load);
+            csp_dispatch_report();
+            can_reasm_report();
+            task_load_reset(&csp_router_load);
+            task_load_reset(&csp_rx_load);
+            last_report = xTaskGetTickCount();
+        }
+    }
+}
+
+void csp_router_get_stats(csp_router_stats_s *stats) {
+    if (!stats) {
+        return;
+    }
+
+    *stats = csp_router_stats;
+    if (CSP_LOAD_REPORT_MS == 0) {
+        stats->cpu_permille = task_load_permille(&csp_router_load);
+        stats->blocked_ticks = csp_router_load.blocked_ticks;
     }
 }
 
@@ -276,38 +697,54 @@ void packet_dump(uint8_t *data, uint16_t len) {
         return;
     }
 
-    const uint16_t break_nochar = 8;
+    enum { break_nochar = 8 };
+    static const char hex[] = "0123456789ABCDEF";
+    /* "0xXX " per byte, 3 separator spaces, one ascii char per byte and the newline */
+    char line[break_nochar * 5 + 3 + break_nochar + 1];
 
     for (uint16_t start = 0; start < len; start += break_nochar) {
         uint16_t end = start + break_nochar;
+        uint16_t pos = 0;
         if (end > len) end = len;
 
         /* Hex column: print actual bytes, pad missing with spaces so column width is stable */
         for (uint16_t i = start; i < start + break_nochar; i++) {
             if (i < end) {
-                uart_log("0x%.02X ", data[i]);
+                line[pos++] = '0';
+                line[pos++] = 'x';
+                line[pos++] = hex[data[i] >> 4];
+                line[pos++] = hex[data[i] & 0x0F];
+                line[pos++] = ' ';
             } else {
-                /* "0x%.02X " is 5 characters wide, so pad with 5 spaces for missing bytes */
-                uart_log("     ");
+                memset(&line[pos], ' ', 5);
+                pos += 5;
             }
         }
 
         /* separator between hex and ascii columns */
-        uart_log("   ");
+        memset(&line[pos], ' ', 3);
+        pos += 3;
 
         /* ASCII/string column: only print existing bytes in this block */
         for (uint16_t i = start; i < end; i++) {
             uint8_t c = data[i];
             /* printable range 32..126, otherwise show dot */
-            uart_log("%c", (c >= 32 && c <= 126) ? c : '.');
+            line[pos++] = (c >= 32 && c <= 126) ? c : '.';
         }
 
-        uart_log("\n");
+        line[pos++] = '\n';
+
+        /* one log record per row instead of one printf pass per byte */
+        uart_log_write((const uint8_t *)line, pos);
     }
 }
 
 void csp_output_hook(csp_id_t *idout, csp_packet_t *packet, csp_iface_t *iface, uint16_t via, int from_me) {
     (void)from_me;
+#if CSP_TRACE_BINARY
+    csp_trace_packet(CSP_TRACE_DIR_OUT, idout, packet, iface,
+                     (via != CSP_NO_VIA_ADDRESS) ? via : CSP_TRACE_NO_VIA);
+#else
     uart_log("OUT: S %u, D %u, Dp %u, Sp %u, Pr %u, Fl 0x%02X, Sz %u VIA: %s (%u)\n",
               idout->src,
               idout->dst,
@@ -319,11 +756,15 @@ void csp_output_hook(csp_id_t *idout, csp_packet_t *packet, csp_iface_t *iface,
               iface->name,
               (via != CSP_NO_VIA_ADDRESS) ? via : idout->dst);
     packet_dump(packet->data, packet->length);
+#endif
     return;
 }
 
 void csp_input_hook(csp_iface_t *iface, csp_packet_t *packet) {
     // debug
+#if CSP_TRACE_BINARY
+    csp_trace_packet(CSP_TRACE_DIR_IN, &packet->id, packet, iface, CSP_TRACE_NO_VIA);
+#else
     uart_log("INP: S %u, D %u, Dp %u, Sp %u, Pr %u, Fl 0x%02X, Sz %" PRIu16 " VIA: %s\n",
               packet->id.src,
               packet->id.dst,
@@ -334,6 +775,7 @@ void csp_input_hook(csp_iface_t *iface, csp_packet_t *packet) {
               packet->length,
               iface->name);
     packet_dump(packet->data, packet->length);
+#endif
 }
 
 /* configSUPPORT_STATIC_ALLOCATION is set to 1, so the application must provide an
@@ -383,3 +825,9 @@ void vApplicationGetTimerTaskMemory(StaticTask_t **ppxTimerTaskTCBBuffer,
     configTIMER_TASK_STACK_DEPTH is specified in words, not bytes. */
     *pulTimerTaskStackSize = configTIMER_TASK_STACK_DEPTH;
 }
+
+/* No FreeRTOS heap is linked (configSUPPORT_DYNAMIC_ALLOCATION is 0), libcsp still asks
+for its size to answer CSP_MEMFREE. */
+size_t xPortGetFreeHeapSize(void) {
+    return 0;
+}
@@ -12,4 +12,12 @@ void MX_DMA_Init(void) {
   NVIC_SetPriority(DMA1_Channel1_IRQn,
                    configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY + 1);
   HAL_NVIC_EnableIRQ(DMA1_Channel1_IRQn);
+
+  // USART3 TX, used by the log task
+  HAL_NVIC_SetPriority(DMA1_Channel2_IRQn,
+                       configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY + 1,
+                       configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY + 1);
+  NVIC_SetPriority(DMA1_Channel2_IRQn,
+                   configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY + 1);
+  HAL_NVIC_EnableIRQ(DMA1_Channel2_IRQn);
 }
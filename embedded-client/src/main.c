@@ -5,10 +5,14 @@
 #include "dma.h"
 #include "gpio.h"
 #include "i2c.h"
-#include "printf.h"
 #include "rtc.h"
 #include "task.h"
 #include "cspcan.h"
+#include "cpu_load.h"
+#include "csp_dispatch.h"
+#include "rx_latency.h"
+#include "status_share.h"
+#include "uart_log.h"
 #include "usart.h"
 #include <stdint.h>
 #include <stdlib.h>
@@ -16,24 +20,9 @@
 #include "csp/csp.h"
 
 void SystemClock_Config(void);
-void uart_log(const char *format, ...);
-
-void uart_log(const char *format, ...) {
-  va_list arguments;
-  char buffer[128] = {0};
-
-  va_start(arguments, format);
-  vsnprintf_(buffer, sizeof(buffer), format, arguments);
-  va_end(arguments);
-
-  if (strlen(buffer) == 0) {
-    return;
-  }
-
-  HAL_UART_Transmit(&huart3, (uint8_t *)buffer, strlen((char *)buffer),
-                    strlen((char *)buffer));
-}
 
+static StaticTask_t csp_router_tcb;
+static StackType_t csp_router_stack[CSP_ROUTER_TASK_DEPTH];
 
 
 void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin) {
@@ -50,15 +39,22 @@ int main(void) {
   SystemClock_Config();
 
   MX_GPIO_Init();
+  MX_DMA_Init();
   MX_ADC1_Init();
   MX_CAN_Init();
   MX_USART3_UART_Init();
+  uart_log_init();
 
   uart_log("application started!\n");
 
+  cpu_cycles_init();
+
   csp_init();
-  xTaskCreate(task_csp_router, "csp_router", 512, NULL, 2, NULL);
-  xTaskCreate(task_csp_server, "csp_server", 2048, NULL, 2, NULL);
+  rx_latency_init();
+  csp_dispatch_init();
+  status_share_init(STATUS_SHARE_BOARD_NAME, STATUS_SHARE_PERIOD_MS);
+  xTaskCreateStatic(task_csp_router, "csp_router", CSP_ROUTER_TASK_DEPTH, NULL, CSP_ROUTER_TASK_PRIO,
+                    csp_router_stack, &csp_router_tcb);
 
   if (can_add_interface(LOCAL_NODE_ID, CSP_NETMASK) != 0) {
     uart_log("Failed to add CSP CAN interface\r\n");
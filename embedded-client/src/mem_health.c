@@ -0,0 +1,107 @@
+#include "mem_health.h"
+#include "timers.h"
+#include "cspcan.h"
+#include "runtime_stats.h"
+#include <string.h>
+#include <csp/csp_buffer.h>
+
+typedef struct {
+    TaskHandle_t handle;
+    uint16_t depth; /* words */
+} mem_health_task_s;
+
+static mem_health_task_s mem_health_tasks[MEM_HEALTH_TASKS];
+static uint32_t mem_health_task_count;
+static uint32_t mem_health_buffer_low = CSP_CONF_BUFFER_COUNT;
+static uint32_t mem_health_buffer_exhausted;
+
+void mem_health_task(TaskHandle_t task, uint16_t depth) {
+    if (!task) {
+        return;
+    }
+
+    RUNTIME_CRITICAL_ENTER();
+    for (uint32_t i = 0; i < mem_health_task_count; i++) {
+        if (mem_health_tasks[i].handle == task) {
+            RUNTIME_CRITICAL_EXIT();
+            return;
+        }
+    }
+    if (mem_health_task_count < MEM_HEALTH_TASKS) {
+        mem_health_tasks[mem_health_task_count].handle = task;
+        mem_health_tasks[mem_health_task_count].depth = depth;
+        mem_health_task_count++;
+    }
+    RUNTIME_CRITICAL_EXIT();
+}
+
+void mem_health_buffers(const csp_packet_t *packet) {
+    int remaining = csp_buffer_remaining();
+    uint32_t free_buffers = (remaining > 0) ? (uint32_t)remaining : 0;
+
+    RUNTIME_CRITICAL_ENTER();
+    if (!packet) {
+        mem_health_buffer_exhausted++;
+        free_buffers = 0;
+    }
+    if (free_buffers < mem_health_buffer_low) {
+        mem_health_buffer_low = free_buffers;
+    }
+    RUNTIME_CRITICAL_EXIT();
+}
+
+void mem_health_handler(csp_packet_t *packet) {
+    mem_health_request_s request;
+    mem_health_response_s response;
+    csp_can_stats_s can;
+
+    if (mem_health_request_decode(&request, packet->data, packet->length) != 0) {
+        csp_buffer_free(packet);
+        return;
+    }
+
+    // both only exist once the scheduler runs, which it does by the time anyone asks
+    mem_health_task(xTaskGetIdleTaskHandle(), configMINIMAL_STACK_SIZE);
+    mem_health_task(xTimerGetTimerDaemonTaskHandle(), configTIMER_TASK_STACK_DEPTH);
+    // this request is holding a buffer too
+    mem_health_buffers(packet);
+
+    can_get_stats(&can);
+    memset(&response, 0, sizeof(response));
+    response.rx_ring_length[0] = CSP_QUEUE_LENGTH;
+    response.rx_ring_length[1] = CSP_QUEUE_LENGTH_HI;
+    for (uint32_t fifo = 0; fifo < CSP_CAN_RX_FIFOS; fifo++) {
+        response.rx_ring_peak[fifo] = can.rx_ring_peak[fifo];
+        response.rx_ring_dropped[fifo] = can.rx_ring_dropped[fifo];
+        response.rx_fifo_overruns[fifo] = can.rx_fifo_overruns[fifo];
+    }
+    response.tx_queue_length = CSP_CAN_TX_PRIOS * CSP_CAN_TX_QUEUE_LENGTH;
+    response.tx_queue_peak = can.tx_queue_peak;
+    response.tx_dropped = can.tx_dropped;
+
+    RUNTIME_CRITICAL_ENTER();
+    response.buffer_low_water = (uint8_t)mem_health_buffer_low;
+    response.buffer_exhausted = mem_health_buffer_exhausted;
+    RUNTIME_CRITICAL_EXIT();
+    response.buffer_count = CSP_CONF_BUFFER_COUNT;
+
+    response.task_count = (uint8_t)mem_health_task_count;
+    response.task_index = request.task_index;
+    if (request.task_index < mem_health_task_count) {
+        const mem_health_task_s *task = &mem_health_tasks[request.task_index];
+        const char *name = pcTaskGetName(task->handle);
+        response.stack_depth = task->depth;
+        response.stack_free = (uint16_t)uxTaskGetStackHighWaterMark(task->handle);
+        response.task_name_len = (uint8_t)strnlen(name, sizeof(response.task_name));
+        memcpy(response.task_name, name, response.task_name_len);
+    }
+
+    int32_t len = mem_health_response_encode(&response, packet->data, sizeof(packet->data));
+    if (len < 0) {
+        csp_buffer_free(packet);
+        return;
+    }
+
+    packet->length = (uint16_t)len;
+    csp_sendto_reply(packet, packet, CSP_O_SAME);
+}
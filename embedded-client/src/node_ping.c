@@ -0,0 +1,41 @@
+#include "node_ping.h"
+#include "cspcan.h"
+#include <csp/csp.h>
+
+static node_ping_stats_s node_ping_stats;
+
+/*
+ * Runs in the router task, see csp_dispatch.c. The ping buffer is turned into the pong
+ * in place and sent back to NODE_PONG_PORT of whoever pinged, the router task is the
+ * only writer of the counters.
+ */
+void node_ping_handler(csp_packet_t *packet) {
+    node_ping_s ping;
+    node_pong_s pong;
+
+    if (node_ping_decode(&ping, packet->data, packet->length) != 0) {
+        node_ping_stats.malformed++;
+        csp_buffer_free(packet);
+        return;
+    }
+
+    uint8_t prio = packet->id.pri;
+    uint16_t pinger = packet->id.src;
+
+    pong.pinger_id = ping.pinger_id;
+    // not packet->id.dst, that is the broadcast address for a broadcast ping
+    pong.ponger_id = can_get_address();
+    pong.seq = ping.seq;
+    packet->length = (uint16_t)node_pong_encode(&pong, packet->data, sizeof(packet->data));
+
+    csp_sendto(prio, pinger, NODE_PONG_PORT, NODE_PING_PORT, CSP_O_NONE, packet);
+    node_ping_stats.pings++;
+}
+
+void node_ping_get_stats(node_ping_stats_s *stats) {
+    if (!stats) {
+        return;
+    }
+
+    *stats = node_ping_stats;
+}
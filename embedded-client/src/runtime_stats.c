@@ -0,0 +1,168 @@
+#include "runtime_stats.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include <string.h>
+
+/*
+ * Tasks are measured by FreeRTOS itself, every context switch adds the cycles the task
+ * ran to its ulRunTimeCounter. A window is the time between two task_index 0 requests:
+ * the counters are diffed against the marks of the previous window, the CAN interrupt
+ * and critical section figures are taken and cleared, and the pages of the answer are
+ * served from that copy until the next index 0 request.
+ *
+ * The counters are 32 bits, a task that runs more than 2^32 cycles in one window (about
+ * 9 minutes at 8 MHz) wraps. CYCCNT stands still in tickless sleep, so the window is
+ * measured in ticks and the share nobody ran is the time spent sleeping.
+ */
+
+typedef struct {
+    TaskHandle_t handle;
+    uint32_t counter; /* ulRunTimeCounter when the window started */
+} runtime_task_mark_s;
+
+runtime_critical_s runtime_critical;
+
+static runtime_isr_stats_s runtime_isr_stats[RUNTIME_ISRS];
+
+static TaskStatus_t runtime_tasks[RUNTIME_STATS_TASKS];
+static uint16_t runtime_task_permille[RUNTIME_STATS_TASKS];
+static runtime_task_mark_s runtime_marks[RUNTIME_STATS_TASKS];
+static UBaseType_t runtime_task_count;
+static UBaseType_t runtime_mark_count;
+static TickType_t runtime_window_start;
+static uint32_t runtime_window_ms;
+#ifdef HOST_BUILD
+static uint32_t runtime_window_total;
+#endif
+static runtime_isr_stats_s runtime_window_isr[RUNTIME_ISRS];
+static uint16_t runtime_window_isr_permille[RUNTIME_ISRS];
+static runtime_critical_s runtime_window_critical;
+
+void runtime_stats_timer_init(void) {
+    cpu_cycles_init();
+}
+
+uint32_t runtime_stats_counter(void) {
+    return cpu_cycles();
+}
+
+void runtime_stats_isr(runtime_isr_e isr, uint32_t start) {
+    uint32_t cycles = cpu_cycles() - start;
+    runtime_isr_stats_s *stats = &runtime_isr_stats[isr];
+
+    stats->count++;
+    stats->cycles += cycles;
+    if (cycles > stats->max_cycles) {
+        stats->max_cycles = cycles;
+    }
+}
+
+static uint16_t runtime_permille(uint64_t cycles, uint64_t window) {
+    if (window == 0) {
+        return 0;
+    }
+
+    uint64_t permille = (cycles * 1000u) / window;
+    return (permille > 1000u) ? 1000u : (uint16_t)permille;
+}
+
+static uint32_t runtime_task_mark(TaskHandle_t handle) {
+    for (UBaseType_t i = 0; i < runtime_mark_count; i++) {
+        if (runtime_marks[i].handle == handle) {
+            return runtime_marks[i].counter;
+        }
+    }
+    return 0;
+}
+
+static void runtime_stats_window(void) {
+    uint32_t total = 0;
+    UBaseType_t count = uxTaskGetSystemState(runtime_tasks, RUNTIME_STATS_TASKS, &total);
+    TickType_t now = xTaskGetTickCount();
+    TickType_t ticks = now - runtime_window_start;
+
+    taskENTER_CRITICAL();
+    memcpy(runtime_window_isr, runtime_isr_stats, sizeof(runtime_window_isr));
+    memset(runtime_isr_stats, 0, sizeof(runtime_isr_stats));
+    runtime_window_critical = runtime_critical;
+    runtime_critical.max_cycles = 0;
+    runtime_critical.max_site = NULL;
+    taskEXIT_CRITICAL();
+
+#ifdef HOST_BUILD
+    // the POSIX port counts process time in its own unit, see host/inc/FreeRTOSConfig.h
+    uint64_t window = total - runtime_window_total;
+    runtime_window_total = total;
+#else
+    uint64_t window = (uint64_t)ticks * (SystemCoreClock / configTICK_RATE_HZ);
+#endif
+
+    // 0 means more tasks than RUNTIME_STATS_TASKS, report none rather than a partial list
+    runtime_task_count = count;
+    for (UBaseType_t i = 0; i < count; i++) {
+        uint32_t ran = runtime_tasks[i].ulRunTimeCounter - runtime_task_mark(runtime_tasks[i].xHandle);
+        runtime_task_permille[i] = runtime_permille(ran, window);
+    }
+    for (UBaseType_t i = 0; i < count; i++) {
+        runtime_marks[i].handle = runtime_tasks[i].xHandle;
+        runtime_marks[i].counter = runtime_tasks[i].ulRunTimeCounter;
+    }
+    runtime_mark_count = count;
+
+    for (uint32_t i = 0; i < RUNTIME_ISRS; i++) {
+        runtime_window_isr_permille[i] = runtime_permille(runtime_window_isr[i].cycles, window);
+    }
+
+    runtime_window_ms = ticks * portTICK_PERIOD_MS;
+    runtime_window_start = now;
+}
+
+void runtime_stats_handler(csp_packet_t *packet) {
+    run_time_stats_request_s request;
+    run_time_stats_response_s response;
+
+    if (run_time_stats_request_decode(&request, packet->data, packet->length) != 0) {
+        csp_buffer_free(packet);
+        return;
+    }
+
+    if (request.task_index == 0) {
+        runtime_stats_window();
+    }
+
+    memset(&response, 0, sizeof(response));
+    response.window_ms = runtime_window_ms;
+    response.core_clock_hz = SystemCoreClock;
+    response.task_count = (uint8_t)runtime_task_count;
+    response.task_index = request.task_index;
+    if (request.task_index < runtime_task_count) {
+        const TaskStatus_t *task = &runtime_tasks[request.task_index];
+        response.task_permille = runtime_task_permille[request.task_index];
+        response.task_priority = (uint8_t)task->uxCurrentPriority;
+        response.task_state = (uint8_t)task->eCurrentState;
+        response.task_name_len = (uint8_t)strnlen(task->pcTaskName, sizeof(response.task_name));
+        memcpy(response.task_name, task->pcTaskName, response.task_name_len);
+    }
+
+    for (uint32_t i = 0; i < RUNTIME_ISRS; i++) {
+        response.isr_permille[i] = runtime_window_isr_permille[i];
+        response.isr_count[i] = runtime_window_isr[i].count;
+        response.isr_max_cycles[i] = runtime_window_isr[i].max_cycles;
+    }
+
+    response.critical_max_cycles = runtime_window_critical.max_cycles;
+    if (runtime_window_critical.max_site) {
+        const char *site = runtime_window_critical.max_site;
+        response.critical_max_site_len = (uint8_t)strnlen(site, sizeof(response.critical_max_site));
+        memcpy(response.critical_max_site, site, response.critical_max_site_len);
+    }
+
+    int32_t len = run_time_stats_response_encode(&response, packet->data, sizeof(packet->data));
+    if (len < 0) {
+        csp_buffer_free(packet);
+        return;
+    }
+
+    packet->length = (uint16_t)len;
+    csp_sendto_reply(packet, packet, CSP_O_SAME);
+}
@@ -0,0 +1,233 @@
+#include "rx_latency.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "cpu_load.h"
+#include "runtime_stats.h"
+#include <string.h>
+#include <csp/csp_buffer.h>
+
+/*
+ * A packet is followed in the entry of its pool buffer. libcsp does not say which one
+ * that is, so rx_latency_init() takes the whole pool once and learns where the buffers
+ * start and how far apart they are. A buffer that comes back from the pool takes over
+ * the entry of its previous use, packets that were routed away or dropped before
+ * reaching a handler are simply never completed.
+ *
+ * Nothing here masks interrupts on the packet path. An entry is only touched by the
+ * task that owns the packet at that moment, the rx thread, the router and the handler
+ * task hand it on through FreeRTOS queues. Every histogram has one writer: the rx
+ * thread owns the ring, frames and reasm ones, the router the router one, and the
+ * handler and total stages have one copy per csp_dispatch target, summed when read.
+ */
+
+typedef struct {
+    uint32_t isr_stamp; /* rx interrupt of the frame that completed the packet */
+    uint32_t mark;      /* end of the previous stage */
+    uint8_t tracked;
+} rx_latency_entry_s;
+
+#define RX_LATENCY_TARGETS (CSP_DISPATCH_TASKS + 1) /* the router and the handler tasks */
+#define RX_LATENCY_DELIVERY(target, stage) (&rx_latency_delivery[target][(stage) - RX_LATENCY_HANDLER])
+
+static const char *const rx_latency_names[RX_LATENCY_STAGES] = {
+    [RX_LATENCY_RING] = "ring",     [RX_LATENCY_FRAMES] = "frames",   [RX_LATENCY_REASM] = "reasm",
+    [RX_LATENCY_ROUTER] = "router", [RX_LATENCY_HANDLER] = "handler", [RX_LATENCY_TOTAL] = "total",
+};
+
+static rx_latency_hist_s rx_latency_hists[RX_LATENCY_HANDLER];
+static rx_latency_hist_s rx_latency_delivery[RX_LATENCY_TARGETS][RX_LATENCY_STAGES - RX_LATENCY_HANDLER];
+static rx_latency_entry_s rx_latency_entries[CSP_CONF_BUFFER_COUNT];
+static uintptr_t rx_latency_pool_base;
+static uintptr_t rx_latency_pool_stride;
+
+_Static_assert(RX_LATENCY_BUCKETS <= sizeof(((rx_latency_response_s *)0)->buckets) / sizeof(uint32_t),
+               "RX_LATENCY_BUCKETS is over the bound of 21.RxLatency.uavcan");
+
+void rx_latency_init(void) {
+    csp_packet_t *taken[CSP_CONF_BUFFER_COUNT];
+    uint32_t count = 0;
+
+    while (count < CSP_CONF_BUFFER_COUNT && (taken[count] = csp_buffer_get(0)) != NULL) {
+        count++;
+    }
+
+    uintptr_t base = UINTPTR_MAX;
+    uintptr_t stride = UINTPTR_MAX;
+    for (uint32_t i = 0; i < count; i++) {
+        uintptr_t addr = (uintptr_t)taken[i];
+        if (addr < base) {
+            base = addr;
+        }
+        for (uint32_t j = 0; j < count; j++) {
+            uintptr_t other = (uintptr_t)taken[j];
+            if (other > addr && other - addr < stride) {
+                stride = other - addr;
+            }
+        }
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        csp_buffer_free(taken[i]);
+    }
+
+    // stride 0 keeps rx_latency_entry() from ever matching, e.g. with the pool not full
+    rx_latency_pool_base = base;
+    rx_latency_pool_stride = (count == CSP_CONF_BUFFER_COUNT && stride != UINTPTR_MAX) ? stride : 0;
+}
+
+static rx_latency_entry_s *rx_latency_entry(const csp_packet_t *packet) {
+    uintptr_t offset = (uintptr_t)packet - rx_latency_pool_base;
+
+    if (rx_latency_pool_stride == 0 || offset % rx_latency_pool_stride != 0 ||
+        offset / rx_latency_pool_stride >= CSP_CONF_BUFFER_COUNT) {
+        return NULL;
+    }
+    return &rx_latency_entries[offset / rx_latency_pool_stride];
+}
+
+static uint32_t rx_latency_bucket(uint32_t us) {
+    if (us < 2) {
+        return 0;
+    }
+
+    uint32_t bucket = 31 - __builtin_clz(us);
+    return (bucket < RX_LATENCY_BUCKETS) ? bucket : RX_LATENCY_BUCKETS - 1;
+}
+
+static void rx_latency_add(rx_latency_hist_s *hist, uint32_t cycles) {
+    uint32_t us = cycles / (SystemCoreClock / 1000000U);
+
+    hist->count++;
+    hist->total_us += us;
+    if (us > hist->max_us) {
+        hist->max_us = us;
+    }
+    hist->buckets[rx_latency_bucket(us)]++;
+}
+
+void rx_latency_record(rx_latency_stage_e stage, uint32_t cycles) {
+    if (stage < RX_LATENCY_HANDLER) {
+        rx_latency_add(&rx_latency_hists[stage], cycles);
+    }
+}
+
+void rx_latency_track(const csp_packet_t *packet, uint32_t isr_stamp) {
+    rx_latency_entry_s *entry = rx_latency_entry(packet);
+
+    if (entry) {
+        entry->isr_stamp = isr_stamp;
+        entry->mark = cpu_cycles();
+        entry->tracked = 1;
+    }
+}
+
+void rx_latency_untrack(const csp_packet_t *packet) {
+    rx_latency_entry_s *entry = rx_latency_entry(packet);
+
+    if (entry) {
+        entry->tracked = 0;
+    }
+}
+
+void rx_latency_routed(const csp_packet_t *packet) {
+    rx_latency_entry_s *entry = rx_latency_entry(packet);
+
+    if (entry && entry->tracked) {
+        uint32_t now = cpu_cycles();
+        rx_latency_add(&rx_latency_hists[RX_LATENCY_ROUTER], now - entry->mark);
+        entry->mark = now;
+    }
+}
+
+void rx_latency_delivered(const csp_packet_t *packet, csp_dispatch_target_e target) {
+    rx_latency_entry_s *entry = rx_latency_entry(packet);
+
+    if (entry && entry->tracked && target < RX_LATENCY_TARGETS) {
+        uint32_t now = cpu_cycles();
+        entry->tracked = 0;
+        rx_latency_add(RX_LATENCY_DELIVERY(target, RX_LATENCY_HANDLER), now - entry->mark);
+        rx_latency_add(RX_LATENCY_DELIVERY(target, RX_LATENCY_TOTAL), now - entry->isr_stamp);
+    }
+}
+
+static void rx_latency_merge(rx_latency_hist_s *into, const rx_latency_hist_s *from) {
+    into->count += from->count;
+    into->total_us += from->total_us;
+    if (from->max_us > into->max_us) {
+        into->max_us = from->max_us;
+    }
+    for (uint32_t i = 0; i < RX_LATENCY_BUCKETS; i++) {
+        into->buckets[i] += from->buckets[i];
+    }
+}
+
+/*
+ * Reads and optionally clears a stage. Runs in the handler task, which is the lowest
+ * priority one, so no writer can be halfway through an update when this starts and the
+ * critical section keeps them out until it is done.
+ */
+static void rx_latency_take(rx_latency_stage_e stage, rx_latency_hist_s *hist, int reset) {
+    memset(hist, 0, sizeof(*hist));
+
+    RUNTIME_CRITICAL_ENTER();
+    if (stage < RX_LATENCY_HANDLER) {
+        *hist = rx_latency_hists[stage];
+        if (reset) {
+            memset(&rx_latency_hists[stage], 0, sizeof(rx_latency_hists[stage]));
+        }
+    } else {
+        for (uint32_t target = 0; target < RX_LATENCY_TARGETS; target++) {
+            rx_latency_hist_s *from = RX_LATENCY_DELIVERY(target, stage);
+            rx_latency_merge(hist, from);
+            if (reset) {
+                memset(from, 0, sizeof(*from));
+            }
+        }
+    }
+    RUNTIME_CRITICAL_EXIT();
+}
+
+void rx_latency_get(rx_latency_stage_e stage, rx_latency_hist_s *hist) {
+    if (!hist || stage >= RX_LATENCY_STAGES) {
+        return;
+    }
+
+    rx_latency_take(stage, hist, 0);
+}
+
+void rx_latency_handler(csp_packet_t *packet) {
+    rx_latency_request_s request;
+    rx_latency_response_s response;
+    rx_latency_hist_s hist;
+
+    if (rx_latency_request_decode(&request, packet->data, packet->length) != 0) {
+        csp_buffer_free(packet);
+        return;
+    }
+
+    memset(&response, 0, sizeof(response));
+    response.stage_count = RX_LATENCY_STAGES;
+    response.stage = request.stage;
+    if (request.stage < RX_LATENCY_STAGES) {
+        rx_latency_stage_e stage = (rx_latency_stage_e)request.stage;
+
+        // read and clear as one, so no sample falls between the two
+        rx_latency_take(stage, &hist, request.reset);
+
+        response.packets = hist.count;
+        response.max_us = hist.max_us;
+        response.total_us = hist.total_us;
+        response.stage_name_len = (uint8_t)strnlen(rx_latency_names[stage], sizeof(response.stage_name));
+        memcpy(response.stage_name, rx_latency_names[stage], response.stage_name_len);
+        response.buckets_len = RX_LATENCY_BUCKETS;
+        memcpy(response.buckets, hist.buckets, sizeof(hist.buckets));
+    }
+
+    int32_t len = rx_latency_response_encode(&response, packet->data, sizeof(packet->data));
+    if (len < 0) {
+        csp_buffer_free(packet);
+        return;
+    }
+
+    packet->length = (uint16_t)len;
+    csp_sendto_reply(packet, packet, CSP_O_SAME);
+}
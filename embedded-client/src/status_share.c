@@ -0,0 +1,82 @@
+#include "status_share.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
+#include "uart_log.h"
+#include "mem_health.h"
+#include <string.h>
+#include <csp/csp.h>
+#include <csp/csp_buffer.h>
+
+static StaticTimer_t status_share_timer_buffer;
+static TimerHandle_t status_share_timer;
+static csp_packet_t *status_share_packet;
+static status_share_request_s status_share_msg;
+static status_share_stats_s status_share_stats;
+
+/*
+ * Runs in the timer service task, which is also the only writer of the counters.
+ * csp_sendto() goes straight down to csp_can_tx_frame() and frees the packet when it
+ * returns, the extra reference taken before every send keeps it ours. The frames are
+ * copied into the tx queue by then, so the packet can be rewritten on the next tick.
+ * STATUS_SHARE_PRIO has its own tx queue, checking it for room first means the send
+ * does not have to drop a fragment halfway through a packet.
+ */
+static void status_share_publish(TimerHandle_t timer) {
+    (void)timer;
+
+    if (can_tx_queue_free(STATUS_SHARE_PRIO) < STATUS_SHARE_FRAMES) {
+        status_share_stats.skipped++;
+        return;
+    }
+
+    status_share_msg.duration_sec = xTaskGetTickCount() / configTICK_RATE_HZ;
+    int32_t len = status_share_request_encode(&status_share_msg, status_share_packet->data,
+                                              sizeof(status_share_packet->data));
+    if (len < 0) {
+        return;
+    }
+    status_share_packet->length = (uint16_t)len;
+
+    csp_buffer_refc_inc(status_share_packet);
+    csp_sendto(STATUS_SHARE_PRIO, CSP_BROADCAST_ADDR, STATUS_SHARE_PORT, STATUS_SHARE_PORT, CSP_O_NONE,
+               status_share_packet);
+    status_share_stats.sent++;
+}
+
+int status_share_init(const char *board_name, uint32_t period_ms) {
+    if (!board_name || period_ms == 0) {
+        return -1;
+    }
+
+    size_t name_len = strlen(board_name);
+    if (name_len > sizeof(status_share_msg.board_name)) {
+        name_len = sizeof(status_share_msg.board_name);
+    }
+    memcpy(status_share_msg.board_name, board_name, name_len);
+    status_share_msg.board_name_len = (uint8_t)name_len;
+
+    status_share_packet = csp_buffer_get(0);
+    mem_health_buffers(status_share_packet);
+    if (!status_share_packet) {
+        uart_log("StatusShare: no csp buffer\n");
+        return -1;
+    }
+
+    status_share_timer = xTimerCreateStatic("status_share", pdMS_TO_TICKS(period_ms), pdTRUE, NULL,
+                                            status_share_publish, &status_share_timer_buffer);
+    if (!status_share_timer || xTimerStart(status_share_timer, 0) != pdPASS) {
+        uart_log("StatusShare: cannot start timer\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+void status_share_get_stats(status_share_stats_s *stats) {
+    if (!stats) {
+        return;
+    }
+
+    *stats = status_share_stats;
+}
@@ -1,8 +1,10 @@
 
 #include "stm32f1xx_it.h"
 #include "main.h"
+#include "runtime_stats.h"
 
 extern DMA_HandleTypeDef hdma_adc1;
+extern DMA_HandleTypeDef hdma_usart3_tx;
 extern ADC_HandleTypeDef hadc1;
 extern RTC_HandleTypeDef hrtc;
 extern UART_HandleTypeDef huart3;
@@ -47,6 +49,8 @@ void RCC_IRQHandler(void) {}
 
 void DMA1_Channel1_IRQHandler(void) { HAL_DMA_IRQHandler(&hdma_adc1); }
 
+void DMA1_Channel2_IRQHandler(void) { HAL_DMA_IRQHandler(&hdma_usart3_tx); }
+
 void ADC1_2_IRQHandler(void) { HAL_ADC_IRQHandler(&hadc1); }
 
 void EXTI1_IRQHandler(void) { HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_1); }
@@ -55,10 +59,27 @@ void TIM1_UP_IRQHandler(void) { HAL_TIM_IRQHandler(&htim1); }
 
 void USART3_IRQHandler(void) { HAL_UART_IRQHandler(&huart3); }
 
-void USB_HP_CAN1_TX_IRQHandler(void) { HAL_CAN_IRQHandler(&hcan); }
+// the CAN vectors are timed for the run time stats, see runtime_stats.h
+void USB_HP_CAN1_TX_IRQHandler(void) {
+  uint32_t start = cpu_cycles();
+  HAL_CAN_IRQHandler(&hcan);
+  runtime_stats_isr(RUNTIME_ISR_CAN_TX, start);
+}
 
-void USB_LP_CAN1_RX0_IRQHandler(void) { HAL_CAN_IRQHandler(&hcan); }
+void USB_LP_CAN1_RX0_IRQHandler(void) {
+  uint32_t start = cpu_cycles();
+  HAL_CAN_IRQHandler(&hcan);
+  runtime_stats_isr(RUNTIME_ISR_CAN_RX0, start);
+}
 
-void CAN1_RX1_IRQHandler(void) { HAL_CAN_IRQHandler(&hcan); }
+void CAN1_RX1_IRQHandler(void) {
+  uint32_t start = cpu_cycles();
+  HAL_CAN_IRQHandler(&hcan);
+  runtime_stats_isr(RUNTIME_ISR_CAN_RX1, start);
+}
 
-void CAN1_SCE_IRQHandler(void) { HAL_CAN_IRQHandler(&hcan); }
+void CAN1_SCE_IRQHandler(void) {
+  uint32_t start = cpu_cycles();
+  HAL_CAN_IRQHandler(&hcan);
+  runtime_stats_isr(RUNTIME_ISR_CAN_SCE, start);
+}
@@ -0,0 +1,182 @@
+#include "uart_log.h"
+#include "usart.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "mem_health.h"
+#include "printf.h"
+#include "stm32f1xx_hal.h"
+#include <stdarg.h>
+#include <string.h>
+
+/*
+ * Multi producer / single consumer byte ring. A producer reserves space by moving head
+ * with a compare-and-swap (ldrex/strex, so an ISR interrupting a task simply retries),
+ * copies its record in and then marks the record header committed. The log task sends
+ * committed records straight out of the ring with DMA, zeroes them and only then moves
+ * tail, so a record is never copied twice. A record that does not fit before the end of the ring
+ * leaves a padding record behind and starts again at offset 0.
+ */
+
+#define UART_LOG_RING_MASK (UART_LOG_RING_SIZE - 1)
+#define UART_LOG_ALIGN(x) (((x) + 3u) & ~3u)
+
+_Static_assert((UART_LOG_RING_SIZE & UART_LOG_RING_MASK) == 0, "UART_LOG_RING_SIZE must be a power of two");
+
+enum {
+    UART_LOG_REC_FREE = 0, /* reserved but not written yet, or already consumed */
+    UART_LOG_REC_DATA,
+    UART_LOG_REC_PAD,
+};
+
+typedef struct {
+    uint16_t len;
+    volatile uint8_t state;
+    uint8_t reserved;
+} uart_log_hdr_s;
+
+typedef struct {
+    uint8_t buf[UART_LOG_RING_SIZE] __attribute__((aligned(4)));
+    uint32_t head; /* producers, compare-and-swap only */
+    volatile uint32_t tail; /* log task only */
+    uint32_t overflows;
+    TaskHandle_t task;
+    SemaphoreHandle_t tx_done;
+} uart_log_ring_s;
+
+static uart_log_ring_s log_ring;
+static StaticSemaphore_t log_tx_done_buf;
+static StaticTask_t log_task_tcb;
+static StackType_t log_task_stack[UART_LOG_TASK_DEPTH];
+
+static uint8_t uart_log_in_isr(void) {
+    return __get_IPSR() != 0;
+}
+
+static void uart_log_kick(void) {
+    if (log_ring.task == NULL || xTaskGetSchedulerState() != taskSCHEDULER_RUNNING) {
+        return;
+    }
+
+    if (uart_log_in_isr()) {
+        BaseType_t task_woken = pdFALSE;
+        vTaskNotifyGiveFromISR(log_ring.task, &task_woken);
+        portYIELD_FROM_ISR(task_woken);
+    } else {
+        xTaskNotifyGive(log_ring.task);
+    }
+}
+
+int uart_log_write(const uint8_t *data, uint16_t len) {
+    const uint32_t need = sizeof(uart_log_hdr_s) + UART_LOG_ALIGN(len);
+    uint32_t head;
+    uint32_t next;
+    uint32_t pad;
+
+    if (!data || !len || need > UART_LOG_RING_SIZE / 2) {
+        return 1;
+    }
+
+    head = __atomic_load_n(&log_ring.head, __ATOMIC_RELAXED);
+    do {
+        uint32_t room = UART_LOG_RING_SIZE - (head & UART_LOG_RING_MASK);
+        pad = (need > room) ? room : 0;
+        next = head + pad + need;
+        if (next - log_ring.tail > UART_LOG_RING_SIZE) {
+            // drop the whole record, a torn line is worse than a missing one
+            __atomic_fetch_add(&log_ring.overflows, 1, __ATOMIC_RELAXED);
+            return 1;
+        }
+    } while (!__atomic_compare_exchange_n(&log_ring.head, &head, next, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    if (pad) {
+        uart_log_hdr_s *hdr = (uart_log_hdr_s *)&log_ring.buf[head & UART_LOG_RING_MASK];
+        hdr->len = pad - sizeof(uart_log_hdr_s);
+        __DMB();
+        hdr->state = UART_LOG_REC_PAD;
+        head += pad;
+    }
+
+    uart_log_hdr_s *hdr = (uart_log_hdr_s *)&log_ring.buf[head & UART_LOG_RING_MASK];
+    hdr->len = len;
+    memcpy((uint8_t *)(hdr + 1), data, len);
+    // the log task must not see the record before its payload
+    __DMB();
+    hdr->state = UART_LOG_REC_DATA;
+
+    uart_log_kick();
+    return 0;
+}
+
+void uart_log(const char *format, ...) {
+    va_list arguments;
+    char buffer[UART_LOG_LINE_MAX];
+
+    va_start(arguments, format);
+    int len = vsnprintf_(buffer, sizeof(buffer), format, arguments);
+    va_end(arguments);
+
+    if (len <= 0) {
+        return;
+    }
+    if (len >= (int)sizeof(buffer)) {
+        len = sizeof(buffer) - 1;
+    }
+
+    uart_log_write((const uint8_t *)buffer, (uint16_t)len);
+}
+
+uint32_t uart_log_overflows(void) {
+    return __atomic_load_n(&log_ring.overflows, __ATOMIC_RELAXED);
+}
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
+    if (huart->Instance != USART3 || log_ring.tx_done == NULL) {
+        return;
+    }
+
+    BaseType_t task_woken = pdFALSE;
+    xSemaphoreGiveFromISR(log_ring.tx_done, &task_woken);
+    portYIELD_FROM_ISR(task_woken);
+}
+
+static void task_uart_log(void *data) {
+    (void)data;
+
+    while (1) {
+        uint32_t tail = log_ring.tail;
+
+        while (tail != __atomic_load_n(&log_ring.head, __ATOMIC_ACQUIRE)) {
+            uart_log_hdr_s *hdr = (uart_log_hdr_s *)&log_ring.buf[tail & UART_LOG_RING_MASK];
+            uint8_t state = hdr->state;
+
+            if (state == UART_LOG_REC_FREE) {
+                // reserved but still being written, its producer will notify us
+                break;
+            }
+            __DMB();
+
+            if (state == UART_LOG_REC_DATA) {
+                if (HAL_UART_Transmit_DMA(&huart3, (uint8_t *)(hdr + 1), hdr->len) == HAL_OK) {
+                    xSemaphoreTake(log_ring.tx_done, portMAX_DELAY);
+                }
+            }
+
+            uint32_t size = sizeof(uart_log_hdr_s) + UART_LOG_ALIGN(hdr->len);
+            // any word in here can become a record header later, it must read as FREE until written
+            memset(hdr, 0, size);
+            tail += size;
+            __DMB();
+            log_ring.tail = tail;
+        }
+
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+
+void uart_log_init(void) {
+    log_ring.tx_done = xSemaphoreCreateBinaryStatic(&log_tx_done_buf);
+    log_ring.task = xTaskCreateStatic(task_uart_log, "uart_log", UART_LOG_TASK_DEPTH, NULL, UART_LOG_TASK_PRIO,
+                                      log_task_stack, &log_task_tcb);
+    mem_health_task(log_ring.task, UART_LOG_TASK_DEPTH);
+}
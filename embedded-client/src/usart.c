@@ -2,6 +2,7 @@
 #include "FreeRTOS.h"
 
 UART_HandleTypeDef huart3;
+DMA_HandleTypeDef hdma_usart3_tx;
 
 void MX_USART3_UART_Init(void) {
 
@@ -36,6 +37,20 @@ void HAL_UART_MspInit(UART_HandleTypeDef *uartHandle) {
     GPIO_InitStruct.Pull = GPIO_NOPULL;
     HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
 
+    hdma_usart3_tx.Instance = DMA1_Channel2;
+    hdma_usart3_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    hdma_usart3_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_usart3_tx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_usart3_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_usart3_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_usart3_tx.Init.Mode = DMA_NORMAL;
+    hdma_usart3_tx.Init.Priority = DMA_PRIORITY_LOW;
+    if (HAL_DMA_Init(&hdma_usart3_tx) != HAL_OK) {
+      Error_Handler();
+    }
+
+    __HAL_LINKDMA(uartHandle, hdmatx, hdma_usart3_tx);
+
     HAL_NVIC_SetPriority(USART3_IRQn,
                          configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY + 1,
                          configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY + 1);
@@ -53,6 +68,8 @@ void HAL_UART_MspDeInit(UART_HandleTypeDef *uartHandle) {
 
     HAL_GPIO_DeInit(GPIOB, GPIO_PIN_10 | GPIO_PIN_11);
 
+    HAL_DMA_DeInit(uartHandle->hdmatx);
+
     HAL_NVIC_DisableIRQ(USART3_IRQn);
   }
 }
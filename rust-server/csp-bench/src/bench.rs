@@ -0,0 +1,653 @@
+use libcsp::csp_client::{ClientConfig, CspClient, TAG_LEN};
+use libcsp::csp_packet::CspPacket;
+use libcsp::libcsp::{
+    csp_can_socketcan_open_and_add_interface, csp_close, csp_conf, csp_conn_t, csp_connect,
+    csp_iface_t, csp_init, csp_read, csp_route_work, csp_send, CSP_O_NONE, CSP_PING,
+};
+use serde::Serialize;
+use std::ffi;
+use std::fs::File;
+use std::io::{self, Write};
+use std::ptr;
+use std::str::FromStr;
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::Arc;
+use std::thread;
+use std::time::{Duration, Instant};
+use structopt::StructOpt;
+
+// CFP2 carries the CSP source, ports and flags in the first 4 data bytes of a packet
+const CFP2_FIRST_FRAME_DATA: usize = 4;
+const CAN_FRAME_DATA: usize = 8;
+// Requests carry a sequence number so late echoes of timed out requests can be told apart
+const SEQ_SIZE: usize = 4;
+
+#[derive(Debug, StructOpt)]
+#[structopt(
+    name = "csp-bench",
+    about = "Measures CSP-over-CAN throughput and latency against nodes answering CSP ping."
+)]
+struct Opt {
+    /// SocketCAN interface, e.g. vcan0 with host build nodes attached
+    #[structopt(long, default_value = "vcan0")]
+    iface: String,
+
+    /// Node id of the benchmark itself
+    #[structopt(long, default_value = "20")]
+    source_node_id: u32,
+
+    /// Comma separated node ids to load, workers are spread over them
+    #[structopt(long, default_value = "11")]
+    nodes: String,
+
+    /// Port echoing the request back, CSP ping by default
+    #[structopt(long, default_value = "1")]
+    port: u8,
+
+    /// Comma separated payload sizes in bytes
+    #[structopt(long, default_value = "1,4,8,12,16,32,64,128,192,256")]
+    sizes: String,
+
+    /// Comma separated CSP priorities (0 critical .. 3 low)
+    #[structopt(long, default_value = "2")]
+    prios: String,
+
+    /// Comma separated numbers of requests kept in flight at once
+    #[structopt(long, default_value = "1,4")]
+    concurrency: String,
+
+    /// Measuring time of every sweep point in milliseconds
+    #[structopt(long, default_value = "3000")]
+    duration_ms: u64,
+
+    /// Time per sweep point whose samples are thrown away, in milliseconds
+    #[structopt(long, default_value = "200")]
+    warmup_ms: u64,
+
+    /// Reply timeout in milliseconds, the upper bound of the adaptive one with --pipelined
+    #[structopt(long, default_value = "1000")]
+    timeout_ms: u32,
+
+    /// Keep the concurrent requests in flight on one CspClient connection per
+    /// node instead of one connection per request, sizes below 4 are skipped
+    #[structopt(long)]
+    pipelined: bool,
+
+    /// JSON result file, stdout when omitted
+    #[structopt(long)]
+    output: Option<String>,
+}
+
+#[derive(Debug, Serialize)]
+struct Latency {
+    min: u32,
+    p50: u32,
+    p99: u32,
+    p999: u32,
+    max: u32,
+    mean: f64,
+}
+
+#[derive(Debug, Serialize)]
+struct PointResult {
+    size: usize,
+    prio: u8,
+    concurrency: usize,
+    duration_s: f64,
+    requests: u64,
+    replies: u64,
+    timeouts: u64,
+    stale_replies: u64,
+    bad_replies: u64,
+    no_buffer: u64,
+    requests_per_s: f64,
+    /// requests and replies together
+    packets_per_s: f64,
+    /// payload bytes of both directions
+    goodput_bytes_per_s: f64,
+    can_frames: u64,
+    can_frames_per_packet: f64,
+    expected_can_frames_per_packet: usize,
+    latency_us: Option<Latency>,
+}
+
+#[derive(Debug, Serialize)]
+struct Report {
+    iface: String,
+    source_node_id: u32,
+    nodes: Vec<u16>,
+    port: u8,
+    duration_ms: u64,
+    timeout_ms: u32,
+    pipelined: bool,
+    results: Vec<PointResult>,
+}
+
+/// Counters of one worker for one sweep point
+#[derive(Debug, Default)]
+struct WorkerResult {
+    latencies_us: Vec<u32>,
+    requests: u64,
+    replies: u64,
+    timeouts: u64,
+    stale_replies: u64,
+    bad_replies: u64,
+    no_buffer: u64,
+}
+
+impl WorkerResult {
+    fn merge(&mut self, other: WorkerResult) {
+        self.latencies_us.extend(other.latencies_us);
+        self.requests += other.requests;
+        self.replies += other.replies;
+        self.timeouts += other.timeouts;
+        self.stale_replies += other.stale_replies;
+        self.bad_replies += other.bad_replies;
+        self.no_buffer += other.no_buffer;
+    }
+}
+
+fn parse_list<T: FromStr>(name: &str, list: &str) -> Result<Vec<T>, String> {
+    list.split(',')
+        .map(str::trim)
+        .filter(|s| !s.is_empty())
+        .map(|s| {
+            s.parse::<T>()
+                .map_err(|_| format!("invalid value '{}' in --{}", s, name))
+        })
+        .collect::<Result<Vec<T>, String>>()
+        .and_then(|v| {
+            if v.is_empty() {
+                Err(format!("--{} is empty", name))
+            } else {
+                Ok(v)
+            }
+        })
+}
+
+/// Frames CFP2 needs for a packet of `size` bytes
+fn cfp2_frames(size: usize) -> usize {
+    1 + size
+        .saturating_sub(CFP2_FIRST_FRAME_DATA)
+        .div_ceil(CAN_FRAME_DATA)
+}
+
+/// Nearest rank percentile of a sorted sample set
+fn percentile(sorted: &[u32], p: f64) -> u32 {
+    let rank = ((p / 100.0) * sorted.len() as f64).ceil() as usize;
+    sorted[rank.clamp(1, sorted.len()) - 1]
+}
+
+fn latency_summary(samples: &mut [u32]) -> Option<Latency> {
+    if samples.is_empty() {
+        return None;
+    }
+
+    samples.sort_unstable();
+    let sum: u64 = samples.iter().map(|&v| v as u64).sum();
+    Some(Latency {
+        min: samples[0],
+        p50: percentile(samples, 50.0),
+        p99: percentile(samples, 99.0),
+        p999: percentile(samples, 99.9),
+        max: samples[samples.len() - 1],
+        mean: sum as f64 / samples.len() as f64,
+    })
+}
+
+/// Counts every frame on the interface with a raw socket of its own, so the
+/// numbers are what the bus carried and not what CFP2 is supposed to need.
+fn spawn_frame_counter(iface: &str, frames: Arc<AtomicU64>) -> io::Result<()> {
+    let if_name = ffi::CString::new(iface).map_err(io::Error::other)?;
+
+    // unsafe needed because of following errors:
+    // -> call to unsafe functions `socket`, `if_nametoindex`, `bind`, `close`
+    let fd = unsafe {
+        let fd = libc::socket(libc::PF_CAN, libc::SOCK_RAW, libc::CAN_RAW);
+        if fd < 0 {
+            return Err(io::Error::last_os_error());
+        }
+
+        let mut addr: libc::sockaddr_can = std::mem::zeroed();
+        addr.can_family = libc::AF_CAN as libc::sa_family_t;
+        addr.can_ifindex = libc::if_nametoindex(if_name.as_ptr()) as i32;
+        if addr.can_ifindex == 0
+            || libc::bind(
+                fd,
+                &addr as *const libc::sockaddr_can as *const libc::sockaddr,
+                std::mem::size_of::<libc::sockaddr_can>() as libc::socklen_t,
+            ) != 0
+        {
+            let err = io::Error::last_os_error();
+            libc::close(fd);
+            return Err(err);
+        }
+
+        fd
+    };
+
+    thread::Builder::new()
+        .name("can-count".to_string())
+        .spawn(move || {
+            // unsafe needed because of following errors:
+            // -> call to unsafe function `read`
+            unsafe {
+                let mut frame: libc::can_frame = std::mem::zeroed();
+                loop {
+                    let n = libc::read(
+                        fd,
+                        &mut frame as *mut libc::can_frame as *mut ffi::c_void,
+                        std::mem::size_of::<libc::can_frame>(),
+                    );
+                    if n == std::mem::size_of::<libc::can_frame>() as isize {
+                        frames.fetch_add(1, Ordering::Relaxed);
+                    } else if n < 0
+                        && io::Error::last_os_error().kind() != io::ErrorKind::Interrupted
+                    {
+                        eprintln!("frame counter stopped: {}", io::Error::last_os_error());
+                        return;
+                    }
+                }
+            }
+        })?;
+
+    Ok(())
+}
+
+/// One request in flight at a time over a single connection until `stop` is set.
+///
+/// Samples are only kept once `measuring` is set, the warmup requests just
+/// bring the connection tables and queues of both ends up to speed.
+fn run_worker(
+    node: u16,
+    port: u8,
+    prio: u8,
+    size: usize,
+    timeout_ms: u32,
+    measuring: &AtomicBool,
+    stop: &AtomicBool,
+) -> WorkerResult {
+    let mut result = WorkerResult::default();
+    let mut seq: u32 = 0;
+
+    // unsafe needed because of following errors:
+    // -> call to unsafe functions `csp_connect`, `csp_send`, `csp_read`, `csp_close`
+    unsafe {
+        let conn: *mut csp_conn_t = csp_connect(prio, node, port, 0, CSP_O_NONE);
+        if conn.is_null() {
+            eprintln!("cannot connect to node {} port {}", node, port);
+            return result;
+        }
+
+        while !stop.load(Ordering::Relaxed) {
+            let Some(mut request) = CspPacket::get() else {
+                result.no_buffer += 1;
+                thread::sleep(Duration::from_millis(1));
+                continue;
+            };
+
+            seq = seq.wrapping_add(1);
+            let buffer = request.buffer_mut();
+            let tag = seq.to_le_bytes();
+            for (i, byte) in buffer[..size].iter_mut().enumerate() {
+                *byte = if i < SEQ_SIZE { tag[i] } else { i as u8 };
+            }
+            request.set_len(size);
+
+            let counted = measuring.load(Ordering::Relaxed);
+            let started = Instant::now();
+            csp_send(conn, request.into_raw());
+            if counted {
+                result.requests += 1;
+            }
+
+            // Echoes of requests that already timed out are dropped here until ours shows up
+            loop {
+                let elapsed = started.elapsed().as_millis() as u32;
+                let remaining = timeout_ms.saturating_sub(elapsed);
+                let Some(reply) = CspPacket::from_raw(csp_read(conn, remaining)) else {
+                    if counted {
+                        result.timeouts += 1;
+                    }
+                    break;
+                };
+
+                let data = reply.data();
+                if size >= SEQ_SIZE && data.len() >= SEQ_SIZE && data[..SEQ_SIZE] != tag {
+                    if counted {
+                        result.stale_replies += 1;
+                    }
+                    continue;
+                }
+
+                if counted {
+                    if data.len() == size {
+                        result.replies += 1;
+                        result
+                            .latencies_us
+                            .push(started.elapsed().as_micros().min(u32::MAX as u128) as u32);
+                    } else {
+                        result.bad_replies += 1;
+                    }
+                }
+                break;
+            }
+        }
+
+        csp_close(conn);
+    }
+
+    result
+}
+
+/// Requests back to back through the shared `client` until `stop` is set.
+///
+/// Latency is the round trip from the request leaving for the connection,
+/// time spent waiting for room in the window is not counted.
+async fn run_pipelined_worker(
+    client: CspClient,
+    node: u16,
+    port: u8,
+    payload: Vec<u8>,
+    measuring: Arc<AtomicBool>,
+    stop: Arc<AtomicBool>,
+) -> WorkerResult {
+    let mut result = WorkerResult::default();
+
+    while !stop.load(Ordering::Relaxed) {
+        let counted = measuring.load(Ordering::Relaxed);
+        let reply = client.request(node, port, &payload).await;
+        if !counted {
+            continue;
+        }
+
+        result.requests += 1;
+        match reply {
+            Ok(reply) if reply.data() == payload.as_slice() => {
+                result.replies += 1;
+                result
+                    .latencies_us
+                    .push(reply.rtt().as_micros().min(u32::MAX as u128) as u32);
+            }
+            Ok(_) => result.bad_replies += 1,
+            Err(e) if e.kind() == io::ErrorKind::TimedOut => result.timeouts += 1,
+            Err(_) => {
+                result.no_buffer += 1;
+                tokio::time::sleep(Duration::from_millis(1)).await;
+            }
+        }
+    }
+
+    result
+}
+
+/// `concurrency` requests spread over the nodes, all in flight at once on
+/// one connection per node.
+fn run_pipelined(
+    opt: &Opt,
+    nodes: &[u16],
+    size: usize,
+    prio: u8,
+    concurrency: usize,
+    measuring: Arc<AtomicBool>,
+    stop: Arc<AtomicBool>,
+) -> WorkerResult {
+    let mut total = WorkerResult::default();
+    let runtime = match tokio::runtime::Builder::new_multi_thread()
+        .enable_all()
+        .build()
+    {
+        Ok(runtime) => runtime,
+        Err(e) => {
+            eprintln!("cannot start the async runtime: {}", e);
+            return total;
+        }
+    };
+
+    runtime.block_on(async {
+        let timeout = Duration::from_millis(opt.timeout_ms as u64);
+        let client = CspClient::new(ClientConfig {
+            prio,
+            window: concurrency.div_ceil(nodes.len()),
+            initial_timeout: timeout,
+            max_timeout: timeout,
+            ..ClientConfig::default()
+        });
+        let payload: Vec<u8> = (TAG_LEN..size).map(|i| i as u8).collect();
+
+        let workers: Vec<_> = (0..concurrency)
+            .map(|i| {
+                tokio::spawn(run_pipelined_worker(
+                    client.clone(),
+                    nodes[i % nodes.len()],
+                    opt.port,
+                    payload.clone(),
+                    measuring.clone(),
+                    stop.clone(),
+                ))
+            })
+            .collect();
+
+        for worker in workers {
+            total.merge(worker.await.unwrap_or_default());
+        }
+        total.stale_replies = client.stats().await.iter().map(|s| s.late).sum();
+    });
+
+    total
+}
+
+fn run_point(
+    opt: &Opt,
+    nodes: &[u16],
+    size: usize,
+    prio: u8,
+    concurrency: usize,
+    frames: &AtomicU64,
+) -> PointResult {
+    let measuring = Arc::new(AtomicBool::new(false));
+    let stop = Arc::new(AtomicBool::new(false));
+    let mut total = WorkerResult::default();
+    let mut elapsed = Duration::ZERO;
+    let mut can_frames = 0;
+
+    thread::scope(|s| {
+        let workers: Vec<_> = if opt.pipelined {
+            let (measuring, stop) = (measuring.clone(), stop.clone());
+            vec![s
+                .spawn(move || run_pipelined(opt, nodes, size, prio, concurrency, measuring, stop))]
+        } else {
+            (0..concurrency)
+                .map(|i| {
+                    let node = nodes[i % nodes.len()];
+                    let (measuring, stop) = (&measuring, &stop);
+                    s.spawn(move || {
+                        run_worker(node, opt.port, prio, size, opt.timeout_ms, measuring, stop)
+                    })
+                })
+                .collect()
+        };
+
+        thread::sleep(Duration::from_millis(opt.warmup_ms));
+        let frames_start = frames.load(Ordering::Relaxed);
+        let started = Instant::now();
+        measuring.store(true, Ordering::Relaxed);
+
+        thread::sleep(Duration::from_millis(opt.duration_ms));
+        measuring.store(false, Ordering::Relaxed);
+        elapsed = started.elapsed();
+        can_frames = frames.load(Ordering::Relaxed) - frames_start;
+        stop.store(true, Ordering::Relaxed);
+
+        for worker in workers {
+            total.merge(worker.join().unwrap_or_default());
+        }
+    });
+
+    let secs = elapsed.as_secs_f64();
+    let packets = total.requests + total.replies;
+    PointResult {
+        size,
+        prio,
+        concurrency,
+        duration_s: secs,
+        requests: total.requests,
+        replies: total.replies,
+        timeouts: total.timeouts,
+        stale_replies: total.stale_replies,
+        bad_replies: total.bad_replies,
+        no_buffer: total.no_buffer,
+        requests_per_s: total.replies as f64 / secs,
+        packets_per_s: packets as f64 / secs,
+        goodput_bytes_per_s: (2 * total.replies * size as u64) as f64 / secs,
+        can_frames,
+        can_frames_per_packet: if packets > 0 {
+            can_frames as f64 / packets as f64
+        } else {
+            0.0
+        },
+        expected_can_frames_per_packet: cfp2_frames(size),
+        latency_us: latency_summary(&mut total.latencies_us),
+    }
+}
+
+fn main() -> Result<(), Box<dyn std::error::Error>> {
+    let opt = Opt::from_args();
+
+    let nodes: Vec<u16> = parse_list("nodes", &opt.nodes)?;
+    let mut sizes: Vec<usize> = parse_list("sizes", &opt.sizes)?;
+    if opt.pipelined {
+        // every pipelined request starts with the client's correlation tag
+        sizes.retain(|&size| size >= TAG_LEN);
+    }
+    let prios: Vec<u8> = parse_list("prios", &opt.prios)?;
+    let concurrency: Vec<usize> = parse_list("concurrency", &opt.concurrency)?;
+
+    if let Some(size) = sizes.iter().find(|&&s| s == 0 || s > CspPacket::capacity()) {
+        return Err(format!("size {} out of range 1..{}", size, CspPacket::capacity()).into());
+    }
+    if let Some(prio) = prios.iter().find(|&&p| p > 3) {
+        return Err(format!("priority {} out of range 0..3", prio).into());
+    }
+    if concurrency.contains(&0) {
+        return Err("concurrency must be at least 1".into());
+    }
+
+    // unsafe needed because of following errors:
+    // -> call to unsafe function `csp_init`
+    // -> use of mutable static
+    unsafe {
+        csp_conf.version = 2;
+        csp_init();
+    }
+
+    thread::Builder::new()
+        .name("csp-router".to_string())
+        .spawn(|| {
+            // unsafe needed because of following errors:
+            // -> call to unsafe function `csp_route_work`
+            unsafe {
+                loop {
+                    csp_route_work();
+                }
+            }
+        })?;
+
+    let frames = Arc::new(AtomicU64::new(0));
+    spawn_frame_counter(&opt.iface, frames.clone())?;
+
+    let mut default_iface: *mut csp_iface_t = ptr::null_mut();
+    let if_name = ffi::CString::new(opt.iface.as_str()).unwrap();
+    let if_name_def = ffi::CString::new("CAN").unwrap();
+
+    // unsafe needed because of following errors:
+    // -> call to unsafe function `csp_can_socketcan_open_and_add_interface`
+    // -> dereference of raw pointer
+    unsafe {
+        csp_can_socketcan_open_and_add_interface(
+            if_name.as_ptr(),
+            if_name_def.as_ptr(),
+            opt.source_node_id,
+            1000000,
+            true,
+            &mut default_iface as *mut _,
+        );
+        if default_iface.is_null() {
+            return Err(format!("cannot open CAN interface {}", opt.iface).into());
+        }
+
+        (*default_iface).is_default = 1;
+    }
+
+    if opt.port as u32 != CSP_PING {
+        eprintln!(
+            "port {} must echo every request back unchanged to be measured",
+            opt.port
+        );
+    }
+
+    eprintln!(
+        "{:>5} {:>4} {:>4} {:>9} {:>9} {:>11} {:>7} {:>8} {:>8} {:>8} {:>8}",
+        "size",
+        "prio",
+        "conc",
+        "req/s",
+        "pkt/s",
+        "goodput B/s",
+        "frm/pkt",
+        "p50 us",
+        "p99 us",
+        "p999 us",
+        "timeouts"
+    );
+
+    let mut results = Vec::new();
+    for &prio in &prios {
+        for &conc in &concurrency {
+            for &size in &sizes {
+                let r = run_point(&opt, &nodes, size, prio, conc, &frames);
+                let (p50, p99, p999) = r
+                    .latency_us
+                    .as_ref()
+                    .map_or((0, 0, 0), |l| (l.p50, l.p99, l.p999));
+                eprintln!(
+                    "{:>5} {:>4} {:>4} {:>9.1} {:>9.1} {:>11.1} {:>7.2} {:>8} {:>8} {:>8} {:>8}",
+                    r.size,
+                    r.prio,
+                    r.concurrency,
+                    r.requests_per_s,
+                    r.packets_per_s,
+                    r.goodput_bytes_per_s,
+                    r.can_frames_per_packet,
+                    p50,
+                    p99,
+                    p999,
+                    r.timeouts
+                );
+                results.push(r);
+            }
+        }
+    }
+
+    let report = Report {
+        iface: opt.iface.clone(),
+        source_node_id: opt.source_node_id,
+        nodes,
+        port: opt.port,
+        duration_ms: opt.duration_ms,
+        timeout_ms: opt.timeout_ms,
+        pipelined: opt.pipelined,
+        results,
+    };
+
+    let json = serde_json::to_string_pretty(&report)?;
+    match &opt.output {
+        Some(path) => {
+            let mut file = File::create(path)?;
+            writeln!(file, "{}", json)?;
+        }
+        None => println!("{}", json),
+    }
+
+    Ok(())
+}
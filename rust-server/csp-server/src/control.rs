@@ -0,0 +1,294 @@
+//! Local control socket of a running csp-server.
+//!
+//! A csp-server started with `--daemon` keeps the CSP stack up and accepts
+//! commands on a Unix stream socket, so scripts no longer pay csp_init,
+//! SocketCAN setup and router start for every packet. The protocol is one
+//! text line per command and one reply line per command, in order:
+//!
+//! ```text
+//! send <node> <port> [hex bytes]                    -> ok <us>
+//! transaction <node> <port> <timeout ms> [hex bytes] -> ok <us> [hex reply]
+//!                                                    -> err <reason>
+//! ```
+//!
+//! `send` is connectionless (`csp_sendto` from `CONTROL_SEND_PORT`, whatever
+//! comes back there is logged), `transaction` opens a connection and waits
+//! for one reply. `node` is a 14 bit CSP address and `port` one of the 64
+//! CSP ports. Commands on one control connection run
+//! concurrently, up to `PIPELINE_DEPTH` of them, replies keep command order.
+
+use libcsp::csp_async::{CspCallbackPort, CSP_PORTS};
+use libcsp::csp_packet::CspPacket;
+use libcsp::csp_utils;
+use libcsp::libcsp::{csp_prio_t_CSP_PRIO_NORM, csp_sendto, CSP_O_NONE};
+use std::io;
+use std::path::Path;
+use std::time::Instant;
+use tokio::io::{AsyncBufReadExt, AsyncWriteExt, BufReader, BufWriter};
+use tokio::net::{UnixListener, UnixStream};
+use tokio::sync::mpsc;
+use tokio::task::JoinHandle;
+
+use crate::fanout;
+
+pub const DEFAULT_SOCKET: &str = "/tmp/csp-server.sock";
+
+/// Commands of one control connection executing at the same time
+const PIPELINE_DEPTH: usize = 64;
+
+/// Source port of connectionless sends, clear of the node services (20-22,
+/// 29-31, NodePong being bound here too), `csp_async::CONN_PORT` and
+/// `fanout::FANOUT_REPLY_PORT`. Answers sent with `csp_sendto_reply` land on
+/// a callback port here instead of CMP (port 0).
+pub const CONTROL_SEND_PORT: u8 = 27;
+
+enum Command {
+    Send {
+        node: u16,
+        port: u8,
+        data: Vec<u8>,
+    },
+    Transaction {
+        node: u16,
+        port: u8,
+        timeout_ms: u32,
+        data: Vec<u8>,
+    },
+}
+
+fn parse_command(line: &str) -> Result<Command, String> {
+    let mut words = line.split_whitespace();
+    let verb = words.next().unwrap_or_default();
+
+    fn number<T: std::str::FromStr>(word: Option<&str>, what: &str) -> Result<T, String> {
+        let word = word.ok_or_else(|| format!("missing {}", what))?;
+        word.parse().map_err(|_| format!("bad {} '{}'", what, word))
+    }
+
+    let node: u16 = number(words.next(), "node")?;
+    if node > fanout::ADDRESS_MAX {
+        return Err(format!(
+            "node id {} out of range 0..{}",
+            node,
+            fanout::ADDRESS_MAX
+        ));
+    }
+    let port: u8 = number(words.next(), "port")?;
+    if port as usize >= CSP_PORTS {
+        return Err(format!("port {} out of range 0..{}", port, CSP_PORTS - 1));
+    }
+    let timeout_ms = match verb {
+        "send" => 0,
+        "transaction" => number(words.next(), "timeout")?,
+        _ => return Err(format!("unknown command '{}'", verb)),
+    };
+
+    let data = words
+        .map(|s| u8::from_str_radix(s, 16).map_err(|_| format!("bad hex byte '{}'", s)))
+        .collect::<Result<Vec<u8>, String>>()?;
+    if data.len() > CspPacket::capacity() {
+        return Err(format!("{} bytes do not fit a csp buffer", data.len()));
+    }
+
+    Ok(match verb {
+        "send" => Command::Send { node, port, data },
+        _ => Command::Transaction {
+            node,
+            port,
+            timeout_ms,
+            data,
+        },
+    })
+}
+
+fn execute(command: Command) -> Result<Vec<u8>, String> {
+    let prio = csp_prio_t_CSP_PRIO_NORM as u8;
+
+    match command {
+        Command::Send { node, port, data } => {
+            let packet = CspPacket::from_slice(&data).ok_or("no csp buffer")?;
+            // unsafe needed because of following errors:
+            // -> call to unsafe function `csp_sendto`
+            unsafe {
+                csp_sendto(
+                    prio,
+                    node,
+                    port,
+                    CONTROL_SEND_PORT,
+                    CSP_O_NONE,
+                    packet.into_raw(),
+                );
+            }
+            Ok(Vec::new())
+        }
+        Command::Transaction {
+            node,
+            port,
+            timeout_ms,
+            data,
+        } => {
+            let request = CspPacket::from_slice(&data).ok_or("no csp buffer")?;
+            csp_utils::csp_transaction_packet(prio, node, port, timeout_ms, request)
+                .map(|reply| reply.data().to_vec())
+                .map_err(|e| format!("csp error {}", e))
+        }
+    }
+}
+
+async fn run_command(line: String) -> String {
+    let command = match parse_command(&line) {
+        Ok(command) => command,
+        Err(e) => return format!("err {}", e),
+    };
+
+    let started = Instant::now();
+    // csp_sendto and csp_read block, keep them off the runtime
+    let result = match tokio::task::spawn_blocking(move || execute(command)).await {
+        Ok(result) => result,
+        Err(_) => Err("command panicked".to_string()),
+    };
+
+    match result {
+        Ok(reply) => {
+            let mut line = format!("ok {}", started.elapsed().as_micros());
+            for byte in reply {
+                line.push_str(&format!(" {:02x}", byte));
+            }
+            line
+        }
+        Err(e) => format!("err {}", e),
+    }
+}
+
+async fn serve_connection(stream: UnixStream) -> io::Result<()> {
+    let (reader, writer) = stream.into_split();
+    let (pending_tx, mut pending) = mpsc::channel::<JoinHandle<String>>(PIPELINE_DEPTH);
+
+    let replies = tokio::spawn(async move {
+        let mut writer = BufWriter::new(writer);
+        while let Some(reply) = pending.recv().await {
+            let reply = reply
+                .await
+                .unwrap_or_else(|_| "err command lost".to_string());
+            writer.write_all(reply.as_bytes()).await?;
+            writer.write_all(b"\n").await?;
+            // only flush once the commands that are already done have been written
+            if pending.is_empty() {
+                writer.flush().await?;
+            }
+        }
+        writer.flush().await
+    });
+
+    let mut lines = BufReader::new(reader).lines();
+    while let Some(line) = lines.next_line().await? {
+        if line.trim().is_empty() {
+            continue;
+        }
+        if pending_tx
+            .send(tokio::spawn(run_command(line)))
+            .await
+            .is_err()
+        {
+            break;
+        }
+    }
+    drop(pending_tx);
+
+    replies.await.map_err(io::Error::other)?
+}
+
+/// Accepts control connections on `path` forever.
+pub async fn run(path: &Path) -> io::Result<()> {
+    // a socket file nobody listens on is left over from a daemon that died
+    if path.exists() {
+        if UnixStream::connect(path).await.is_ok() {
+            return Err(io::Error::new(
+                io::ErrorKind::AddrInUse,
+                format!("{} is served by another csp-server", path.display()),
+            ));
+        }
+        std::fs::remove_file(path)?;
+    }
+
+    let mut answers = CspCallbackPort::bind(CONTROL_SEND_PORT)?;
+    tokio::spawn(async move {
+        while let Some(packet) = answers.recv().await {
+            let mut line = format!(
+                "Answer to a control send from {}:{}:",
+                packet.src(),
+                packet.sport()
+            );
+            for byte in packet.data() {
+                line.push_str(&format!(" {:02x}", byte));
+            }
+            println!("{}", line);
+        }
+    });
+
+    let listener = UnixListener::bind(path)?;
+    println!("control socket listening on {}", path.display());
+
+    loop {
+        let (stream, _) = listener.accept().await?;
+        tokio::spawn(async move {
+            if let Err(e) = serve_connection(stream).await {
+                eprintln!("control connection: {}", e);
+            }
+        });
+    }
+}
+
+/// Thin client: sends `commands` to the daemon on `path`, or the lines of
+/// stdin when there are none, and prints the replies. Returns how many
+/// commands failed.
+pub async fn client(path: &Path, commands: Vec<String>) -> io::Result<usize> {
+    let stream = UnixStream::connect(path).await.map_err(|e| {
+        io::Error::new(
+            e.kind(),
+            format!(
+                "{}: {} (is csp-server --daemon running?)",
+                path.display(),
+                e
+            ),
+        )
+    })?;
+    let (reader, writer) = stream.into_split();
+
+    let requests = tokio::spawn(async move {
+        let mut writer = BufWriter::new(writer);
+        if commands.is_empty() {
+            let mut stdin = BufReader::new(tokio::io::stdin()).lines();
+            while let Some(line) = stdin.next_line().await? {
+                if line.trim().is_empty() {
+                    continue;
+                }
+                writer.write_all(line.as_bytes()).await?;
+                writer.write_all(b"\n").await?;
+                // keep the daemon busy while a slow producer writes the next line
+                if stdin.get_ref().buffer().is_empty() {
+                    writer.flush().await?;
+                }
+            }
+        } else {
+            for command in commands {
+                writer.write_all(command.as_bytes()).await?;
+                writer.write_all(b"\n").await?;
+            }
+        }
+        writer.flush().await?;
+        writer.into_inner().shutdown().await
+    });
+
+    let mut failed = 0;
+    let mut replies = BufReader::new(reader).lines();
+    while let Some(reply) = replies.next_line().await? {
+        if !reply.starts_with("ok") {
+            failed += 1;
+        }
+        println!("{}", reply);
+    }
+
+    requests.await.map_err(io::Error::other)??;
+    Ok(failed)
+}
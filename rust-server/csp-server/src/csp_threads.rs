@@ -0,0 +1,349 @@
+//! Dedicated OS threads for the blocking side of libcsp.
+//!
+//! `csp_route_work`, `csp_accept` and `csp_read` all block inside libcsp's
+//! own queues. Running them on Tokio workers parks those workers for good,
+//! so they live on plain threads here (optionally pinned to a core) and
+//! hand packets to async code through a bounded channel.
+
+use libcsp::libcsp::{
+    csp_accept, csp_bind, csp_buffer_free, csp_close, csp_conn_dport, csp_conn_sport, csp_conn_t,
+    csp_listen, csp_packet_t, csp_read, csp_route_work, csp_socket_s, csp_socket_t, CSP_ANY,
+};
+use std::ffi;
+use std::fmt;
+use std::io;
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::sync::mpsc as std_mpsc;
+use std::sync::{Arc, Mutex};
+use std::thread;
+use std::time::Instant;
+use tokio::sync::{mpsc, oneshot};
+
+/// Default depth of the channel between the CSP I/O thread and async code
+pub const RX_CHANNEL_DEPTH: usize = 64;
+
+/// A packet copied out of a libcsp buffer so the buffer can go straight back to the pool
+#[derive(Debug)]
+pub struct RxPacket {
+    pub src: u16,
+    pub dport: i32,
+    pub sport: i32,
+    pub data: Vec<u8>,
+}
+
+/// Backpressure counters of the CSP I/O thread -> async channel
+#[derive(Debug, Default)]
+pub struct ChannelStats {
+    /// packets handed over to async code
+    pub forwarded: AtomicU64,
+    /// times the channel was full and the I/O thread had to wait
+    pub full_events: AtomicU64,
+    /// total time spent waiting on a full channel, in microseconds
+    pub blocked_us: AtomicU64,
+    /// packets lost because the receiving side was gone
+    pub dropped: AtomicU64,
+    /// highest number of packets seen queued in the channel
+    pub peak_depth: AtomicUsize,
+}
+
+impl fmt::Display for ChannelStats {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        write!(
+            f,
+            "forwarded {} full {} blocked {} us dropped {} peak depth {}",
+            self.forwarded.load(Ordering::Relaxed),
+            self.full_events.load(Ordering::Relaxed),
+            self.blocked_us.load(Ordering::Relaxed),
+            self.dropped.load(Ordering::Relaxed),
+            self.peak_depth.load(Ordering::Relaxed)
+        )
+    }
+}
+
+/// Pins the calling thread to a single CPU core.
+pub fn pin_to_core(core: usize) -> io::Result<()> {
+    // unsafe needed because of following errors:
+    // -> call to unsafe functions `CPU_ZERO`, `CPU_SET` and `sched_setaffinity`
+    unsafe {
+        let mut set: libc::cpu_set_t = std::mem::zeroed();
+        libc::CPU_ZERO(&mut set);
+        libc::CPU_SET(core, &mut set);
+        if libc::sched_setaffinity(0, std::mem::size_of::<libc::cpu_set_t>(), &set) != 0 {
+            return Err(io::Error::last_os_error());
+        }
+    }
+
+    Ok(())
+}
+
+fn spawn_pinned<F>(name: &str, core: Option<usize>, f: F) -> io::Result<thread::JoinHandle<()>>
+where
+    F: FnOnce() + Send + 'static,
+{
+    let thread_name = name.to_string();
+    thread::Builder::new()
+        .name(thread_name.clone())
+        .spawn(move || {
+            if let Some(core) = core {
+                match pin_to_core(core) {
+                    Ok(_) => println!("{} pinned to core {}", thread_name, core),
+                    Err(e) => eprintln!("{} cannot be pinned to core {}: {}", thread_name, core, e),
+                }
+            }
+            f();
+        })
+}
+
+/// Starts the libcsp router on its own thread.
+pub fn spawn_router(core: Option<usize>) -> io::Result<thread::JoinHandle<()>> {
+    spawn_pinned("csp-router", core, || {
+        // unsafe needed because of following errors:
+        // -> call to unsafe function `csp_route_work`
+        unsafe {
+            loop {
+                csp_route_work();
+            }
+        }
+    })
+}
+
+/// Connection scheduler settings of `spawn_server`
+#[derive(Debug, Clone, Copy)]
+pub struct ServerConfig {
+    /// connections served at the same time, one worker thread each
+    pub workers: usize,
+    /// accepted connections waiting for a free worker, also the libcsp listen backlog
+    pub backlog: usize,
+    /// a connection is closed after this long without a packet
+    pub idle_ms: u32,
+}
+
+impl Default for ServerConfig {
+    fn default() -> Self {
+        ServerConfig {
+            workers: 4,
+            backlog: 10,
+            idle_ms: 50,
+        }
+    }
+}
+
+/// Counters of the connection scheduler
+#[derive(Debug, Default)]
+pub struct ConnStats {
+    /// connections accepted so far
+    pub accepted: AtomicU64,
+    /// connections being read by a worker right now
+    pub active: AtomicUsize,
+    pub peak_active: AtomicUsize,
+    /// accepted connections waiting for a worker right now
+    pub queued: AtomicUsize,
+    pub peak_queued: AtomicUsize,
+    /// total and longest time between accept and a worker picking the connection up
+    pub backlog_wait_us: AtomicU64,
+    pub backlog_wait_max_us: AtomicU64,
+}
+
+impl fmt::Display for ConnStats {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        let accepted = self.accepted.load(Ordering::Relaxed);
+        let wait_us = self.backlog_wait_us.load(Ordering::Relaxed);
+        write!(
+            f,
+            "accepted {} active {} (peak {}) queued {} (peak {}) backlog wait us avg {} max {}",
+            accepted,
+            self.active.load(Ordering::Relaxed),
+            self.peak_active.load(Ordering::Relaxed),
+            self.queued.load(Ordering::Relaxed),
+            self.peak_queued.load(Ordering::Relaxed),
+            wait_us.checked_div(accepted).unwrap_or(0),
+            self.backlog_wait_max_us.load(Ordering::Relaxed)
+        )
+    }
+}
+
+/// An accepted connection on its way to a worker
+struct Accepted {
+    conn: usize,
+    at: Instant,
+}
+
+/// Starts the accept thread and `config.workers` connection workers, every
+/// packet read is forwarded to `tx`.
+///
+/// Each worker serves one connection until it goes idle, so a slow node only
+/// holds up its own worker. Accepted connections queue for a free worker up
+/// to `config.backlog`; past that the accept thread stops accepting and the
+/// rest waits in the libcsp listen backlog. When the channel to `tx` is full
+/// the workers wait for room instead of dropping, so the pressure ends up in
+/// libcsp's connection queues where it belongs.
+///
+/// Only the accept thread is pinned to `core`, the workers are left to the
+/// scheduler: pinned to one core they would serve a single connection at a
+/// time.
+pub fn spawn_server(
+    core: Option<usize>,
+    config: ServerConfig,
+    tx: mpsc::Sender<RxPacket>,
+    stats: Arc<ChannelStats>,
+    conn_stats: Arc<ConnStats>,
+) -> io::Result<thread::JoinHandle<()>> {
+    let workers = config.workers.max(1);
+    let backlog = config.backlog.max(1);
+    let (queue_tx, queue_rx) = std_mpsc::sync_channel::<Accepted>(backlog);
+    let queue_rx = Arc::new(Mutex::new(queue_rx));
+
+    for worker in 0..workers {
+        let queue_rx = queue_rx.clone();
+        let tx = tx.clone();
+        let stats = stats.clone();
+        let conn_stats = conn_stats.clone();
+        spawn_pinned(&format!("csp-conn-{}", worker), None, move || loop {
+            let accepted = match queue_rx.lock() {
+                Ok(queue) => match queue.recv() {
+                    Ok(accepted) => accepted,
+                    Err(_) => return,
+                },
+                Err(_) => return,
+            };
+            serve(accepted, config.idle_ms, &tx, &stats, &conn_stats);
+        })?;
+    }
+
+    spawn_pinned("csp-io", core, move || {
+        println!(
+            "Server task started, {} workers, backlog {}",
+            workers, backlog
+        );
+        // unsafe needed because of following errors:
+        // -> call to unsafe functions `csp_bind`, `csp_listen`, `csp_accept`
+        unsafe {
+            /* Create socket with no specific socket options, e.g. accepts CRC32, HMAC, etc. if enabled during compilation */
+            let mut sock: csp_socket_t = std::mem::zeroed();
+
+            /* Bind socket to all ports, e.g. all incoming connections will be handled here */
+            csp_bind(
+                (&mut sock) as *mut csp_socket_s,
+                CSP_ANY.try_into().unwrap(),
+            );
+
+            csp_listen((&mut sock) as *mut csp_socket_s, backlog);
+
+            loop {
+                /* Wait for a new connection, 10000 mS timeout */
+                let conn: *mut csp_conn_t = csp_accept((&mut sock) as *mut csp_socket_s, 10000);
+                if conn.is_null() {
+                    // timeout
+                    continue;
+                }
+
+                conn_stats.accepted.fetch_add(1, Ordering::Relaxed);
+                let queued = conn_stats.queued.fetch_add(1, Ordering::Relaxed) + 1;
+                conn_stats.peak_queued.fetch_max(queued, Ordering::Relaxed);
+
+                // blocks while every worker is busy and the queue is full
+                let accepted = Accepted {
+                    conn: conn as usize,
+                    at: Instant::now(),
+                };
+                if let Err(std_mpsc::SendError(accepted)) = queue_tx.send(accepted) {
+                    csp_close(accepted.conn as *mut csp_conn_t);
+                    return;
+                }
+            }
+        }
+    })
+}
+
+/// Reads one connection until it stays idle for `idle_ms`, then closes it.
+fn serve(
+    accepted: Accepted,
+    idle_ms: u32,
+    tx: &mpsc::Sender<RxPacket>,
+    stats: &ChannelStats,
+    conn_stats: &ConnStats,
+) {
+    let waited = accepted.at.elapsed().as_micros() as u64;
+    conn_stats.queued.fetch_sub(1, Ordering::Relaxed);
+    conn_stats
+        .backlog_wait_us
+        .fetch_add(waited, Ordering::Relaxed);
+    conn_stats
+        .backlog_wait_max_us
+        .fetch_max(waited, Ordering::Relaxed);
+    let active = conn_stats.active.fetch_add(1, Ordering::Relaxed) + 1;
+    conn_stats.peak_active.fetch_max(active, Ordering::Relaxed);
+
+    let conn = accepted.conn as *mut csp_conn_t;
+    // unsafe needed because of following errors:
+    // -> call to unsafe functions `csp_read`, `csp_conn_dport`, `csp_conn_sport`, `csp_close`
+    // -> dereference of raw pointer
+    // -> access to union field is unsafe
+    unsafe {
+        let mut packet: *mut csp_packet_t;
+        while {
+            packet = csp_read(conn, idle_ms);
+            !packet.is_null()
+        } {
+            let len = (*packet).length as usize;
+            let rx = RxPacket {
+                src: (*packet).id.src,
+                dport: csp_conn_dport(conn),
+                sport: csp_conn_sport(conn),
+                data: (&(*packet).__bindgen_anon_1.data)[..len].to_vec(),
+            };
+            csp_buffer_free(packet as *mut ffi::c_void);
+
+            forward(tx, stats, rx);
+        }
+
+        /* Close current connection */
+        csp_close(conn);
+    }
+
+    conn_stats.active.fetch_sub(1, Ordering::Relaxed);
+}
+
+fn forward(tx: &mpsc::Sender<RxPacket>, stats: &ChannelStats, rx: RxPacket) {
+    match tx.try_send(rx) {
+        Ok(_) => {}
+        Err(mpsc::error::TrySendError::Full(rx)) => {
+            stats.full_events.fetch_add(1, Ordering::Relaxed);
+            let start = Instant::now();
+            if tx.blocking_send(rx).is_err() {
+                stats.dropped.fetch_add(1, Ordering::Relaxed);
+                return;
+            }
+            stats
+                .blocked_us
+                .fetch_add(start.elapsed().as_micros() as u64, Ordering::Relaxed);
+        }
+        Err(mpsc::error::TrySendError::Closed(_)) => {
+            stats.dropped.fetch_add(1, Ordering::Relaxed);
+            return;
+        }
+    }
+
+    stats.forwarded.fetch_add(1, Ordering::Relaxed);
+    let depth = tx.max_capacity() - tx.capacity();
+    stats.peak_depth.fetch_max(depth, Ordering::Relaxed);
+}
+
+/// Runs a blocking CSP call on a fresh OS thread and awaits its result
+/// without tying up a runtime worker.
+pub async fn run_blocking<F, R>(name: &str, f: F) -> io::Result<R>
+where
+    F: FnOnce() -> R + Send + 'static,
+    R: Send + 'static,
+{
+    let (done_tx, done_rx) = oneshot::channel();
+    thread::Builder::new()
+        .name(name.to_string())
+        .spawn(move || {
+            let _ = done_tx.send(f());
+        })?;
+
+    done_rx
+        .await
+        .map_err(|_| io::Error::other("blocking CSP call panicked"))
+}
@@ -0,0 +1,284 @@
+//! Fleet fan-out: one command to a whole set of nodes from a single process.
+//!
+//! Requests go out connectionless with `csp_sendto` from `FANOUT_REPLY_PORT`,
+//! so a fleet command needs no libcsp connection per node. Nodes answer with
+//! `csp_sendto_reply` (the CSP services do), which lands on a callback port
+//! here and is matched by sender. At most `window` nodes are waiting for an
+//! answer at any time, the next node goes out the moment one answers.
+
+use libcsp::csp_async::CspCallbackPort;
+use libcsp::csp_packet::CspPacket;
+use libcsp::libcsp::{csp_sendto, CSP_O_NONE};
+use std::collections::{BTreeMap, HashMap, VecDeque};
+use std::fmt;
+use std::io;
+use std::time::{Duration, Instant};
+use tokio::time::{sleep_until, Instant as TokioInstant};
+
+/// Source port of fan-out requests, the highest port libcsp lets us bind
+pub const FANOUT_REPLY_PORT: u8 = 32;
+
+/// CSP addresses are 14 bits wide
+const ADDRESS_BITS: u32 = 14;
+pub const ADDRESS_MAX: u16 = (1 << ADDRESS_BITS) - 1;
+
+#[derive(Debug, Clone, Copy)]
+pub struct FanoutConfig {
+    pub port: u8,
+    pub prio: u8,
+    /// nodes waiting for an answer at once
+    pub window: usize,
+    pub timeout: Duration,
+    /// only send, do not wait for answers
+    pub expect_reply: bool,
+}
+
+#[derive(Debug)]
+pub enum Outcome {
+    Reply { rtt: Duration, data: Vec<u8> },
+    Sent,
+    Timeout,
+    Failed(String),
+}
+
+pub struct FanoutReport {
+    pub port: u8,
+    pub window: usize,
+    pub elapsed: Duration,
+    pub outcomes: BTreeMap<u16, Outcome>,
+    /// answers from nodes that were not waited for, or came twice
+    pub unexpected: u64,
+}
+
+impl FanoutReport {
+    pub fn all_ok(&self) -> bool {
+        self.outcomes
+            .values()
+            .all(|o| matches!(o, Outcome::Reply { .. } | Outcome::Sent))
+    }
+}
+
+impl fmt::Display for FanoutReport {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        let mut rtts: Vec<u128> = Vec::new();
+        let (mut sent, mut timeouts, mut failed) = (0, 0, 0);
+        for outcome in self.outcomes.values() {
+            match outcome {
+                Outcome::Reply { rtt, .. } => rtts.push(rtt.as_micros()),
+                Outcome::Sent => sent += 1,
+                Outcome::Timeout => timeouts += 1,
+                Outcome::Failed(_) => failed += 1,
+            }
+        }
+        rtts.sort_unstable();
+
+        writeln!(
+            f,
+            "fanout port {}: {} nodes, {} replies, {} sent without reply, {} timeouts, {} failed, {} unexpected in {} ms (window {})",
+            self.port,
+            self.outcomes.len(),
+            rtts.len(),
+            sent,
+            timeouts,
+            failed,
+            self.unexpected,
+            self.elapsed.as_millis(),
+            self.window
+        )?;
+        if !rtts.is_empty() {
+            let p = |p: f64| rtts[((rtts.len() - 1) as f64 * p).round() as usize];
+            writeln!(
+                f,
+                "rtt us min {} p50 {} p99 {} max {}",
+                rtts[0],
+                p(0.5),
+                p(0.99),
+                rtts[rtts.len() - 1]
+            )?;
+        }
+
+        for (node, outcome) in &self.outcomes {
+            match outcome {
+                Outcome::Reply { rtt, data } => {
+                    write!(
+                        f,
+                        "node {}: {} us, {} bytes:",
+                        node,
+                        rtt.as_micros(),
+                        data.len()
+                    )?;
+                    for byte in data {
+                        write!(f, " {:02x}", byte)?;
+                    }
+                    writeln!(f)?;
+                }
+                Outcome::Sent => writeln!(f, "node {}: sent", node)?,
+                Outcome::Timeout => writeln!(f, "node {}: timeout", node)?,
+                Outcome::Failed(e) => writeln!(f, "node {}: {}", node, e)?,
+            }
+        }
+
+        Ok(())
+    }
+}
+
+/// Parses a node set: comma separated node ids, ranges (`10-20`) and
+/// subnets (`32/10`, the address with its network bits out of 14). The
+/// broadcast address of a subnet is left out.
+pub fn parse_node_set(spec: &str) -> Result<Vec<u16>, String> {
+    let parse = |s: &str| -> Result<u16, String> {
+        let node: u16 = s
+            .trim()
+            .parse()
+            .map_err(|_| format!("bad node id '{}'", s.trim()))?;
+        if node > ADDRESS_MAX {
+            return Err(format!("node id {} out of range 0..{}", node, ADDRESS_MAX));
+        }
+        Ok(node)
+    };
+
+    let mut nodes = Vec::new();
+    for item in spec.split(',').filter(|s| !s.trim().is_empty()) {
+        if let Some((first, last)) = item.split_once('-') {
+            let (first, last) = (parse(first)?, parse(last)?);
+            if first > last {
+                return Err(format!("empty range '{}'", item.trim()));
+            }
+            nodes.extend(first..=last);
+        } else if let Some((addr, bits)) = item.split_once('/') {
+            let addr = parse(addr)?;
+            let bits: u32 = bits
+                .trim()
+                .parse()
+                .ok()
+                .filter(|&b| b <= ADDRESS_BITS)
+                .ok_or_else(|| format!("bad network bits in '{}'", item.trim()))?;
+            let hostmask = ADDRESS_MAX >> bits;
+            let first = addr & !hostmask;
+            let broadcast = first | hostmask;
+            nodes.extend((first..=broadcast).filter(|&n| n != broadcast || hostmask == 0));
+        } else {
+            nodes.push(parse(item)?);
+        }
+    }
+
+    nodes.sort_unstable();
+    nodes.dedup();
+    if nodes.is_empty() {
+        return Err("empty node set".to_string());
+    }
+    Ok(nodes)
+}
+
+fn send_requests(nodes: Vec<u16>, config: FanoutConfig, payload: &[u8]) -> Vec<(u16, String)> {
+    let mut failed = Vec::new();
+
+    for node in nodes {
+        let Some(packet) = CspPacket::from_slice(payload) else {
+            failed.push((node, "no csp buffer".to_string()));
+            continue;
+        };
+
+        // unsafe needed because of following errors:
+        // -> call to unsafe function `csp_sendto`
+        unsafe {
+            csp_sendto(
+                config.prio,
+                node,
+                config.port,
+                FANOUT_REPLY_PORT,
+                CSP_O_NONE,
+                packet.into_raw(),
+            );
+        }
+    }
+
+    failed
+}
+
+/// Sends `payload` to every node of `nodes` and collects what comes back.
+pub async fn run(
+    nodes: Vec<u16>,
+    payload: Vec<u8>,
+    config: FanoutConfig,
+) -> io::Result<FanoutReport> {
+    if payload.len() > CspPacket::capacity() {
+        return Err(io::Error::new(
+            io::ErrorKind::InvalidInput,
+            format!(
+                "payload of {} bytes does not fit a csp buffer",
+                payload.len()
+            ),
+        ));
+    }
+
+    let mut replies = CspCallbackPort::bind(FANOUT_REPLY_PORT)?;
+    let window = config.window.max(1);
+    let started = Instant::now();
+    let mut queue: VecDeque<u16> = nodes.into_iter().collect();
+    let mut waiting: HashMap<u16, Instant> = HashMap::new();
+    let mut outcomes = BTreeMap::new();
+    let mut unexpected = 0;
+
+    while !queue.is_empty() || !waiting.is_empty() {
+        let room = window.saturating_sub(waiting.len()).min(queue.len());
+        if room > 0 {
+            let batch: Vec<u16> = queue.drain(..room).collect();
+            let now = Instant::now();
+            for &node in &batch {
+                if config.expect_reply {
+                    waiting.insert(node, now);
+                } else {
+                    outcomes.insert(node, Outcome::Sent);
+                }
+            }
+
+            // csp_sendto can wait for room in the CAN tx queue, keep it off the runtime
+            let payload = payload.clone();
+            let failed =
+                tokio::task::spawn_blocking(move || send_requests(batch, config, &payload))
+                    .await
+                    .map_err(io::Error::other)?;
+            for (node, e) in failed {
+                waiting.remove(&node);
+                outcomes.insert(node, Outcome::Failed(e));
+            }
+            continue;
+        }
+
+        let Some(oldest) = waiting.values().min().copied() else {
+            continue;
+        };
+        tokio::select! {
+            Some(packet) = replies.recv() => {
+                match waiting.remove(&packet.src()) {
+                    Some(sent) => {
+                        outcomes.insert(packet.src(), Outcome::Reply {
+                            rtt: sent.elapsed(),
+                            data: packet.data().to_vec(),
+                        });
+                    }
+                    None => unexpected += 1,
+                }
+            }
+            _ = sleep_until(TokioInstant::from_std(oldest + config.timeout)) => {
+                let now = Instant::now();
+                waiting.retain(|&node, &mut sent| {
+                    let expired = now.duration_since(sent) >= config.timeout;
+                    if expired {
+                        outcomes.insert(node, Outcome::Timeout);
+                    }
+                    !expired
+                });
+            }
+        }
+    }
+
+    Ok(FanoutReport {
+        port: config.port,
+        window,
+        elapsed: started.elapsed(),
+        outcomes,
+        unexpected,
+    })
+}
@@ -0,0 +1,148 @@
+//! MemHealth poller (nodes/node2/22.MemHealth.uavcan).
+//!
+//! Everything the node reports is kept since its boot: peaks, drops and the
+//! lowest free buffer and stack figures. Every answer repeats the queue and
+//! buffer part, the tasks come one per request.
+
+use std::fmt;
+use std::io;
+use std::time::Duration;
+use tokio::time::{interval, MissedTickBehavior};
+use uavcan_messages::{MemHealthRequest, MemHealthResponse, Message};
+
+use crate::csp_threads;
+use crate::runtime_stats::query;
+
+pub const MEM_HEALTH_PORT: u8 = MemHealthRequest::ID as u8;
+
+const RX_RINGS: [&str; 2] = ["rx fifo0", "rx fifo1"];
+
+pub struct TaskStack {
+    pub name: String,
+    pub depth: u16,
+    pub free: u16,
+}
+
+pub struct MemReport {
+    pub node: u16,
+    pub first: MemHealthResponse,
+    pub tasks: Vec<TaskStack>,
+}
+
+fn task(response: &MemHealthResponse) -> TaskStack {
+    TaskStack {
+        name: String::from_utf8_lossy(response.task_name.as_slice()).into_owned(),
+        depth: response.stack_depth,
+        free: response.stack_free,
+    }
+}
+
+/// Fetches the queue and buffer figures and the stack of every task of `node`.
+pub fn poll(node: u16, timeout_ms: u32) -> Result<MemReport, String> {
+    let first: MemHealthResponse = query(
+        node,
+        MEM_HEALTH_PORT,
+        &MemHealthRequest { task_index: 0 },
+        timeout_ms,
+    )?;
+
+    let mut tasks = Vec::with_capacity(first.task_count as usize);
+    if first.task_count > 0 {
+        tasks.push(task(&first));
+    }
+    for index in 1..first.task_count {
+        let response: MemHealthResponse = query(
+            node,
+            MEM_HEALTH_PORT,
+            &MemHealthRequest { task_index: index },
+            timeout_ms,
+        )?;
+        tasks.push(task(&response));
+    }
+
+    Ok(MemReport { node, first, tasks })
+}
+
+fn percent(used: u32, size: u32) -> u32 {
+    if size == 0 {
+        return 0;
+    }
+    used * 100 / size
+}
+
+impl fmt::Display for MemReport {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        let m = &self.first;
+        writeln!(f, "MemHealth {}:", self.node)?;
+        for (i, name) in RX_RINGS.iter().enumerate() {
+            writeln!(
+                f,
+                "  {:<16} peak {:>4}/{:<4} ({:>3}%), {} dropped, {} hw fifo overruns",
+                name,
+                m.rx_ring_peak[i],
+                m.rx_ring_length[i],
+                percent(m.rx_ring_peak[i], m.rx_ring_length[i] as u32),
+                m.rx_ring_dropped[i],
+                m.rx_fifo_overruns[i]
+            )?;
+        }
+        writeln!(
+            f,
+            "  {:<16} peak {:>4}/{:<4} ({:>3}%), {} dropped",
+            "tx queues",
+            m.tx_queue_peak,
+            m.tx_queue_length,
+            percent(m.tx_queue_peak, m.tx_queue_length as u32),
+            m.tx_dropped
+        )?;
+        // only sampled by the application, the real peak may be higher
+        let buffers_used = m.buffer_count.saturating_sub(m.buffer_low_water) as u32;
+        writeln!(
+            f,
+            "  {:<16} peak >={:>2}/{:<4} ({:>3}%), {} times exhausted",
+            "csp buffers",
+            buffers_used,
+            m.buffer_count,
+            percent(buffers_used, m.buffer_count as u32),
+            m.buffer_exhausted
+        )?;
+
+        if self.tasks.is_empty() {
+            writeln!(f, "  no tasks listed")?;
+        }
+        for task in &self.tasks {
+            let used = task.depth.saturating_sub(task.free) as u32;
+            writeln!(
+                f,
+                "  stack {:<10} peak {:>4}/{:<4} ({:>3}%) words, {} left",
+                task.name,
+                used,
+                task.depth,
+                percent(used, task.depth as u32),
+                task.free
+            )?;
+        }
+        Ok(())
+    }
+}
+
+/// Polls `node` once, or every `period` forever, and prints each report.
+pub async fn run(node: u16, period: Option<Duration>, timeout_ms: u32) -> io::Result<()> {
+    let Some(period) = period else {
+        let report = csp_threads::run_blocking("mem-health", move || poll(node, timeout_ms))
+            .await?
+            .map_err(io::Error::other)?;
+        print!("{}", report);
+        return Ok(());
+    };
+
+    let mut ticker = interval(period);
+    ticker.set_missed_tick_behavior(MissedTickBehavior::Delay);
+    loop {
+        ticker.tick().await;
+        match csp_threads::run_blocking("mem-health", move || poll(node, timeout_ms)).await? {
+            Ok(report) => print!("{}", report),
+            Err(e) => eprintln!("MemHealth {}: {}", node, e),
+        }
+    }
+}
@@ -0,0 +1,258 @@
+//! NodePing/NodePong round-trip probe (nodes/node2/30.NodePing.uavcan, 31.NodePong.uavcan).
+//!
+//! Every period one NodePing goes to each node on port 30 and the node answers
+//! with a NodePong on port 31, which lands on a callback port here. A node has
+//! at most one ping outstanding and every round carries a new seq, which the
+//! pong echoes. A pong is measured only when its sender and seq match the
+//! outstanding ping and it came within the timeout. Any other pong is counted
+//! as late and not measured, whether it comes before or after the next round.
+
+use libcsp::csp_async::CspCallbackPort;
+use libcsp::csp_packet::CspPacket;
+use libcsp::libcsp::{csp_prio_t_CSP_PRIO_NORM, csp_sendto, CSP_O_NONE};
+use std::collections::BTreeMap;
+use std::fmt;
+use std::io;
+use std::time::{Duration, Instant};
+use tokio::time::{interval, MissedTickBehavior};
+use uavcan_messages::{Message, NodePing, NodePong};
+
+pub const NODE_PING_PORT: u8 = NodePing::ID as u8;
+pub const NODE_PONG_PORT: u8 = NodePong::ID as u8;
+
+const REPORT_PERIOD: Duration = Duration::from_secs(10);
+
+// Values below 2^SUB_BUCKET_BITS are counted exactly, above that every power of two
+// range is split into 2^(SUB_BUCKET_BITS - 1) buckets, i.e. under 1/64 relative error.
+const SUB_BUCKET_BITS: u32 = 7;
+const SUB_BUCKETS: u32 = 1 << SUB_BUCKET_BITS;
+const HALF_SUB_BUCKETS: u32 = SUB_BUCKETS / 2;
+const BUCKETS: usize = (SUB_BUCKETS + (32 - SUB_BUCKET_BITS) * HALF_SUB_BUCKETS) as usize;
+
+/// Log-linear latency histogram in the spirit of HdrHistogram, fixed size and
+/// allocation free once created.
+pub struct LatencyHistogram {
+    counts: Vec<u64>,
+    total: u64,
+    sum: u64,
+    min: u32,
+    max: u32,
+}
+
+impl Default for LatencyHistogram {
+    fn default() -> Self {
+        LatencyHistogram {
+            counts: vec![0; BUCKETS],
+            total: 0,
+            sum: 0,
+            min: u32::MAX,
+            max: 0,
+        }
+    }
+}
+
+impl LatencyHistogram {
+    fn index(value: u32) -> usize {
+        if value < SUB_BUCKETS {
+            return value as usize;
+        }
+
+        let shift = 31 - value.leading_zeros() - (SUB_BUCKET_BITS - 1);
+        let top = value >> shift;
+        (SUB_BUCKETS + (shift - 1) * HALF_SUB_BUCKETS + (top - HALF_SUB_BUCKETS)) as usize
+    }
+
+    /// Largest value that falls into bucket `index`
+    fn highest_equivalent(index: usize) -> u32 {
+        let index = index as u32;
+        if index < SUB_BUCKETS {
+            return index;
+        }
+
+        let shift = (index - SUB_BUCKETS) / HALF_SUB_BUCKETS + 1;
+        let top = (index - SUB_BUCKETS) % HALF_SUB_BUCKETS + HALF_SUB_BUCKETS;
+        (((top as u64 + 1) << shift) - 1).min(u32::MAX as u64) as u32
+    }
+
+    pub fn record(&mut self, value: u32) {
+        self.counts[Self::index(value)] += 1;
+        self.total += 1;
+        self.sum += value as u64;
+        self.min = self.min.min(value);
+        self.max = self.max.max(value);
+    }
+
+    /// Value at percentile `p` (0..100), `None` while empty
+    pub fn value_at_percentile(&self, p: f64) -> Option<u32> {
+        if self.total == 0 {
+            return None;
+        }
+
+        let rank = ((p / 100.0) * self.total as f64).ceil().max(1.0) as u64;
+        let mut seen = 0;
+        for (index, &count) in self.counts.iter().enumerate() {
+            seen += count;
+            if seen >= rank {
+                return Some(Self::highest_equivalent(index).min(self.max));
+            }
+        }
+
+        Some(self.max)
+    }
+}
+
+impl fmt::Display for LatencyHistogram {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        if self.total == 0 {
+            return write!(f, "no samples");
+        }
+
+        let p = |p| self.value_at_percentile(p).unwrap_or(0);
+        write!(
+            f,
+            "rtt us min {} p50 {} p90 {} p99 {} p99.9 {} max {} mean {}",
+            self.min,
+            p(50.0),
+            p(90.0),
+            p(99.0),
+            p(99.9),
+            self.max,
+            self.sum / self.total
+        )
+    }
+}
+
+#[derive(Default)]
+struct NodeState {
+    /// seq and send time of the outstanding ping
+    in_flight: Option<(u32, Instant)>,
+    sent: u64,
+    pongs: u64,
+    timeouts: u64,
+    late: u64,
+    malformed: u64,
+    histogram: LatencyHistogram,
+}
+
+impl fmt::Display for NodeState {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        write!(
+            f,
+            "sent {} pong {} timeout {} late {} malformed {}, {}",
+            self.sent, self.pongs, self.timeouts, self.late, self.malformed, self.histogram
+        )
+    }
+}
+
+fn send_pings(pinger_id: u8, seq: u32, nodes: Vec<u16>) {
+    let ping = NodePing { pinger_id, seq };
+
+    for node in nodes {
+        let Some(mut packet) = CspPacket::get() else {
+            eprintln!("NodePing to {}: no csp buffer", node);
+            continue;
+        };
+        match ping.encode(packet.buffer_mut()) {
+            Ok(len) => packet.set_len(len),
+            Err(e) => {
+                eprintln!("NodePing to {}: {}", node, e);
+                continue;
+            }
+        }
+
+        // unsafe needed because of following errors:
+        // -> call to unsafe function `csp_sendto`
+        unsafe {
+            csp_sendto(
+                csp_prio_t_CSP_PRIO_NORM as u8,
+                node,
+                NODE_PING_PORT,
+                NODE_PONG_PORT,
+                CSP_O_NONE,
+                packet.into_raw(),
+            );
+        }
+    }
+}
+
+/// Pings `nodes` every `period` forever and prints per node histograms every 10 s.
+pub async fn run(
+    pinger_id: u8,
+    nodes: Vec<u16>,
+    period: Duration,
+    timeout: Duration,
+) -> io::Result<()> {
+    let mut pongs = CspCallbackPort::bind(NODE_PONG_PORT)?;
+    let mut state: BTreeMap<u16, NodeState> = nodes
+        .iter()
+        .map(|&node| (node, NodeState::default()))
+        .collect();
+
+    let mut ping = interval(period);
+    ping.set_missed_tick_behavior(MissedTickBehavior::Skip);
+    let mut report = interval(REPORT_PERIOD);
+    report.tick().await;
+    let mut seq: u32 = 0;
+
+    loop {
+        tokio::select! {
+            _ = ping.tick() => {
+                let now = Instant::now();
+                seq = seq.wrapping_add(1);
+                let mut due = Vec::with_capacity(state.len());
+                for (&node, s) in state.iter_mut() {
+                    if let Some((_, sent)) = s.in_flight {
+                        if now.duration_since(sent) < timeout {
+                            continue;
+                        }
+                        s.timeouts += 1;
+                    }
+                    s.in_flight = Some((seq, now));
+                    s.sent += 1;
+                    due.push(node);
+                }
+
+                // csp_sendto can wait for room in the CAN tx queue, keep it off the runtime
+                if !due.is_empty() {
+                    tokio::task::spawn_blocking(move || send_pings(pinger_id, seq, due));
+                }
+            }
+            Some(packet) = pongs.recv() => {
+                let received = Instant::now();
+                let Some(s) = state.get_mut(&packet.src()) else {
+                    continue;
+                };
+
+                let pong = match NodePong::decode(packet.data()) {
+                    Ok(pong) if pong.pinger_id == pinger_id => pong,
+                    _ => {
+                        s.malformed += 1;
+                        continue;
+                    }
+                };
+
+                match s.in_flight {
+                    Some((sent_seq, sent)) if sent_seq == pong.seq => {
+                        s.in_flight = None;
+                        let rtt = received.duration_since(sent);
+                        if rtt > timeout {
+                            // the answer to the current ping, but too late to measure
+                            s.timeouts += 1;
+                            s.late += 1;
+                            continue;
+                        }
+                        s.pongs += 1;
+                        s.histogram.record(rtt.as_micros().min(u32::MAX as u128) as u32);
+                    }
+                    // an earlier round, already counted as a timeout
+                    _ => s.late += 1,
+                }
+            }
+            _ = report.tick() => {
+                for (node, s) in &state {
+                    println!("NodePing {}: {}", node, s);
+                }
+            }
+        }
+    }
+}
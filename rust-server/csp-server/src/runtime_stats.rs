@@ -0,0 +1,222 @@
+//! RunTimeStats poller (nodes/node2/20.RunTimeStats.uavcan).
+//!
+//! Asking a node for task 0 closes its measurement window and opens the next
+//! one, the other tasks of the closed window are then fetched one request
+//! each. A poll therefore covers the time since the previous poll of that
+//! node, by whoever sent it.
+
+use libcsp::csp_packet::CspPacket;
+use libcsp::csp_utils;
+use libcsp::libcsp::csp_prio_t_CSP_PRIO_NORM;
+use std::fmt;
+use std::io;
+use std::time::Duration;
+use tokio::time::{interval, MissedTickBehavior};
+use uavcan_messages::{Message, RunTimeStatsRequest, RunTimeStatsResponse};
+
+use crate::csp_threads;
+
+pub const RUNTIME_STATS_PORT: u8 = RunTimeStatsRequest::ID as u8;
+
+/// Order of the isr_ arrays, see runtime_isr_e in the firmware
+const ISR_NAMES: [&str; 4] = ["can_tx", "can_rx0", "can_rx1", "can_sce"];
+
+/// FreeRTOS eTaskState
+const TASK_STATES: [&str; 5] = ["running", "ready", "blocked", "suspended", "deleted"];
+
+/// Sends `request` to `port` of `node` and decodes the single reply.
+/// Blocks in libcsp, call it off the runtime.
+pub fn query<Req: Message, Resp: Message>(
+    node: u16,
+    port: u8,
+    request: &Req,
+    timeout_ms: u32,
+) -> Result<Resp, String> {
+    let mut packet = CspPacket::get().ok_or("no csp buffer")?;
+    let len = request
+        .encode(packet.buffer_mut())
+        .map_err(|e| e.to_string())?;
+    packet.set_len(len);
+
+    let reply = csp_utils::csp_transaction_packet(
+        csp_prio_t_CSP_PRIO_NORM as u8,
+        node,
+        port,
+        timeout_ms,
+        packet,
+    )
+    .map_err(|e| format!("csp error {}", e))?;
+    Resp::decode(reply.data()).map_err(|e| e.to_string())
+}
+
+pub struct TaskRuntime {
+    pub name: String,
+    pub priority: u8,
+    pub state: u8,
+    pub permille: u16,
+}
+
+pub struct RuntimeReport {
+    pub node: u16,
+    pub window_ms: u32,
+    pub core_clock_hz: u32,
+    pub tasks: Vec<TaskRuntime>,
+    /// (permille, count, max cycles) per CAN vector
+    pub isrs: [(u16, u32, u32); 4],
+    pub critical_max_cycles: u32,
+    pub critical_max_site: String,
+}
+
+impl RuntimeReport {
+    fn micros(&self, cycles: u32) -> f64 {
+        if self.core_clock_hz == 0 {
+            return 0.0;
+        }
+        cycles as f64 * 1e6 / self.core_clock_hz as f64
+    }
+}
+
+fn task(response: &RunTimeStatsResponse) -> TaskRuntime {
+    TaskRuntime {
+        name: String::from_utf8_lossy(response.task_name.as_slice()).into_owned(),
+        priority: response.task_priority,
+        state: response.task_state,
+        permille: response.task_permille,
+    }
+}
+
+/// Closes the current window of `node` and fetches all of its tasks.
+pub fn poll(node: u16, timeout_ms: u32) -> Result<RuntimeReport, String> {
+    let first: RunTimeStatsResponse = query(
+        node,
+        RUNTIME_STATS_PORT,
+        &RunTimeStatsRequest { task_index: 0 },
+        timeout_ms,
+    )?;
+
+    let mut isrs = [(0, 0, 0); 4];
+    for (i, isr) in isrs.iter_mut().enumerate() {
+        *isr = (
+            first.isr_permille[i],
+            first.isr_count[i],
+            first.isr_max_cycles[i],
+        );
+    }
+
+    let mut report = RuntimeReport {
+        node,
+        window_ms: first.window_ms,
+        core_clock_hz: first.core_clock_hz,
+        tasks: Vec::with_capacity(first.task_count as usize),
+        isrs,
+        critical_max_cycles: first.critical_max_cycles,
+        critical_max_site: String::from_utf8_lossy(first.critical_max_site.as_slice()).into_owned(),
+    };
+    if first.task_count == 0 {
+        return Ok(report);
+    }
+
+    report.tasks.push(task(&first));
+    for index in 1..first.task_count {
+        let response: RunTimeStatsResponse = query(
+            node,
+            RUNTIME_STATS_PORT,
+            &RunTimeStatsRequest { task_index: index },
+            timeout_ms,
+        )?;
+        // somebody else opened a new window in between, the pages would not add up
+        if response.window_ms != first.window_ms || response.task_count != first.task_count {
+            return Err("window changed while paging, another poller is active".to_string());
+        }
+        report.tasks.push(task(&response));
+    }
+
+    Ok(report)
+}
+
+impl fmt::Display for RuntimeReport {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        writeln!(
+            f,
+            "RunTimeStats {}: {} ms window at {:.1} MHz",
+            self.node,
+            self.window_ms,
+            self.core_clock_hz as f64 / 1e6
+        )?;
+        if self.tasks.is_empty() {
+            writeln!(f, "  no tasks, the node has more than it can list")?;
+        }
+
+        let mut busy = 0u32;
+        for task in &self.tasks {
+            busy += task.permille as u32;
+            writeln!(
+                f,
+                "  {:<16} prio {} {:<9} {:>3}.{}%",
+                task.name,
+                task.priority,
+                TASK_STATES.get(task.state as usize).unwrap_or(&"?"),
+                task.permille / 10,
+                task.permille % 10
+            )?;
+        }
+        if !self.tasks.is_empty() {
+            let rest = 1000u32.saturating_sub(busy);
+            writeln!(
+                f,
+                "  {:<16}                {:>3}.{}%",
+                "(sleeping)",
+                rest / 10,
+                rest % 10
+            )?;
+        }
+
+        for (name, &(permille, count, max_cycles)) in ISR_NAMES.iter().zip(self.isrs.iter()) {
+            if count == 0 {
+                continue;
+            }
+            writeln!(
+                f,
+                "  isr {:<12} {:>3}.{}%, {} calls, longest {} cycles ({:.1} us)",
+                name,
+                permille / 10,
+                permille % 10,
+                count,
+                max_cycles,
+                self.micros(max_cycles)
+            )?;
+        }
+
+        if self.critical_max_cycles != 0 {
+            writeln!(
+                f,
+                "  longest critical section {} cycles ({:.1} us) in {}",
+                self.critical_max_cycles,
+                self.micros(self.critical_max_cycles),
+                self.critical_max_site
+            )?;
+        }
+        Ok(())
+    }
+}
+
+/// Polls `node` once, or every `period` forever, and prints each window.
+pub async fn run(node: u16, period: Option<Duration>, timeout_ms: u32) -> io::Result<()> {
+    let Some(period) = period else {
+        let report = csp_threads::run_blocking("runtime-stats", move || poll(node, timeout_ms))
+            .await?
+            .map_err(io::Error::other)?;
+        print!("{}", report);
+        return Ok(());
+    };
+
+    let mut ticker = interval(period);
+    ticker.set_missed_tick_behavior(MissedTickBehavior::Delay);
+    loop {
+        ticker.tick().await;
+        match csp_threads::run_blocking("runtime-stats", move || poll(node, timeout_ms)).await? {
+            Ok(report) => print!("{}", report),
+            Err(e) => eprintln!("RunTimeStats {}: {}", node, e),
+        }
+    }
+}
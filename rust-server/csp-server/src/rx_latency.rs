@@ -0,0 +1,159 @@
+//! RxLatency poller (nodes/node2/21.RxLatency.uavcan).
+//!
+//! The node keeps one histogram per receive stage, from the CAN interrupt to
+//! the start of the service handler. Bucket 0 counts samples under 2 us,
+//! bucket n the ones from 2^n us up to 2^(n+1) us, the last bucket everything
+//! above. Percentiles are therefore only known to the bucket and are printed
+//! as its upper bound.
+
+use std::fmt;
+use std::io;
+use std::time::Duration;
+use tokio::time::{interval, MissedTickBehavior};
+use uavcan_messages::{Message, RxLatencyRequest, RxLatencyResponse};
+
+use crate::csp_threads;
+use crate::runtime_stats::query;
+
+pub const RX_LATENCY_PORT: u8 = RxLatencyRequest::ID as u8;
+
+pub struct StageLatency {
+    pub name: String,
+    pub count: u32,
+    pub max_us: u32,
+    pub total_us: u64,
+    pub buckets: Vec<u32>,
+}
+
+impl StageLatency {
+    /// Upper bound in us of the bucket the `permille` sample falls in
+    fn percentile(&self, permille: u64) -> Option<u64> {
+        if self.count == 0 {
+            return None;
+        }
+
+        let rank = (self.count as u64 * permille).div_ceil(1000).max(1);
+        let mut seen = 0u64;
+        for (bucket, &count) in self.buckets.iter().enumerate() {
+            seen += count as u64;
+            if seen >= rank {
+                if bucket + 1 == self.buckets.len() {
+                    // open ended, the max is the best bound there is
+                    return Some(self.max_us as u64);
+                }
+                return Some((2u64 << bucket).min(self.max_us as u64 + 1));
+            }
+        }
+        Some(self.max_us as u64)
+    }
+}
+
+pub struct LatencyReport {
+    pub node: u16,
+    pub stages: Vec<StageLatency>,
+}
+
+fn stage(response: RxLatencyResponse) -> StageLatency {
+    StageLatency {
+        name: String::from_utf8_lossy(response.stage_name.as_slice()).into_owned(),
+        count: response.packets,
+        max_us: response.max_us,
+        total_us: response.total_us,
+        buckets: response.buckets.as_slice().to_vec(),
+    }
+}
+
+/// Fetches every stage of `node`, clearing each one after it is read when `reset` is set.
+pub fn poll(node: u16, reset: bool, timeout_ms: u32) -> Result<LatencyReport, String> {
+    let mut report = LatencyReport {
+        node,
+        stages: Vec::new(),
+    };
+
+    let mut index = 0;
+    loop {
+        let response: RxLatencyResponse = query(
+            node,
+            RX_LATENCY_PORT,
+            &RxLatencyRequest {
+                stage: index,
+                reset,
+            },
+            timeout_ms,
+        )?;
+        let count = response.stage_count;
+        if index < count {
+            report.stages.push(stage(response));
+        }
+        index += 1;
+        if index >= count {
+            break;
+        }
+    }
+
+    Ok(report)
+}
+
+impl fmt::Display for LatencyReport {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        writeln!(f, "RxLatency {}:", self.node)?;
+        for stage in &self.stages {
+            let Some(p50) = stage.percentile(500) else {
+                writeln!(f, "  {:<8} no packets", stage.name)?;
+                continue;
+            };
+            writeln!(
+                f,
+                "  {:<8} {} packets, mean {} us, p50 <{} us, p99 <{} us, max {} us",
+                stage.name,
+                stage.count,
+                stage.total_us / stage.count as u64,
+                p50,
+                stage.percentile(990).unwrap_or(0),
+                stage.max_us
+            )?;
+
+            let last = stage.buckets.iter().rposition(|&c| c != 0).unwrap_or(0);
+            let buckets: Vec<String> = stage.buckets[..=last]
+                .iter()
+                .enumerate()
+                .map(|(bucket, count)| {
+                    if bucket == 0 {
+                        format!("<2:{}", count)
+                    } else {
+                        format!("{}:{}", 1u64 << bucket, count)
+                    }
+                })
+                .collect();
+            writeln!(f, "           {}", buckets.join(" "))?;
+        }
+        Ok(())
+    }
+}
+
+/// Reads `node` once, or every `period` forever, and prints the histograms.
+pub async fn run(
+    node: u16,
+    reset: bool,
+    period: Option<Duration>,
+    timeout_ms: u32,
+) -> io::Result<()> {
+    let Some(period) = period else {
+        let report = csp_threads::run_blocking("rx-latency", move || poll(node, reset, timeout_ms))
+            .await?
+            .map_err(io::Error::other)?;
+        print!("{}", report);
+        return Ok(());
+    };
+
+    let mut ticker = interval(period);
+    ticker.set_missed_tick_behavior(MissedTickBehavior::Delay);
+    loop {
+        ticker.tick().await;
+        match csp_threads::run_blocking("rx-latency", move || poll(node, reset, timeout_ms)).await?
+        {
+            Ok(report) => print!("{}", report),
+            Err(e) => eprintln!("RxLatency {}: {}", node, e),
+        }
+    }
+}
@@ -1,18 +1,30 @@
+mod control;
+mod csp_threads;
+mod fanout;
+mod mem_health;
+mod node_ping;
+mod runtime_stats;
+mod rx_latency;
+mod status_share;
+
+use csp_threads::{ChannelStats, ConnStats, RxPacket, ServerConfig};
 use libcsp::libcsp::{
-    csp_accept, csp_bind, csp_buffer_free, csp_can_socketcan_open_and_add_interface, csp_close,
-    csp_conf, csp_conn_dport, csp_conn_sport, csp_conn_t, csp_iface_t, csp_init, csp_listen,
-    csp_packet_t, csp_prio_t_CSP_PRIO_NORM, csp_read, csp_route_work, csp_socket_s, csp_socket_t,
-    CSP_ANY, CSP_ERR_NONE,
+    csp_can_socketcan_open_and_add_interface, csp_conf, csp_iface_t, csp_init,
+    csp_prio_t_CSP_PRIO_NORM, CSP_ERR_NONE,
 };
 use std::env;
 use std::ffi;
+use std::path::Path;
 use std::process;
+use std::sync::Arc;
 use std::{ptr, time::Duration};
 use structopt::StructOpt;
 
+use libcsp::csp_async::CSP_PORTS;
 use libcsp::csp_utils;
 
-use tokio::time::sleep;
+use tokio::sync::mpsc;
+use tokio::time::interval;
 
 #[derive(Debug, StructOpt)]
 #[structopt(name = "example", about = "An example of StructOpt usage.")]
@@ -40,6 +52,105 @@ struct Opt {
     /// Optional iface name string
     #[structopt(long)]
     data: Option<String>,
+
+    /// Optional core to pin the libcsp router thread to
+    #[structopt(long)]
+    router_core: Option<usize>,
+
+    /// Optional core to pin the CSP accept thread to
+    #[structopt(long)]
+    io_core: Option<usize>,
+
+    /// Optional depth of the packet channel towards async code
+    #[structopt(long)]
+    rx_queue_len: Option<usize>,
+
+    /// Optional number of connections served at the same time
+    #[structopt(long)]
+    conn_workers: Option<usize>,
+
+    /// Optional number of accepted connections waiting for a worker
+    #[structopt(long)]
+    conn_backlog: Option<usize>,
+
+    /// Optional idle time in milliseconds after which a connection is closed
+    #[structopt(long)]
+    conn_idle_ms: Option<u32>,
+
+    /// Optional comma separated node ids to probe with NodePing
+    #[structopt(long)]
+    ping_nodes: Option<String>,
+
+    /// Optional NodePing period in milliseconds
+    #[structopt(long)]
+    ping_period_ms: Option<u64>,
+
+    /// Optional NodePong timeout in milliseconds
+    #[structopt(long)]
+    ping_timeout_ms: Option<u64>,
+
+    /// Optional node set to send --data to at once, e.g. '2-9,16/10'
+    #[structopt(long)]
+    fanout_nodes: Option<String>,
+
+    /// Optional number of nodes waiting for an answer at once
+    #[structopt(long)]
+    fanout_window: Option<usize>,
+
+    /// Optional per node answer timeout in milliseconds
+    #[structopt(long)]
+    fanout_timeout_ms: Option<u64>,
+
+    /// Flag to only send to the node set and not wait for answers
+    #[structopt(long)]
+    fanout_no_reply: bool,
+
+    /// Optional node to read task, interrupt and critical section times from
+    #[structopt(long)]
+    runtime_stats: Option<u16>,
+
+    /// Optional node to read the receive latency histograms from
+    #[structopt(long)]
+    rx_latency: Option<u16>,
+
+    /// Flag to clear the latency histograms after reading them
+    #[structopt(long)]
+    latency_reset: bool,
+
+    /// Optional node to read queue, buffer and stack headroom from
+    #[structopt(long)]
+    mem_health: Option<u16>,
+
+    /// Optional period in milliseconds to keep polling node stats at
+    #[structopt(long)]
+    stats_period_ms: Option<u64>,
+
+    /// Optional node stats reply timeout in milliseconds
+    #[structopt(long)]
+    stats_timeout_ms: Option<u32>,
+
+    /// Flag to keep running and take commands on the control socket
+    #[structopt(long)]
+    daemon: bool,
+
+    /// Optional path of the control socket
+    #[structopt(long)]
+    control_socket: Option<String>,
+
+    /// Flag to hand --data, or commands from stdin, to a running daemon
+    #[structopt(long)]
+    ctl: bool,
+
+    /// Optional reply timeout in milliseconds, makes --ctl --data a transaction
+    #[structopt(long)]
+    ctl_timeout_ms: Option<u32>,
+}
+
+fn parse_hex(hex_string: &str) -> Vec<u8> {
+    hex_string
+        .split_whitespace()
+        .filter_map(|s| u8::from_str_radix(s, 16).ok())
+        .collect()
 }
 
 fn send_packet_directly(
@@ -51,10 +162,7 @@ fn send_packet_directly(
     let bytes: Vec<u8>;
 
     if !hex_string.is_empty() {
-        bytes = hex_string
-            .split_whitespace()
-            .filter_map(|s| u8::from_str_radix(s, 16).ok())
-            .collect();
+        bytes = parse_hex(hex_string);
         ptr_send_bytes = bytes.as_ptr() as *mut ffi::c_void;
     } else {
         return Err(Box::new(std::io::Error::other("Both hex_string is empty")));
@@ -100,10 +208,47 @@ fn print_help(program_name: &str) {
     println!("        --dest_port     : to pass destination port (default is 29)");
     println!("        --dest_node_id  : to pass destination node id (default is 2)");
     println!("        --source_node_id: to pass source node id (default is 10)");
+    println!("        --router_core   : to pin the libcsp router thread to a cpu core (default is unpinned)");
+    println!("        --io_core       : to pin the CSP accept thread to a cpu core, the connection workers stay unpinned (default is unpinned)");
+    println!(
+        "        --rx_queue_len  : to pass depth of the received packet queue (default is 64)"
+    );
+    println!(
+        "        --conn_workers  : to pass how many connections are served at once (default is 4)"
+    );
+    println!("        --conn_backlog  : to pass how many accepted connections may wait for a worker (default is 10)");
+    println!("        --conn_idle_ms  : to pass after how many idle ms a connection is closed (default is 50)");
+    println!("        --ping_nodes    : to probe comma separated node ids with NodePing (eg --ping_nodes '2,3')");
+    println!("        --ping_period_ms: to pass NodePing period in ms (default is 1000)");
+    println!("        --ping_timeout_ms: to pass NodePong timeout in ms (default is 500)");
     println!("    Additional Options:");
     println!("        --data          : to pass hex string  (eg --data '01 02 03 04')");
     println!("            This option enables the breakglass mode directly");
     println!("            and raw bytes that passed as argument with this option will be sent to the dest_node_id and dest_port");
+    println!("        --fanout_nodes  : to send --data to a node set instead of dest_node_id (eg --fanout_nodes '2-9,12,64/8')");
+    println!("            ids, ranges and subnets (address/network bits) may be mixed, the answers of all nodes are reported at once");
+    println!("        --fanout_window : to pass how many nodes may be waiting for an answer at once (default is 16)");
+    println!("        --fanout_timeout_ms: to pass how long to wait for each node in ms (default is 1000)");
+    println!("        --fanout_no_reply: to only send to the node set without waiting for answers");
+    println!("    Node Stats Options:");
+    println!("        --runtime_stats : to print cpu time per task, CAN interrupt time and the longest critical section of a node");
+    println!("            every poll covers the time since the previous one, the first one the time since boot");
+    println!("        --rx_latency    : to print the receive latency of a node per stage, from the CAN interrupt to the handler");
+    println!("        --latency_reset : to clear the latency histograms after reading them");
+    println!("        --mem_health    : to print the peak use of the CAN queues, csp buffers and task stacks of a node");
+    println!(
+        "        --stats_period_ms: to keep polling every this many ms (default is to poll once)"
+    );
+    println!(
+        "        --stats_timeout_ms: to pass the node stats reply timeout in ms (default is 1000)"
+    );
+    println!("    Daemon Options:");
+    println!("        --daemon        : to keep the CSP stack up and take commands on the control socket");
+    println!("        --control_socket: to pass the control socket path (default is /tmp/csp-server.sock)");
+    println!("        --ctl           : to send --data through a running daemon instead of starting the stack");
+    println!("            without --data, command lines are read from stdin and one reply line is printed per command:");
+    println!("            'send <node> <port> [hex bytes]' or 'transaction <node> <port> <timeout ms> [hex bytes]'");
+    println!("        --ctl_timeout_ms: to wait this many ms for a reply to --ctl --data (default is no reply)");
 }
 
 #[tokio::main]
@@ -119,6 +264,35 @@ async fn main() -> Result<(), Box<dyn std::error::Error>> {
         return Ok(());
     }
 
+    let control_socket = opt
+        .control_socket
+        .as_deref()
+        .unwrap_or(control::DEFAULT_SOCKET);
+
+    // The thin client only talks to the daemon, it never starts a CSP stack of its own
+    if opt.ctl {
+        let node = opt.dest_node_id.unwrap_or(2);
+        let port = opt.dest_port.unwrap_or(29);
+        let commands = match (&opt.data, opt.ctl_timeout_ms) {
+            (None, _) => Vec::new(),
+            (Some(data), None) => vec![format!("send {} {} {}", node, port, data)],
+            (Some(data), Some(timeout)) => {
+                vec![format!(
+                    "transaction {} {} {} {}",
+                    node, port, timeout, data
+                )]
+            }
+        };
+        match control::client(Path::new(control_socket), commands).await {
+            Ok(0) => process::exit(0),
+            Ok(_) => process::exit(1),
+            Err(e) => {
+                eprintln!("Control client failed: {}", e);
+                process::exit(1);
+            }
+        }
+    }
+
     let mut src_nodeid = 10;
     if let Some(source_node_id) = opt.source_node_id {
         src_nodeid = source_node_id;
@@ -134,7 +308,7 @@ async fn main() -> Result<(), Box<dyn std::error::Error>> {
         csp_init();
     }
 
-    tokio::spawn(router_task());
+    csp_threads::spawn_router(opt.router_core)?;
 
     let mut default_iface: *mut csp_iface_t = ptr::null_mut();
     let if_name = ffi::CString::new(iface_name).unwrap();
@@ -166,10 +340,89 @@ async fn main() -> Result<(), Box<dyn std::error::Error>> {
         dest_nodeid = dest_node_id;
     }
 
+    // Fleet fan-out sends the breakglass data to a whole node set and reports per node
+    if let Some(fanout_nodes) = &opt.fanout_nodes {
+        let nodes = match fanout::parse_node_set(fanout_nodes) {
+            Ok(nodes) => nodes,
+            Err(e) => {
+                eprintln!("Bad --fanout_nodes: {}", e);
+                process::exit(2);
+            }
+        };
+        let port = match u8::try_from(port) {
+            Ok(port) if (port as usize) < CSP_PORTS => port,
+            _ => {
+                eprintln!(
+                    "Bad --dest_port: {} out of range 0..{}",
+                    port,
+                    CSP_PORTS - 1
+                );
+                process::exit(2);
+            }
+        };
+        let config = fanout::FanoutConfig {
+            port,
+            prio: csp_prio_t_CSP_PRIO_NORM as u8,
+            window: opt.fanout_window.unwrap_or(16),
+            timeout: Duration::from_millis(opt.fanout_timeout_ms.unwrap_or(1000)),
+            expect_reply: !opt.fanout_no_reply,
+        };
+        let payload = parse_hex(opt.data.as_deref().unwrap_or_default());
+        match fanout::run(nodes, payload, config).await {
+            Ok(report) => {
+                print!("{}", report);
+                process::exit(if report.all_ok() { 0 } else { 1 });
+            }
+            Err(e) => {
+                eprintln!("Fan-out failed: {}", e);
+                process::exit(1);
+            }
+        }
+    }
+
+    // Node stats are a one-shot (or periodic) query, like fan-out they replace the server loop
+    if let Some(node) = opt.runtime_stats {
+        let period = opt
+            .stats_period_ms
+            .map(|ms| Duration::from_millis(ms.max(1)));
+        let timeout_ms = opt.stats_timeout_ms.unwrap_or(1000);
+        if let Err(e) = runtime_stats::run(node, period, timeout_ms).await {
+            eprintln!("RunTimeStats {}: {}", node, e);
+            process::exit(1);
+        }
+        process::exit(0);
+    }
+    if let Some(node) = opt.rx_latency {
+        let period = opt
+            .stats_period_ms
+            .map(|ms| Duration::from_millis(ms.max(1)));
+        let timeout_ms = opt.stats_timeout_ms.unwrap_or(1000);
+        if let Err(e) = rx_latency::run(node, opt.latency_reset, period, timeout_ms).await {
+            eprintln!("RxLatency {}: {}", node, e);
+            process::exit(1);
+        }
+        process::exit(0);
+    }
+    if let Some(node) = opt.mem_health {
+        let period = opt
+            .stats_period_ms
+            .map(|ms| Duration::from_millis(ms.max(1)));
+        let timeout_ms = opt.stats_timeout_ms.unwrap_or(1000);
+        if let Err(e) = mem_health::run(node, period, timeout_ms).await {
+            eprintln!("MemHealth {}: {}", node, e);
+            process::exit(1);
+        }
+        process::exit(0);
+    }
+
     // Console breakglass mode is our first priority
     if opt.data.is_some() {
-        let data = opt.data.as_deref().unwrap_or("");
-        match send_packet_directly(data, port, dest_nodeid) {
+        let data = opt.data.clone().unwrap_or_default();
+        let result = csp_threads::run_blocking("csp-send", move || {
+            send_packet_directly(&data, port, dest_nodeid).map_err(|e| e.to_string())
+        })
+        .await?;
+        match result {
             Ok(_) => {
                 println!("Packet sent successfully");
                 process::exit(0);
@@ -181,68 +434,100 @@ async fn main() -> Result<(), Box<dyn std::error::Error>> {
         }
     }
 
-    tokio::spawn(server_task());
-
-    loop {
-        sleep(Duration::from_secs(1)).await;
-    }
-}
-
-async fn server_task() {
-    println!("Server task started");
-    unsafe {
-        /* Create socket with no specific socket options, e.g. accepts CRC32, HMAC, etc. if enabled during compilation */
-        let mut sock: csp_socket_t = std::mem::zeroed();
-
-        /* Bind socket to all ports, e.g. all incoming connections will be handled here */
-        csp_bind(
-            (&mut sock) as *mut csp_socket_s,
-            CSP_ANY.try_into().unwrap(),
-        );
-
-        /* Create a backlog of 10 connections, i.e. up to 10 new connections can be queued */
-        csp_listen((&mut sock) as *mut csp_socket_s, 10);
+    let rx_queue_len = opt.rx_queue_len.unwrap_or(csp_threads::RX_CHANNEL_DEPTH);
+    let (tx, rx) = mpsc::channel(rx_queue_len.max(1));
+    let stats = Arc::new(ChannelStats::default());
+    let conn_stats = Arc::new(ConnStats::default());
+    let defaults = ServerConfig::default();
+    let server_config = ServerConfig {
+        workers: opt.conn_workers.unwrap_or(defaults.workers),
+        backlog: opt.conn_backlog.unwrap_or(defaults.backlog),
+        idle_ms: opt.conn_idle_ms.unwrap_or(defaults.idle_ms),
+    };
+    csp_threads::spawn_server(
+        opt.io_core,
+        server_config,
+        tx,
+        stats.clone(),
+        conn_stats.clone(),
+    )?;
+
+    tokio::spawn(packet_task(rx));
+
+    let status_table = Arc::new(status_share::StatusTable::default());
+    let status_writer = status_table.clone();
+    tokio::spawn(async move {
+        if let Err(e) = status_share::run(status_writer).await {
+            eprintln!("StatusShare receiver stopped: {}", e);
+        }
+    });
 
-        /* Wait for connections and then process packets on the connection */
-        loop {
-            /* Wait for a new connection, 10000 mS timeout */
-            let conn: *mut csp_conn_t = csp_accept((&mut sock) as *mut csp_socket_s, 10000);
-            if conn.is_null() {
-                // timeout
-                continue;
+    if opt.daemon {
+        let path = control_socket.to_string();
+        tokio::spawn(async move {
+            if let Err(e) = control::run(Path::new(&path)).await {
+                eprintln!("Control socket stopped: {}", e);
+                process::exit(1);
             }
+        });
+    }
 
-            /* Read packets on connection, timeout is 50 mS */
-            let mut _packet: *mut csp_packet_t = std::ptr::null_mut();
-            while {
-                _packet = csp_read(conn, 50);
-                !_packet.is_null()
-            } {
-                let _dport = csp_conn_dport(conn);
-                let _sport = csp_conn_sport(conn);
-                let _source_id = (*_packet).id.src;
-                print!(
-                    "Packet came from {} on dport {} - sport {} and  _packet lenth: {} and the _packet content: ",
-                    _source_id, _dport, _sport, (*_packet).length as usize
-                );
-                for i in 0..(*_packet).length as usize {
-                    print!("{:02x} ", (*_packet).__bindgen_anon_1.data[i]);
-                }
-                println!();
-
-                csp_buffer_free(_packet as *mut ffi::c_void);
+    if let Some(ping_nodes) = &opt.ping_nodes {
+        let nodes: Vec<u16> = ping_nodes
+            .split(',')
+            .filter_map(|s| s.trim().parse().ok())
+            .collect();
+        let period = Duration::from_millis(opt.ping_period_ms.unwrap_or(1000).max(1));
+        let timeout = Duration::from_millis(opt.ping_timeout_ms.unwrap_or(500));
+        let pinger_id = src_nodeid as u8;
+        tokio::spawn(async move {
+            if let Err(e) = node_ping::run(pinger_id, nodes, period, timeout).await {
+                eprintln!("NodePing stopped: {}", e);
             }
+        });
+    }
 
-            /* Close current connection */
-            csp_close(conn);
+    // Report channel and connection pressure whenever something moved since the last report
+    let report_period = Duration::from_secs(10);
+    let mut report = interval(report_period);
+    let mut last_forwarded = 0;
+    let mut last_accepted = 0;
+    loop {
+        report.tick().await;
+        let forwarded = stats.forwarded.load(std::sync::atomic::Ordering::Relaxed);
+        if forwarded != last_forwarded {
+            println!("rx channel: {}", stats);
+            last_forwarded = forwarded;
+        }
+        let accepted = conn_stats
+            .accepted
+            .load(std::sync::atomic::Ordering::Relaxed);
+        if accepted != last_accepted {
+            println!(
+                "connections: {:.1} accepts/s, {}",
+                (accepted - last_accepted) as f64 / report_period.as_secs_f64(),
+                conn_stats
+            );
+            last_accepted = accepted;
+        }
+        for (node, status) in status_table.snapshot() {
+            println!("StatusShare {}: {}", node, status);
+        }
+        if status_table.malformed() != 0 {
+            println!("StatusShare malformed: {}", status_table.malformed());
         }
     }
 }
 
-async fn router_task() {
-    unsafe {
-        loop {
-            csp_route_work();
+async fn packet_task(mut rx: mpsc::Receiver<RxPacket>) {
+    while let Some(packet) = rx.recv().await {
+        print!(
+            "Packet came from {} on dport {} - sport {} and  _packet lenth: {} and the _packet content: ",
+            packet.src, packet.dport, packet.sport, packet.data.len()
+        );
+        for byte in &packet.data {
+            print!("{:02x} ", byte);
         }
+        println!();
     }
 }
@@ -0,0 +1,182 @@
+//! StatusShare receiver (nodes/node1/100.StatusShare.uavcan).
+//!
+//! Nodes broadcast the request half of StatusShare connectionless on their
+//! BCAST_PORT every second. The receiving task is the only writer of the
+//! table; any task or thread can read the latest status of a node without
+//! taking a lock, each slot is a seqlock over plain atomics.
+
+use libcsp::csp_async::CspCallbackPort;
+use std::fmt;
+use std::io;
+use std::sync::atomic::{fence, AtomicU32, AtomicU64, AtomicU8, Ordering};
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+use uavcan_messages::{Message, StatusShareRequest};
+
+/// BCAST_PORT of the firmware, the type id 100 does not fit a 6 bit CSP port
+pub const STATUS_SHARE_PORT: u8 = 10;
+
+/// CSP addresses are 14 bits wide, one slot per possible node
+const NODES: usize = 1 << 14;
+const NAME_MAX: usize = StatusShareRequest::MAX_SIZE - StatusShareRequest::MIN_SIZE;
+
+/// Latest StatusShare of one node as seen by a reader
+#[derive(Debug, Clone)]
+pub struct NodeStatus {
+    pub duration_sec: u32,
+    pub board_name: String,
+    /// time since the broadcast arrived
+    pub age: Duration,
+    /// broadcasts received from this node so far
+    pub updates: u64,
+}
+
+impl fmt::Display for NodeStatus {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        write!(
+            f,
+            "{} up {} s, last seen {} ms ago, {} updates",
+            self.board_name,
+            self.duration_sec,
+            self.age.as_millis(),
+            self.updates
+        )
+    }
+}
+
+struct Slot {
+    /// odd while the writer is inside the slot
+    seq: AtomicU32,
+    duration_sec: AtomicU32,
+    received_us: AtomicU64,
+    updates: AtomicU64,
+    name_len: AtomicU8,
+    name: [AtomicU8; NAME_MAX],
+}
+
+impl Slot {
+    fn new() -> Self {
+        Slot {
+            seq: AtomicU32::new(0),
+            duration_sec: AtomicU32::new(0),
+            received_us: AtomicU64::new(0),
+            updates: AtomicU64::new(0),
+            name_len: AtomicU8::new(0),
+            name: std::array::from_fn(|_| AtomicU8::new(0)),
+        }
+    }
+}
+
+/// Latest status per node, single writer and lock free readers
+pub struct StatusTable {
+    epoch: Instant,
+    slots: Box<[Slot]>,
+    malformed: AtomicU64,
+}
+
+impl Default for StatusTable {
+    fn default() -> Self {
+        StatusTable {
+            epoch: Instant::now(),
+            slots: (0..NODES).map(|_| Slot::new()).collect(),
+            malformed: AtomicU64::new(0),
+        }
+    }
+}
+
+impl StatusTable {
+    /// Only one thread may write at a time, `run` is that writer.
+    fn store(&self, node: u16, status: &StatusShareRequest) {
+        let Some(slot) = self.slots.get(node as usize) else {
+            return;
+        };
+        let received_us = self.epoch.elapsed().as_micros() as u64;
+        let name = status.board_name.as_slice();
+
+        let seq = slot.seq.load(Ordering::Relaxed);
+        slot.seq.store(seq.wrapping_add(1), Ordering::Relaxed);
+        fence(Ordering::Release);
+
+        slot.duration_sec
+            .store(status.duration_sec, Ordering::Relaxed);
+        slot.received_us.store(received_us, Ordering::Relaxed);
+        slot.updates
+            .store(slot.updates.load(Ordering::Relaxed) + 1, Ordering::Relaxed);
+        slot.name_len.store(name.len() as u8, Ordering::Relaxed);
+        for (dst, &byte) in slot.name.iter().zip(name) {
+            dst.store(byte, Ordering::Relaxed);
+        }
+
+        slot.seq.store(seq.wrapping_add(2), Ordering::Release);
+    }
+
+    /// Latest status of `node`, `None` when it has not been heard from.
+    pub fn get(&self, node: u16) -> Option<NodeStatus> {
+        let slot = self.slots.get(node as usize)?;
+        let mut name = [0u8; NAME_MAX];
+
+        loop {
+            let seq = slot.seq.load(Ordering::Acquire);
+            if seq & 1 == 1 {
+                std::hint::spin_loop();
+                continue;
+            }
+
+            let updates = slot.updates.load(Ordering::Relaxed);
+            let duration_sec = slot.duration_sec.load(Ordering::Relaxed);
+            let received_us = slot.received_us.load(Ordering::Relaxed);
+            let name_len = (slot.name_len.load(Ordering::Relaxed) as usize).min(NAME_MAX);
+            for (dst, src) in name.iter_mut().zip(&slot.name[..name_len]) {
+                *dst = src.load(Ordering::Relaxed);
+            }
+
+            fence(Ordering::Acquire);
+            if slot.seq.load(Ordering::Relaxed) != seq {
+                continue;
+            }
+            if updates == 0 {
+                return None;
+            }
+
+            let age = self
+                .epoch
+                .elapsed()
+                .saturating_sub(Duration::from_micros(received_us));
+            return Some(NodeStatus {
+                duration_sec,
+                board_name: String::from_utf8_lossy(&name[..name_len]).into_owned(),
+                age,
+                updates,
+            });
+        }
+    }
+
+    /// Every node heard from so far, in address order
+    pub fn snapshot(&self) -> Vec<(u16, NodeStatus)> {
+        (0..NODES as u16)
+            .filter(|&node| self.slots[node as usize].updates.load(Ordering::Relaxed) != 0)
+            .filter_map(|node| self.get(node).map(|status| (node, status)))
+            .collect()
+    }
+
+    /// Broadcasts that did not decode as StatusShare
+    pub fn malformed(&self) -> u64 {
+        self.malformed.load(Ordering::Relaxed)
+    }
+}
+
+/// Receives StatusShare broadcasts into `table` forever.
+pub async fn run(table: Arc<StatusTable>) -> io::Result<()> {
+    let mut port = CspCallbackPort::bind(STATUS_SHARE_PORT)?;
+
+    while let Some(packet) = port.recv().await {
+        match StatusShareRequest::decode(packet.data()) {
+            Ok(status) => table.store(packet.src(), &status),
+            Err(_) => {
+                table.malformed.fetch_add(1, Ordering::Relaxed);
+            }
+        }
+    }
+
+    Ok(())
+}
@@ -0,0 +1,243 @@
+use std::fs::File;
+use std::io::{self, Read, Write};
+use structopt::StructOpt;
+
+// Must match csp_trace_record_s in embedded-client/inc/csp_trace.h
+const SYNC: [u8; 2] = [0xA5, 0x5A];
+const VERSION: u8 = 1;
+const HEADER_SIZE: usize = 26;
+const PAYLOAD_MAX: usize = 16;
+const NO_VIA: u16 = 0xFFFF;
+const DIR_OUT: u8 = 1;
+
+#[derive(Debug, StructOpt)]
+#[structopt(
+    name = "csp-trace",
+    about = "Decodes the binary CSP packet trace from the embedded-client log stream."
+)]
+struct Opt {
+    /// Capture file or serial device to read, stdin when omitted
+    #[structopt(long)]
+    input: Option<String>,
+
+    /// Drop the plain text log lines mixed into the stream
+    #[structopt(long)]
+    no_text: bool,
+}
+
+#[derive(Debug)]
+struct TraceRecord {
+    dir: u8,
+    timestamp: u32,
+    src: u16,
+    dst: u16,
+    dport: u8,
+    sport: u8,
+    pri: u8,
+    flags: u8,
+    length: u16,
+    via: u16,
+    iface: String,
+    payload: Vec<u8>,
+}
+
+enum Parsed {
+    NeedMore,
+    Invalid,
+    Record(TraceRecord, usize),
+}
+
+fn le16(buf: &[u8], at: usize) -> u16 {
+    u16::from_le_bytes([buf[at], buf[at + 1]])
+}
+
+fn le32(buf: &[u8], at: usize) -> u32 {
+    u32::from_le_bytes([buf[at], buf[at + 1], buf[at + 2], buf[at + 3]])
+}
+
+/// Parses one record from a buffer that starts with the sync pair
+fn parse_record(buf: &[u8]) -> Parsed {
+    if buf.len() < HEADER_SIZE {
+        return Parsed::NeedMore;
+    }
+
+    let payload_len = buf[24] as usize;
+    let length = le16(buf, 16);
+    if buf[2] != VERSION || buf[3] > DIR_OUT || payload_len > PAYLOAD_MAX || payload_len > length as usize {
+        return Parsed::Invalid;
+    }
+
+    let total = HEADER_SIZE + payload_len;
+    if buf.len() < total {
+        return Parsed::NeedMore;
+    }
+
+    let sum = buf[2..total]
+        .iter()
+        .enumerate()
+        .filter(|(i, _)| *i + 2 != 25)
+        .fold(0u8, |acc, (_, b)| acc.wrapping_add(*b));
+    if sum != buf[25] {
+        return Parsed::Invalid;
+    }
+
+    let iface = buf[20..24]
+        .iter()
+        .take_while(|c| **c != 0)
+        .map(|c| *c as char)
+        .collect();
+
+    Parsed::Record(
+        TraceRecord {
+            dir: buf[3],
+            timestamp: le32(buf, 4),
+            src: le16(buf, 8),
+            dst: le16(buf, 10),
+            dport: buf[12],
+            sport: buf[13],
+            pri: buf[14],
+            flags: buf[15],
+            length,
+            via: le16(buf, 18),
+            iface,
+            payload: buf[HEADER_SIZE..total].to_vec(),
+        },
+        total,
+    )
+}
+
+/// Same layout as packet_dump() on the firmware
+fn dump_payload(out: &mut impl Write, data: &[u8]) -> io::Result<()> {
+    const BREAK_NOCHAR: usize = 8;
+
+    for row in data.chunks(BREAK_NOCHAR) {
+        for i in 0..BREAK_NOCHAR {
+            match row.get(i) {
+                Some(b) => write!(out, "0x{:02X} ", b)?,
+                None => write!(out, "     ")?,
+            }
+        }
+        write!(out, "   ")?;
+        for b in row {
+            let c = if (32..=126).contains(b) { *b as char } else { '.' };
+            write!(out, "{}", c)?;
+        }
+        writeln!(out)?;
+    }
+
+    Ok(())
+}
+
+fn print_record(out: &mut impl Write, rec: &TraceRecord) -> io::Result<()> {
+    write!(out, "[{:>10} ms] ", rec.timestamp)?;
+    if rec.dir == DIR_OUT {
+        writeln!(
+            out,
+            "OUT: S {}, D {}, Dp {}, Sp {}, Pr {}, Fl 0x{:02X}, Sz {} VIA: {} ({})",
+            rec.src,
+            rec.dst,
+            rec.dport,
+            rec.sport,
+            rec.pri,
+            rec.flags,
+            rec.length,
+            rec.iface,
+            if rec.via != NO_VIA { rec.via } else { rec.dst }
+        )?;
+    } else {
+        writeln!(
+            out,
+            "INP: S {}, D {}, Dp {}, Sp {}, Pr {}, Fl 0x{:02X}, Sz {} VIA: {}",
+            rec.src, rec.dst, rec.dport, rec.sport, rec.pri, rec.flags, rec.length, rec.iface
+        )?;
+    }
+
+    dump_payload(out, &rec.payload)?;
+    if rec.payload.len() < rec.length as usize {
+        writeln!(
+            out,
+            "... {} more bytes not traced",
+            rec.length as usize - rec.payload.len()
+        )?;
+    }
+
+    Ok(())
+}
+
+/// Decodes every complete record in `pending`, passing the text in between through.
+/// Returns how many bytes were consumed; the rest waits for more input.
+fn decode(pending: &[u8], out: &mut impl Write, show_text: bool) -> io::Result<usize> {
+    let mut pos = 0;
+
+    while pos < pending.len() {
+        let sync_at = pending[pos..]
+            .windows(SYNC.len())
+            .position(|w| w == SYNC)
+            .map(|at| pos + at);
+
+        let text_end = match sync_at {
+            Some(at) => at,
+            // keep a trailing first sync byte, the second one may still be on its way
+            None if pending.last() == Some(&SYNC[0]) => pending.len() - 1,
+            None => pending.len(),
+        };
+        if show_text {
+            out.write_all(&pending[pos..text_end])?;
+        }
+        pos = text_end;
+
+        if sync_at.is_none() {
+            break;
+        }
+
+        match parse_record(&pending[pos..]) {
+            Parsed::NeedMore => break,
+            Parsed::Invalid => {
+                // not a record after all, treat the sync byte as text and look again
+                if show_text {
+                    out.write_all(&pending[pos..pos + 1])?;
+                }
+                pos += 1;
+            }
+            Parsed::Record(rec, used) => {
+                print_record(out, &rec)?;
+                pos += used;
+            }
+        }
+    }
+
+    Ok(pos)
+}
+
+fn main() -> Result<(), Box<dyn std::error::Error>> {
+    let opt = Opt::from_args();
+
+    let mut input: Box<dyn Read> = match opt.input.as_deref() {
+        Some(path) => Box::new(File::open(path)?),
+        None => Box::new(io::stdin()),
+    };
+
+    let stdout = io::stdout();
+    let mut out = stdout.lock();
+    let mut pending: Vec<u8> = Vec::new();
+    let mut chunk = [0u8; 4096];
+
+    loop {
+        let n = input.read(&mut chunk)?;
+        if n == 0 {
+            break;
+        }
+        pending.extend_from_slice(&chunk[..n]);
+
+        let used = decode(&pending, &mut out, !opt.no_text)?;
+        pending.drain(..used);
+        out.flush()?;
+    }
+
+    // whatever is left can not become a record any more
+    if !opt.no_text {
+        out.write_all(&pending)?;
+    }
+
+    Ok(())
+}
@@ -0,0 +1,495 @@
+//! Async access to CSP sockets, connections and callback ports.
+//!
+//! libcsp only offers blocking calls, so instead of parking a thread in
+//! `csp_accept`/`csp_read` per socket and connection, everything here is
+//! delivered by the libcsp router itself through `csp_bind_callback`. One
+//! callback demultiplexes every bound port: packets of a known connection go
+//! to its channel, the first packet from a new sender on a listening socket
+//! creates the connection, anything else goes to the port's `CspCallbackPort`.
+//! The awaiting task is woken the moment the router hands the packet over and
+//! no thread sits in a timeout poll.
+//!
+//! Such connections are connectionless CSP underneath: requests go out with
+//! `csp_sendto` and the peer answers with `csp_sendto_reply`, as the CSP
+//! services and the node firmware do. There is no close on the wire, so their
+//! stream only ends when the local side goes away (the `CspSocket` that
+//! accepted it is dropped).
+//!
+//! RDP needs libcsp's connection state and cannot be served from a callback.
+//! An RDP connection keeps a reader thread inside `csp_read` that checks every
+//! `CLOSE_CHECK_MS` whether the connection is still alive, and its stream ends
+//! when libcsp closes it. At most `RDP_READERS_MAX` of them are open at once.
+
+use futures_core::Stream;
+use std::collections::HashMap;
+use std::io;
+use std::pin::Pin;
+use std::sync::atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex};
+use std::task::{Context, Poll};
+use std::thread;
+use tokio::sync::mpsc;
+
+use crate::csp_packet::CspPacket;
+use crate::libcsp::{
+    csp_bind_callback, csp_close, csp_conn_dport, csp_conn_dst, csp_conn_is_active, csp_conn_sport,
+    csp_conn_t, csp_connect, csp_packet_t, csp_read, csp_send, csp_sendto, CSP_ERR_NONE, CSP_O_RDP,
+};
+
+/// Number of CSP ports (6 bit port field)
+pub const CSP_PORTS: usize = 64;
+
+/// Local port of every outgoing connection that is not RDP, clear of the node
+/// services (20-22, 29-31) and of the other ports csp-server binds. Replies
+/// are told apart by their sender, so there is one connection per remote node
+/// and port.
+pub const CONN_PORT: u8 = 28;
+
+/// RDP connections open at once, each one holds a reader thread
+pub const RDP_READERS_MAX: usize = 8;
+
+/// How long an RDP reader stays inside `csp_read` before it checks whether
+/// the connection or its owner went away. Only teardown waits on this, never
+/// a packet.
+const CLOSE_CHECK_MS: u32 = 100;
+
+static RDP_READERS: AtomicUsize = AtomicUsize::new(0);
+
+/// Local port, remote node, remote port
+type ConnKey = (u8, u16, u8);
+
+/// What a bound port does with a packet that belongs to no connection
+enum Delivery {
+    /// `CspCallbackPort`
+    Packets(mpsc::UnboundedSender<CspPacket>),
+    /// `CspSocket`, a new sender opens a connection
+    Accept(mpsc::UnboundedSender<CspConn>),
+    /// `CONN_PORT`, only replies to connections
+    Replies,
+}
+
+type CallbackSlot = Mutex<Option<Delivery>>;
+
+#[allow(clippy::declare_interior_mutable_const)]
+const CALLBACK_SLOT_INIT: CallbackSlot = Mutex::new(None);
+static CALLBACK_SLOTS: [CallbackSlot; CSP_PORTS] = [CALLBACK_SLOT_INIT; CSP_PORTS];
+/// Ports already registered with `csp_bind_callback`, which cannot be undone
+static CALLBACK_BOUND: AtomicU64 = AtomicU64::new(0);
+
+/// Open connections that are not RDP. Lock order: a callback slot, then this.
+static CONNS: Mutex<Option<HashMap<ConnKey, mpsc::UnboundedSender<CspPacket>>>> = Mutex::new(None);
+
+extern "C" fn csp_async_callback(packet: *mut csp_packet_t) {
+    // unsafe needed because of following errors:
+    // -> call to unsafe function `CspPacket::from_raw`
+    let packet = match unsafe { CspPacket::from_raw(packet) } {
+        Some(packet) => packet,
+        None => return,
+    };
+    let port = packet.dport() as usize % CSP_PORTS;
+    let key = (port as u8, packet.src(), packet.sport());
+
+    // A packet nobody waits for is dropped here, which frees it
+    let packet = match CONNS.lock() {
+        Ok(conns) => match conns.as_ref().and_then(|conns| conns.get(&key)) {
+            Some(tx) => {
+                let _ = tx.send(packet);
+                return;
+            }
+            None => packet,
+        },
+        Err(_) => return,
+    };
+
+    let Ok(slot) = CALLBACK_SLOTS[port].lock() else {
+        return;
+    };
+    match slot.as_ref() {
+        Some(Delivery::Packets(tx)) => {
+            let _ = tx.send(packet);
+        }
+        Some(Delivery::Accept(tx)) => {
+            let prio = packet.prio();
+            if let Ok(mut conn) = CspConn::open(key, prio, 0) {
+                conn.deliver(packet);
+                let _ = tx.send(conn);
+            }
+        }
+        Some(Delivery::Replies) | None => {}
+    }
+}
+
+/// Points `port` at `delivery`, registering the callback with libcsp the first time.
+fn bind_port(port: u8, delivery: Delivery) -> io::Result<()> {
+    if port as usize >= CSP_PORTS {
+        return Err(io::Error::other(format!("port {} out of range", port)));
+    }
+
+    let mut slot = CALLBACK_SLOTS[port as usize]
+        .lock()
+        .map_err(|_| io::Error::other("callback table poisoned"))?;
+    let in_use = match slot.as_ref() {
+        Some(Delivery::Packets(tx)) => !tx.is_closed(),
+        Some(Delivery::Accept(tx)) => !tx.is_closed(),
+        // shared by all connections, stays bound
+        Some(Delivery::Replies) if matches!(delivery, Delivery::Replies) => return Ok(()),
+        Some(Delivery::Replies) => true,
+        None => false,
+    };
+    if in_use {
+        return Err(io::Error::other(format!("port {} already in use", port)));
+    }
+
+    let bit = 1u64 << port;
+    if CALLBACK_BOUND.load(Ordering::Acquire) & bit == 0 {
+        // unsafe needed because of following errors:
+        // -> call to unsafe function `csp_bind_callback`
+        let ret = unsafe { csp_bind_callback(Some(csp_async_callback), port) };
+        if ret != CSP_ERR_NONE as i32 {
+            return Err(io::Error::other(format!("port {} cannot be bound", port)));
+        }
+        CALLBACK_BOUND.fetch_or(bit, Ordering::AcqRel);
+    }
+
+    *slot = Some(delivery);
+    Ok(())
+}
+
+/// Stops delivering to `port`, packets for it are freed from now on.
+fn unbind_port(port: u8) {
+    if let Ok(mut slot) = CALLBACK_SLOTS[port as usize].lock() {
+        *slot = None;
+    }
+}
+
+/// libcsp connection handle shared between the RDP reader thread and
+/// in-flight sends. The connection is closed once the last of them lets go.
+struct RawConn(*mut csp_conn_t);
+
+// libcsp connections are safe to use from several threads.
+unsafe impl Send for RawConn {}
+unsafe impl Sync for RawConn {}
+
+impl Drop for RawConn {
+    fn drop(&mut self) {
+        // unsafe needed because of following errors:
+        // -> call to unsafe function `csp_close`
+        unsafe {
+            csp_close(self.0);
+        }
+    }
+}
+
+/// Gives the RDP reader slot back when the reader thread ends.
+struct RdpReaderSlot;
+
+impl RdpReaderSlot {
+    fn take() -> io::Result<Self> {
+        RDP_READERS
+            .fetch_update(Ordering::AcqRel, Ordering::Acquire, |n| {
+                (n < RDP_READERS_MAX).then_some(n + 1)
+            })
+            .map(|_| RdpReaderSlot)
+            .map_err(|_| {
+                io::Error::other(format!(
+                    "all {} rdp connections are in use",
+                    RDP_READERS_MAX
+                ))
+            })
+    }
+}
+
+impl Drop for RdpReaderSlot {
+    fn drop(&mut self) {
+        RDP_READERS.fetch_sub(1, Ordering::AcqRel);
+    }
+}
+
+/// A listening CSP socket.
+///
+/// Every new (node, port) that sends to the socket's port becomes a
+/// connection. After the socket is dropped the port drops what it receives,
+/// and it can be bound again.
+pub struct CspSocket {
+    port: u8,
+    conns: mpsc::UnboundedReceiver<CspConn>,
+}
+
+impl CspSocket {
+    /// Binds a socket to `port` and starts accepting.
+    pub fn bind(port: u8) -> io::Result<Self> {
+        let (tx, conns) = mpsc::unbounded_channel();
+        bind_port(port, Delivery::Accept(tx))?;
+        Ok(CspSocket { port, conns })
+    }
+
+    /// Waits for the next incoming connection, the first packet already queued on it.
+    pub async fn accept(&mut self) -> Option<CspConn> {
+        self.conns.recv().await
+    }
+}
+
+impl Drop for CspSocket {
+    fn drop(&mut self) {
+        unbind_port(self.port);
+
+        // ends the streams of everything it accepted
+        if let Ok(mut conns) = CONNS.lock() {
+            if let Some(conns) = conns.as_mut() {
+                conns.retain(|&(port, _, _), _| port != self.port);
+            }
+        }
+    }
+}
+
+enum Link {
+    /// Served by the router callback, see the module doc
+    Routed { key: ConnKey, prio: u8, opts: u32 },
+    /// RDP, read by its own thread
+    Rdp {
+        conn: Arc<RawConn>,
+        closed: Arc<AtomicBool>,
+    },
+}
+
+/// An established CSP connection. Incoming packets are read through its
+/// `Stream` implementation, which ends when the connection is closed.
+pub struct CspConn {
+    link: Link,
+    packets: mpsc::UnboundedReceiver<CspPacket>,
+}
+
+impl CspConn {
+    /// Opens a connection to `dest`:`port`.
+    ///
+    /// Without `CSP_O_RDP` in `opts` nothing goes on the wire until the first
+    /// send, `timeout` is not used, and only one such connection per
+    /// `dest`:`port` can be open.
+    pub async fn connect(
+        prio: u8,
+        dest: u16,
+        port: u8,
+        timeout: u32,
+        opts: u32,
+    ) -> io::Result<Self> {
+        if opts & CSP_O_RDP == 0 {
+            bind_port(CONN_PORT, Delivery::Replies)?;
+            return Self::open((CONN_PORT, dest, port), prio, opts);
+        }
+
+        let reader = RdpReaderSlot::take()?;
+        // csp_connect blocks for the RDP handshake, keep it off the runtime workers
+        let conn = tokio::task::spawn_blocking(move || {
+            // unsafe needed because of following errors:
+            // -> call to unsafe function `csp_connect`
+            unsafe { csp_connect(prio, dest, port, timeout, opts) as usize }
+        })
+        .await
+        .map_err(io::Error::other)?;
+
+        if conn == 0 {
+            return Err(io::Error::other(format!(
+                "connection to {}:{} cannot be established",
+                dest, port
+            )));
+        }
+
+        Self::start_rdp(conn as *mut csp_conn_t, reader)
+    }
+
+    /// Registers a connection served by the router callback.
+    fn open(key: ConnKey, prio: u8, opts: u32) -> io::Result<Self> {
+        let (tx, packets) = mpsc::unbounded_channel();
+        let mut conns = CONNS
+            .lock()
+            .map_err(|_| io::Error::other("connection table poisoned"))?;
+        let conns = conns.get_or_insert_with(HashMap::new);
+        if conns.get(&key).is_some_and(|tx| !tx.is_closed()) {
+            return Err(io::Error::other(format!(
+                "connection to {}:{} already open",
+                key.1, key.2
+            )));
+        }
+        conns.insert(key, tx);
+
+        Ok(CspConn {
+            link: Link::Routed { key, prio, opts },
+            packets,
+        })
+    }
+
+    fn start_rdp(conn: *mut csp_conn_t, reader: RdpReaderSlot) -> io::Result<Self> {
+        let conn = Arc::new(RawConn(conn));
+        let (tx, packets) = mpsc::unbounded_channel();
+        let closed = Arc::new(AtomicBool::new(false));
+
+        let reader_conn = conn.clone();
+        let reader_closed = closed.clone();
+        thread::Builder::new()
+            .name("csp-rdp".to_string())
+            .spawn(move || {
+                let _reader = reader;
+                while !reader_closed.load(Ordering::Acquire) {
+                    // unsafe needed because of following errors:
+                    // -> call to unsafe functions `csp_read` and `CspPacket::from_raw`
+                    let packet =
+                        unsafe { CspPacket::from_raw(csp_read(reader_conn.0, CLOSE_CHECK_MS)) };
+                    match packet {
+                        Some(packet) => {
+                            if tx.send(packet).is_err() {
+                                break;
+                            }
+                        }
+                        // csp_read cannot tell a timeout from a closed connection
+                        // unsafe needed because of following errors:
+                        // -> call to unsafe function `csp_conn_is_active`
+                        None if unsafe { csp_conn_is_active(reader_conn.0) } == 0 => break,
+                        None => {}
+                    }
+                }
+            })?;
+
+        Ok(CspConn {
+            link: Link::Rdp { conn, closed },
+            packets,
+        })
+    }
+
+    /// Queues `packet` on the connection, for the callback that accepted it.
+    fn deliver(&mut self, packet: CspPacket) {
+        if let Link::Routed { key, .. } = &self.link {
+            if let Ok(conns) = CONNS.lock() {
+                if let Some(tx) = conns.as_ref().and_then(|conns| conns.get(key)) {
+                    let _ = tx.send(packet);
+                }
+            }
+        }
+    }
+
+    /// Remote node
+    pub fn dst(&self) -> i32 {
+        match &self.link {
+            Link::Routed { key, .. } => key.1 as i32,
+            // unsafe needed because of following errors:
+            // -> call to unsafe function `csp_conn_dst`
+            Link::Rdp { conn, .. } => unsafe { csp_conn_dst(conn.0) },
+        }
+    }
+
+    /// Local port
+    pub fn sport(&self) -> i32 {
+        match &self.link {
+            Link::Routed { key, .. } => key.0 as i32,
+            // unsafe needed because of following errors:
+            // -> call to unsafe function `csp_conn_sport`
+            Link::Rdp { conn, .. } => unsafe { csp_conn_sport(conn.0) },
+        }
+    }
+
+    /// Remote port
+    pub fn dport(&self) -> i32 {
+        match &self.link {
+            Link::Routed { key, .. } => key.2 as i32,
+            // unsafe needed because of following errors:
+            // -> call to unsafe function `csp_conn_dport`
+            Link::Rdp { conn, .. } => unsafe { csp_conn_dport(conn.0) },
+        }
+    }
+
+    /// Waits for the next packet, `None` once the connection is closed.
+    pub async fn recv(&mut self) -> Option<CspPacket> {
+        self.packets.recv().await
+    }
+
+    /// Sends a packet on the connection. libcsp takes the buffer over.
+    pub async fn send(&self, packet: CspPacket) -> io::Result<()> {
+        let packet = packet.into_raw() as usize;
+
+        // the interface driver may block on a full tx queue
+        match &self.link {
+            &Link::Routed { key, prio, opts } => {
+                let (sport, dest, dport) = key;
+                tokio::task::spawn_blocking(move || {
+                    // unsafe needed because of following errors:
+                    // -> call to unsafe function `csp_sendto`
+                    unsafe {
+                        csp_sendto(prio, dest, dport, sport, opts, packet as *mut csp_packet_t)
+                    }
+                })
+                .await
+            }
+            Link::Rdp { conn, .. } => {
+                let conn = conn.clone();
+                tokio::task::spawn_blocking(move || {
+                    // unsafe needed because of following errors:
+                    // -> call to unsafe function `csp_send`
+                    unsafe { csp_send(conn.0, packet as *mut csp_packet_t) }
+                })
+                .await
+            }
+        }
+        .map_err(io::Error::other)
+    }
+}
+
+impl Stream for CspConn {
+    type Item = CspPacket;
+
+    fn poll_next(mut self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<Option<CspPacket>> {
+        self.packets.poll_recv(cx)
+    }
+}
+
+impl Drop for CspConn {
+    fn drop(&mut self) {
+        match &self.link {
+            Link::Routed { key, .. } => {
+                self.packets.close();
+                if let Ok(mut conns) = CONNS.lock() {
+                    // unless a later connection to the same sender took the entry over
+                    if let Some(conns) = conns.as_mut() {
+                        if conns.get(key).is_some_and(|tx| tx.is_closed()) {
+                            conns.remove(key);
+                        }
+                    }
+                }
+            }
+            Link::Rdp { closed, .. } => closed.store(true, Ordering::Release),
+        }
+    }
+}
+
+/// A port served straight from the libcsp router via `csp_bind_callback`.
+///
+/// Queued packets hold pool buffers, so the libcsp pool bounds the backlog.
+pub struct CspCallbackPort {
+    port: u8,
+    packets: mpsc::UnboundedReceiver<CspPacket>,
+}
+
+impl CspCallbackPort {
+    pub fn bind(port: u8) -> io::Result<Self> {
+        let (tx, packets) = mpsc::unbounded_channel();
+        bind_port(port, Delivery::Packets(tx))?;
+        Ok(CspCallbackPort { port, packets })
+    }
+
+    /// Waits for the next packet on the port.
+    pub async fn recv(&mut self) -> Option<CspPacket> {
+        self.packets.recv().await
+    }
+}
+
+impl Stream for CspCallbackPort {
+    type Item = CspPacket;
+
+    fn poll_next(mut self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<Option<CspPacket>> {
+        self.packets.poll_recv(cx)
+    }
+}
+
+impl Drop for CspCallbackPort {
+    fn drop(&mut self) {
+        unbind_port(self.port);
+    }
+}
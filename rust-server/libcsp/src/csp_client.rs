@@ -0,0 +1,385 @@
+//! Pipelined request/response over persistent CSP connections.
+//!
+//! `csp_transaction` opens a connection per request and waits out a full
+//! round trip before the next one can go. `CspClient` keeps one connection
+//! per (node, port) and lets up to `window` requests be in flight on it.
+//! Replies are matched to requests by a correlation tag, so the peer only
+//! has to echo the first `TAG_LEN` bytes of the request at the start of its
+//! reply, as the CSP ping service does. Unless `opts` asks for RDP the
+//! connections are served by the router callback (see `csp_async`), so a
+//! peer costs no thread.
+//!
+//! Each request waits for the retransmission timeout of its connection,
+//! which follows the measured round trip the way TCP's does (RFC 6298).
+
+use std::collections::HashMap;
+use std::io;
+use std::sync::atomic::{AtomicU32, AtomicU64, Ordering};
+use std::sync::{Arc, Mutex, Weak};
+use std::time::{Duration, Instant};
+use tokio::sync::{mpsc, oneshot, Mutex as AsyncMutex, Semaphore};
+
+use crate::csp_async::CspConn;
+use crate::csp_packet::CspPacket;
+use crate::libcsp::{csp_prio_t_CSP_PRIO_NORM, CSP_O_NONE};
+
+/// Correlation tag at the start of every request and reply, little endian
+pub const TAG_LEN: usize = 4;
+
+/// Settings shared by all connections of a `CspClient`
+#[derive(Debug, Clone, Copy)]
+pub struct ClientConfig {
+    pub prio: u8,
+    pub opts: u32,
+    /// requests in flight per connection
+    pub window: usize,
+    /// timeout before the first reply has been measured
+    pub initial_timeout: Duration,
+    pub min_timeout: Duration,
+    pub max_timeout: Duration,
+}
+
+impl Default for ClientConfig {
+    fn default() -> Self {
+        ClientConfig {
+            prio: csp_prio_t_CSP_PRIO_NORM as u8,
+            opts: CSP_O_NONE,
+            window: 8,
+            initial_timeout: Duration::from_millis(1000),
+            min_timeout: Duration::from_millis(10),
+            max_timeout: Duration::from_millis(5000),
+        }
+    }
+}
+
+/// A reply with its correlation tag stripped
+#[derive(Debug)]
+pub struct Reply {
+    packet: CspPacket,
+    rtt: Duration,
+}
+
+impl Reply {
+    /// Reply payload after the tag
+    pub fn data(&self) -> &[u8] {
+        &self.packet.data()[TAG_LEN..]
+    }
+
+    /// Time from handing the request to the connection until the reply arrived
+    pub fn rtt(&self) -> Duration {
+        self.rtt
+    }
+
+    /// The whole reply buffer, tag included
+    pub fn into_packet(self) -> CspPacket {
+        self.packet
+    }
+}
+
+/// Counters and timing of one connection
+#[derive(Debug, Clone, Copy)]
+pub struct PeerStats {
+    pub node: u16,
+    pub port: u8,
+    pub sent: u64,
+    pub replies: u64,
+    pub timeouts: u64,
+    /// replies that came after their request timed out, or with an unknown tag
+    pub late: u64,
+    pub srtt: Option<Duration>,
+    pub rto: Duration,
+}
+
+/// RFC 6298 round trip estimator, without retransmissions
+struct RttEstimator {
+    srtt: Option<Duration>,
+    rttvar: Duration,
+    rto: Duration,
+}
+
+impl RttEstimator {
+    fn sample(&mut self, rtt: Duration, config: &ClientConfig) {
+        match self.srtt {
+            None => {
+                self.srtt = Some(rtt);
+                self.rttvar = rtt / 2;
+            }
+            Some(srtt) => {
+                let delta = srtt.abs_diff(rtt);
+                self.rttvar = self.rttvar * 3 / 4 + delta / 4;
+                self.srtt = Some(srtt * 7 / 8 + rtt / 8);
+            }
+        }
+
+        let rto = self.srtt.unwrap_or(rtt) + (self.rttvar * 4).max(Duration::from_millis(1));
+        self.rto = rto.clamp(config.min_timeout, config.max_timeout);
+    }
+
+    fn backoff(&mut self, config: &ClientConfig) {
+        self.rto = (self.rto * 2).min(config.max_timeout);
+    }
+}
+
+struct Peer {
+    node: u16,
+    port: u8,
+    outgoing: mpsc::UnboundedSender<CspPacket>,
+    window: Semaphore,
+    next_tag: AtomicU32,
+    pending: Mutex<HashMap<u32, (Instant, oneshot::Sender<Reply>)>>,
+    rtt: Mutex<RttEstimator>,
+    sent: AtomicU64,
+    replies: AtomicU64,
+    timeouts: AtomicU64,
+    late: AtomicU64,
+}
+
+impl Peer {
+    fn complete(&self, packet: CspPacket) {
+        let Some(tag) = packet.data().get(..TAG_LEN) else {
+            self.late.fetch_add(1, Ordering::Relaxed);
+            return;
+        };
+        let tag = u32::from_le_bytes([tag[0], tag[1], tag[2], tag[3]]);
+
+        let waiter = self.pending.lock().ok().and_then(|mut p| p.remove(&tag));
+        match waiter {
+            Some((sent, waiter)) => {
+                let rtt = sent.elapsed();
+                let _ = waiter.send(Reply { packet, rtt });
+            }
+            None => {
+                self.late.fetch_add(1, Ordering::Relaxed);
+            }
+        }
+    }
+
+    fn stats(&self) -> PeerStats {
+        let (srtt, rto) = self
+            .rtt
+            .lock()
+            .map(|rtt| (rtt.srtt, rtt.rto))
+            .unwrap_or((None, Duration::ZERO));
+
+        PeerStats {
+            node: self.node,
+            port: self.port,
+            sent: self.sent.load(Ordering::Relaxed),
+            replies: self.replies.load(Ordering::Relaxed),
+            timeouts: self.timeouts.load(Ordering::Relaxed),
+            late: self.late.load(Ordering::Relaxed),
+            srtt,
+            rto,
+        }
+    }
+}
+
+struct PendingGuard<'a> {
+    peer: &'a Peer,
+    tag: u32,
+}
+
+impl Drop for PendingGuard<'_> {
+    fn drop(&mut self) {
+        if let Ok(mut pending) = self.peer.pending.lock() {
+            pending.remove(&self.tag);
+        }
+    }
+}
+
+struct Inner {
+    config: ClientConfig,
+    peers: AsyncMutex<HashMap<(u16, u8), Arc<Peer>>>,
+}
+
+/// Request/response client, cheap to clone and share between tasks.
+#[derive(Clone)]
+pub struct CspClient {
+    inner: Arc<Inner>,
+}
+
+impl CspClient {
+    pub fn new(config: ClientConfig) -> Self {
+        CspClient {
+            inner: Arc::new(Inner {
+                config: ClientConfig {
+                    window: config.window.max(1),
+                    ..config
+                },
+                peers: AsyncMutex::new(HashMap::new()),
+            }),
+        }
+    }
+
+    /// Sends `payload` to `node`:`port` and waits for the matching reply.
+    ///
+    /// Waits first when `window` requests to that node and port are already
+    /// in flight. Many of these futures can be awaited at once, e.g. from
+    /// separate tasks, and they share the one connection.
+    pub async fn request(&self, node: u16, port: u8, payload: &[u8]) -> io::Result<Reply> {
+        if payload.len() + TAG_LEN > CspPacket::capacity() {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidInput,
+                format!(
+                    "request of {} bytes does not fit a csp buffer",
+                    payload.len()
+                ),
+            ));
+        }
+
+        let peer = self.peer(node, port).await?;
+        let _permit = peer
+            .window
+            .acquire()
+            .await
+            .map_err(|_| io::Error::other(format!("connection to {}:{} closed", node, port)))?;
+
+        let tag = peer.next_tag.fetch_add(1, Ordering::Relaxed);
+        let mut packet = CspPacket::get().ok_or_else(|| io::Error::other("no csp buffer"))?;
+        let buffer = packet.buffer_mut();
+        buffer[..TAG_LEN].copy_from_slice(&tag.to_le_bytes());
+        buffer[TAG_LEN..TAG_LEN + payload.len()].copy_from_slice(payload);
+        packet.set_len(TAG_LEN + payload.len());
+
+        let (waiter, reply) = oneshot::channel();
+        let timeout = {
+            let mut pending = peer
+                .pending
+                .lock()
+                .map_err(|_| io::Error::other("poisoned"))?;
+            pending.insert(tag, (Instant::now(), waiter));
+            peer.rtt
+                .lock()
+                .map(|rtt| rtt.rto)
+                .unwrap_or(self.inner.config.max_timeout)
+        };
+        // takes the entry back out unless a reply did, also when this future is dropped
+        let _pending = PendingGuard { peer: &peer, tag };
+
+        if peer.outgoing.send(packet).is_err() {
+            return Err(io::Error::other(format!(
+                "connection to {}:{} closed",
+                node, port
+            )));
+        }
+        peer.sent.fetch_add(1, Ordering::Relaxed);
+
+        match tokio::time::timeout(timeout, reply).await {
+            Ok(Ok(reply)) => {
+                peer.replies.fetch_add(1, Ordering::Relaxed);
+                if let Ok(mut rtt) = peer.rtt.lock() {
+                    rtt.sample(reply.rtt, &self.inner.config);
+                }
+                Ok(reply)
+            }
+            Ok(Err(_)) => Err(io::Error::other(format!(
+                "connection to {}:{} closed",
+                node, port
+            ))),
+            Err(_) => {
+                peer.timeouts.fetch_add(1, Ordering::Relaxed);
+                if let Ok(mut rtt) = peer.rtt.lock() {
+                    rtt.backoff(&self.inner.config);
+                }
+                Err(io::Error::new(
+                    io::ErrorKind::TimedOut,
+                    format!("no reply from {}:{} within {:?}", node, port, timeout),
+                ))
+            }
+        }
+    }
+
+    /// Counters of every open connection
+    pub async fn stats(&self) -> Vec<PeerStats> {
+        let peers = self.inner.peers.lock().await;
+        let mut stats: Vec<PeerStats> = peers.values().map(|peer| peer.stats()).collect();
+        stats.sort_by_key(|s| (s.node, s.port));
+        stats
+    }
+
+    async fn peer(&self, node: u16, port: u8) -> io::Result<Arc<Peer>> {
+        let mut peers = self.inner.peers.lock().await;
+        if let Some(peer) = peers.get(&(node, port)) {
+            if !peer.outgoing.is_closed() {
+                return Ok(peer.clone());
+            }
+        }
+
+        let config = &self.inner.config;
+        let conn = CspConn::connect(
+            config.prio,
+            node,
+            port,
+            config.initial_timeout.as_millis() as u32,
+            config.opts,
+        )
+        .await?;
+
+        let (outgoing, packets) = mpsc::unbounded_channel();
+        let peer = Arc::new(Peer {
+            node,
+            port,
+            outgoing,
+            window: Semaphore::new(config.window),
+            next_tag: AtomicU32::new(0),
+            pending: Mutex::new(HashMap::new()),
+            rtt: Mutex::new(RttEstimator {
+                srtt: None,
+                rttvar: Duration::ZERO,
+                rto: config.initial_timeout,
+            }),
+            sent: AtomicU64::new(0),
+            replies: AtomicU64::new(0),
+            timeouts: AtomicU64::new(0),
+            late: AtomicU64::new(0),
+        });
+
+        tokio::spawn(run_peer(conn, packets, Arc::downgrade(&peer)));
+        peers.insert((node, port), peer.clone());
+        Ok(peer)
+    }
+}
+
+/// Owns the connection: sends requests in order and hands replies to their
+/// waiters. Only holds the peer weakly, so dropping the client closes it.
+async fn run_peer(
+    mut conn: CspConn,
+    mut packets: mpsc::UnboundedReceiver<CspPacket>,
+    peer: Weak<Peer>,
+) {
+    let (node, port) = (conn.dst(), conn.dport());
+
+    loop {
+        tokio::select! {
+            packet = packets.recv() => {
+                let Some(packet) = packet else {
+                    break;
+                };
+                if let Err(e) = conn.send(packet).await {
+                    eprintln!("csp client send to {}:{} failed: {}", node, port, e);
+                    break;
+                }
+            }
+            reply = conn.recv() => {
+                let Some(reply) = reply else {
+                    break;
+                };
+                let Some(peer) = peer.upgrade() else {
+                    break;
+                };
+                peer.complete(reply);
+            }
+        }
+    }
+
+    // fail everything still waiting and let the next request reconnect,
+    // which needs this connection gone first
+    drop(conn);
+    packets.close();
+    if let Some(peer) = peer.upgrade() {
+        peer.window.close();
+        if let Ok(mut pending) = peer.pending.lock() {
+            pending.clear();
+        }
+    }
+}
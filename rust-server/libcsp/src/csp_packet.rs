@@ -0,0 +1,210 @@
+use std::ffi;
+use std::ptr::NonNull;
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+use crate::libcsp::{csp_buffer_free, csp_buffer_get, csp_buffer_remaining, csp_packet_t};
+
+/// Buffers currently owned by a `CspPacket`
+static PACKETS_HELD: AtomicUsize = AtomicUsize::new(0);
+/// Fewest free buffers seen right after a `CspPacket::get`
+static POOL_LOW_WATER: AtomicUsize = AtomicUsize::new(usize::MAX);
+
+/// Occupancy of the libcsp buffer pool
+#[derive(Debug, Clone, Copy)]
+pub struct PoolStats {
+    /// buffers free in the pool right now
+    pub free: usize,
+    /// buffers owned by `CspPacket` values on the Rust side
+    pub held: usize,
+    /// lowest free count observed after an allocation, `None` before the first one
+    pub low_water: Option<usize>,
+}
+
+/// Returns the current buffer pool occupancy.
+pub fn pool_stats() -> PoolStats {
+    // unsafe needed because of following errors:
+    // -> call to unsafe function `csp_buffer_remaining`
+    let free = unsafe { csp_buffer_remaining() }.max(0) as usize;
+    let low_water = POOL_LOW_WATER.load(Ordering::Relaxed);
+
+    PoolStats {
+        free,
+        held: PACKETS_HELD.load(Ordering::Relaxed),
+        low_water: (low_water != usize::MAX).then_some(low_water),
+    }
+}
+
+/// An owned libcsp packet buffer.
+///
+/// The buffer goes back to the libcsp pool when the value is dropped, so a
+/// packet can be moved between threads and tasks without leaking.
+#[derive(Debug)]
+pub struct CspPacket {
+    ptr: NonNull<csp_packet_t>,
+}
+
+// A packet buffer is only ever reachable through its single owner.
+unsafe impl Send for CspPacket {}
+
+impl CspPacket {
+    /// Takes ownership of a buffer returned by libcsp.
+    ///
+    /// # Safety
+    ///
+    /// `packet` must come from the libcsp buffer pool and must not be freed
+    /// or used by anyone else afterwards.
+    pub unsafe fn from_raw(packet: *mut csp_packet_t) -> Option<Self> {
+        let ptr = NonNull::new(packet)?;
+        PACKETS_HELD.fetch_add(1, Ordering::Relaxed);
+        Some(CspPacket { ptr })
+    }
+
+    /// Gets an empty buffer from the pool, `None` when the pool is exhausted.
+    pub fn get() -> Option<Self> {
+        // unsafe needed because of following errors:
+        // -> call to unsafe functions `csp_buffer_get`, `csp_buffer_remaining`
+        // -> dereference of raw pointer
+        unsafe {
+            let packet = Self::from_raw(csp_buffer_get(0))?;
+            (*packet.ptr.as_ptr()).length = 0;
+
+            let free = csp_buffer_remaining().max(0) as usize;
+            POOL_LOW_WATER.fetch_min(free, Ordering::Relaxed);
+
+            Some(packet)
+        }
+    }
+
+    /// Gets a buffer from the pool and copies `bytes` into it.
+    ///
+    /// Returns `None` when the pool is empty or `bytes` does not fit.
+    pub fn from_slice(bytes: &[u8]) -> Option<Self> {
+        if bytes.len() > Self::capacity() {
+            return None;
+        }
+
+        let mut packet = Self::get()?;
+        packet.buffer_mut()[..bytes.len()].copy_from_slice(bytes);
+        packet.set_len(bytes.len());
+        Some(packet)
+    }
+
+    /// Gives the buffer back to the caller, e.g. to pass it to `csp_send`
+    /// which takes ownership of it.
+    pub fn into_raw(self) -> *mut csp_packet_t {
+        let ptr = self.ptr.as_ptr();
+        std::mem::forget(self);
+        PACKETS_HELD.fetch_sub(1, Ordering::Relaxed);
+        ptr
+    }
+
+    pub fn as_ptr(&self) -> *const csp_packet_t {
+        self.ptr.as_ptr()
+    }
+
+    pub fn prio(&self) -> u8 {
+        // unsafe needed because of following errors:
+        // -> dereference of raw pointer
+        unsafe { (*self.ptr.as_ptr()).id.pri }
+    }
+
+    pub fn src(&self) -> u16 {
+        // unsafe needed because of following errors:
+        // -> dereference of raw pointer
+        unsafe { (*self.ptr.as_ptr()).id.src }
+    }
+
+    pub fn dst(&self) -> u16 {
+        // unsafe needed because of following errors:
+        // -> dereference of raw pointer
+        unsafe { (*self.ptr.as_ptr()).id.dst }
+    }
+
+    pub fn sport(&self) -> u8 {
+        // unsafe needed because of following errors:
+        // -> dereference of raw pointer
+        unsafe { (*self.ptr.as_ptr()).id.sport }
+    }
+
+    pub fn dport(&self) -> u8 {
+        // unsafe needed because of following errors:
+        // -> dereference of raw pointer
+        unsafe { (*self.ptr.as_ptr()).id.dport }
+    }
+
+    pub fn len(&self) -> usize {
+        // unsafe needed because of following errors:
+        // -> dereference of raw pointer
+        unsafe { (*self.ptr.as_ptr()).length as usize }
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Size of the data area of every pool buffer
+    pub fn capacity() -> usize {
+        fn array_len<const N: usize>(_: *const [u8; N]) -> usize {
+            N
+        }
+
+        let packet = std::mem::MaybeUninit::<csp_packet_t>::uninit();
+        // unsafe needed because of following errors:
+        // -> dereference of raw pointer (only its field address is taken)
+        array_len(unsafe { std::ptr::addr_of!((*packet.as_ptr()).__bindgen_anon_1.data) })
+    }
+
+    /// Sets the number of valid bytes after serializing into `buffer_mut`.
+    ///
+    /// # Panics
+    ///
+    /// Panics if `len` is larger than `capacity()`.
+    pub fn set_len(&mut self, len: usize) {
+        assert!(
+            len <= Self::capacity(),
+            "csp packet length {} out of range",
+            len
+        );
+        // unsafe needed because of following errors:
+        // -> dereference of raw pointer
+        unsafe {
+            (*self.ptr.as_ptr()).length = len as u16;
+        }
+    }
+
+    /// The valid part of the data area
+    pub fn data(&self) -> &[u8] {
+        // unsafe needed because of following errors:
+        // -> dereference of raw pointer
+        // -> access to union field is unsafe
+        unsafe {
+            let data = &(*self.ptr.as_ptr()).__bindgen_anon_1.data;
+            &data[..self.len().min(data.len())]
+        }
+    }
+
+    /// The valid part of the data area, writable in place
+    pub fn data_mut(&mut self) -> &mut [u8] {
+        let len = self.len().min(Self::capacity());
+        &mut self.buffer_mut()[..len]
+    }
+
+    /// The whole data area, for serializing in place before `set_len`
+    pub fn buffer_mut(&mut self) -> &mut [u8] {
+        // unsafe needed because of following errors:
+        // -> dereference of raw pointer
+        // -> access to union field is unsafe
+        unsafe { &mut (*self.ptr.as_ptr()).__bindgen_anon_1.data }
+    }
+}
+
+impl Drop for CspPacket {
+    fn drop(&mut self) {
+        // unsafe needed because of following errors:
+        // -> call to unsafe function `csp_buffer_free`
+        unsafe {
+            csp_buffer_free(self.ptr.as_ptr() as *mut ffi::c_void);
+        }
+        PACKETS_HELD.fetch_sub(1, Ordering::Relaxed);
+    }
+}
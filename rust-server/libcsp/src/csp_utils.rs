@@ -1,10 +1,42 @@
 use std::ffi;
 
+use crate::csp_packet::CspPacket;
 use crate::libcsp::{
-    csp_buffer_free, csp_buffer_get, csp_close, csp_conn_t, csp_connect, csp_read, csp_send,
-    csp_transaction_persistent, CSP_ERR_NONE, CSP_ERR_TX, CSP_O_NONE,
+    csp_close, csp_conn_t, csp_connect, csp_read, csp_send, csp_transaction_persistent,
+    CSP_ERR_INVAL, CSP_ERR_NOMEM, CSP_ERR_NONE, CSP_ERR_TIMEDOUT, CSP_ERR_TX, CSP_O_NONE,
 };
 
+/// Sends `request` and waits for a single reply on a fresh connection.
+///
+/// The request buffer is handed to libcsp as is, so callers serialize into
+/// `CspPacket::buffer_mut` and nothing is copied on the way out.
+///
+/// # Returns
+///
+/// The reply packet, or the CSP error code.
+pub fn csp_transaction_packet(
+    prio: u8,
+    dest: u16,
+    port: u8,
+    timeout: u32,
+    request: CspPacket,
+) -> Result<CspPacket, i32> {
+    // unsafe needed because of following errors:
+    // -> call to unsafe functions `csp_connect`, `csp_send`, `csp_read`, `csp_close`
+    unsafe {
+        let conn: *mut csp_conn_t = csp_connect(prio, dest, port, 0, CSP_O_NONE);
+        if conn.is_null() {
+            return Err(CSP_ERR_TX);
+        }
+
+        csp_send(conn, request.into_raw());
+        let reply = CspPacket::from_raw(csp_read(conn, timeout));
+        csp_close(conn);
+
+        reply.ok_or(CSP_ERR_TIMEDOUT)
+    }
+}
+
 /// Performs a CSP transaction.
 ///
 /// # Arguments
@@ -43,12 +75,12 @@ pub unsafe fn csp_transaction(
     in_len: u16,
 ) -> i32 {
     unsafe {
-        let conn: *mut csp_conn_t = csp_connect(prio, dest, port, 0, CSP_O_NONE);
-        if conn.is_null() {
-            return CSP_ERR_TX;
-        }
-
         if !in_buf.is_null() {
+            let conn: *mut csp_conn_t = csp_connect(prio, dest, port, 0, CSP_O_NONE);
+            if conn.is_null() {
+                return CSP_ERR_TX;
+            }
+
             let ret_val: i32 = csp_transaction_persistent(
                 conn,
                 timeout,
@@ -61,33 +93,30 @@ pub unsafe fn csp_transaction(
             return ret_val;
         }
 
-        let mut packet = csp_buffer_get(0);
-        if packet.is_null() {
-            return CSP_ERR_TX;
+        // only `out_len` bytes are read from the caller's buffer
+        if out_len as usize > CspPacket::capacity() {
+            return CSP_ERR_INVAL;
         }
+        let request = std::slice::from_raw_parts(out_buf as *const u8, out_len.into());
+        let request = match CspPacket::from_slice(request) {
+            Some(request) => request,
+            None => return CSP_ERR_NOMEM,
+        };
 
-        (*packet).length = out_len;
-        (*packet).__bindgen_anon_1.data = *(out_buf as *const [u8; 256]);
-        csp_send(conn, packet);
-
-        packet = csp_read(conn, timeout);
-        if packet.is_null() {
-            csp_buffer_free(packet as *mut ffi::c_void);
-            csp_close(conn);
-            return CSP_ERR_TX;
-        }
+        let reply = match csp_transaction_packet(prio, dest, port, timeout, request) {
+            Ok(reply) => reply,
+            Err(_) => return CSP_ERR_TX,
+        };
 
         print!(
             "Incoming packet lenth: {} and the packet content: ",
-            (*packet).length as usize
+            reply.len()
         );
-        for i in 0..(*packet).length as usize {
-            print!("{:02x} ", (*packet).__bindgen_anon_1.data[i]);
+        for byte in reply.data() {
+            print!("{:02x} ", byte);
         }
         println!();
 
-        csp_buffer_free(packet as *mut ffi::c_void);
-        csp_close(conn);
         CSP_ERR_NONE.try_into().unwrap()
     }
 }
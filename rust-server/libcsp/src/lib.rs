@@ -1,2 +1,5 @@
+pub mod csp_async;
+pub mod csp_client;
+pub mod csp_packet;
 pub mod csp_utils;
 pub mod libcsp;
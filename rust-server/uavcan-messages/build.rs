@@ -0,0 +1,28 @@
+use std::env;
+use std::path::PathBuf;
+use std::process::Command;
+
+fn main() -> Result<(), Box<dyn std::error::Error>> {
+    let out_dir = env::var("OUT_DIR")?;
+    let manifest_dir = PathBuf::from(env::var("CARGO_MANIFEST_DIR")?);
+    let generator = manifest_dir.join("../../tools/uavcan_gen.py");
+    let nodes = manifest_dir.join("../../embedded-client/nodes");
+
+    println!("cargo:rerun-if-changed={}", generator.display());
+    println!("cargo:rerun-if-changed={}", nodes.display());
+
+    let status = Command::new("python3")
+        .arg(&generator)
+        .arg("--nodes")
+        .arg(&nodes)
+        .arg("--rust-out")
+        .arg(&out_dir)
+        .status()
+        .expect("Failed to execute tools/uavcan_gen.py");
+
+    if !status.success() {
+        panic!("uavcan message generation failed");
+    }
+
+    Ok(())
+}
@@ -0,0 +1,26 @@
+use std::env;
+use std::process;
+
+fn main() {
+    let iterations = env::args()
+        .nth(1)
+        .and_then(|s| s.parse().ok())
+        .unwrap_or(1_000_000);
+
+    let mut failed = false;
+    for r in uavcan_messages::roundtrip::run(iterations) {
+        println!(
+            "{:<24} {:>4} bytes  encode {:>8.1} ns  decode {:>8.1} ns  {}",
+            r.name,
+            r.size,
+            r.encode_ns,
+            r.decode_ns,
+            if r.ok { "ok" } else { "FAILED" }
+        );
+        failed |= !r.ok;
+    }
+
+    if failed {
+        process::exit(1);
+    }
+}
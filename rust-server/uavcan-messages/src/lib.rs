@@ -0,0 +1,247 @@
+//! Message types generated from the `.uavcan` definitions under
+//! `embedded-client/nodes` by `tools/uavcan_gen.py`, with the same byte layout
+//! as the firmware's `uavcan_messages.h`.
+//!
+//! Nothing here allocates: variable length fields are `BoundedArray`s sized by
+//! the definition, and messages encode straight into the caller's buffer, e.g.
+//! a `CspPacket`:
+//!
+//! ```ignore
+//! let len = ping.encode(packet.buffer_mut())?;
+//! packet.set_len(len);
+//! ```
+
+use std::fmt;
+
+/// Why a message could not be encoded or decoded
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum CodecError {
+    /// the output buffer is smaller than the encoded message
+    BufferTooSmall,
+    /// the input ends before the last field
+    Truncated,
+    /// a length prefix or tail is over the array bound of the definition
+    ArrayTooLong,
+}
+
+impl fmt::Display for CodecError {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self {
+            CodecError::BufferTooSmall => write!(f, "buffer too small"),
+            CodecError::Truncated => write!(f, "message truncated"),
+            CodecError::ArrayTooLong => write!(f, "array over its bound"),
+        }
+    }
+}
+
+impl std::error::Error for CodecError {}
+
+pub trait Message: Sized + PartialEq {
+    /// Type id from the file name, the CSP port the message is meant for
+    const ID: u16;
+    /// Encoded size with every array at its bound
+    const MAX_SIZE: usize;
+    /// Encoded size with every dynamic array empty
+    const MIN_SIZE: usize;
+
+    fn encoded_len(&self) -> usize;
+
+    /// Writes the message to the start of `buf` and returns its length.
+    fn encode(&self, buf: &mut [u8]) -> Result<usize, CodecError>;
+
+    /// Reads a message from `buf`. Bytes past the last field are ignored,
+    /// unless that field is a tail array, which takes the rest of `buf`.
+    fn decode(buf: &[u8]) -> Result<Self, CodecError>;
+}
+
+/// Fixed capacity array for `T[<=N]` fields.
+#[derive(Clone, Copy)]
+pub struct BoundedArray<T: Copy + Default, const N: usize> {
+    len: usize,
+    items: [T; N],
+}
+
+impl<T: Copy + Default, const N: usize> BoundedArray<T, N> {
+    pub fn new() -> Self {
+        BoundedArray {
+            len: 0,
+            items: [T::default(); N],
+        }
+    }
+
+    /// Copies `items`, `None` when there are more than `N` of them.
+    pub fn from_slice(items: &[T]) -> Option<Self> {
+        if items.len() > N {
+            return None;
+        }
+
+        let mut array = Self::new();
+        array.items[..items.len()].copy_from_slice(items);
+        array.len = items.len();
+        Some(array)
+    }
+
+    /// Appends `item`, handing it back when the array is full.
+    pub fn push(&mut self, item: T) -> Result<(), T> {
+        if self.len == N {
+            return Err(item);
+        }
+
+        self.items[self.len] = item;
+        self.len += 1;
+        Ok(())
+    }
+
+    pub fn clear(&mut self) {
+        self.len = 0;
+    }
+
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    pub const fn capacity() -> usize {
+        N
+    }
+
+    pub fn as_slice(&self) -> &[T] {
+        &self.items[..self.len]
+    }
+}
+
+impl<T: Copy + Default, const N: usize> Default for BoundedArray<T, N> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<T: Copy + Default + PartialEq, const N: usize> PartialEq for BoundedArray<T, N> {
+    fn eq(&self, other: &Self) -> bool {
+        self.as_slice() == other.as_slice()
+    }
+}
+
+impl<T: Copy + Default + fmt::Debug, const N: usize> fmt::Debug for BoundedArray<T, N> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        self.as_slice().fmt(f)
+    }
+}
+
+/// A field type with a fixed little endian wire size
+pub trait Scalar: Copy {
+    const SIZE: usize;
+    fn write(self, out: &mut [u8]);
+    fn read(bytes: &[u8]) -> Self;
+}
+
+macro_rules! impl_scalar {
+    ($($t:ty),*) => {$(
+        impl Scalar for $t {
+            const SIZE: usize = std::mem::size_of::<$t>();
+
+            fn write(self, out: &mut [u8]) {
+                out.copy_from_slice(&self.to_le_bytes());
+            }
+
+            fn read(bytes: &[u8]) -> Self {
+                let mut raw = [0u8; std::mem::size_of::<$t>()];
+                raw.copy_from_slice(bytes);
+                <$t>::from_le_bytes(raw)
+            }
+        }
+    )*};
+}
+
+impl_scalar!(u8, u16, u32, u64, i8, i16, i32, i64, f32, f64);
+
+impl Scalar for bool {
+    const SIZE: usize = 1;
+
+    fn write(self, out: &mut [u8]) {
+        out[0] = self as u8;
+    }
+
+    fn read(bytes: &[u8]) -> Self {
+        bytes[0] != 0
+    }
+}
+
+/// Cursor over an output buffer already cut to the encoded length, so the
+/// generated encoders only check the length once.
+pub struct Writer<'a> {
+    buf: &'a mut [u8],
+    at: usize,
+}
+
+impl<'a> Writer<'a> {
+    pub fn new(buf: &'a mut [u8]) -> Self {
+        Writer { buf, at: 0 }
+    }
+
+    pub fn put<T: Scalar>(&mut self, value: T) {
+        value.write(&mut self.buf[self.at..self.at + T::SIZE]);
+        self.at += T::SIZE;
+    }
+
+    pub fn put_bytes(&mut self, bytes: &[u8]) {
+        self.buf[self.at..self.at + bytes.len()].copy_from_slice(bytes);
+        self.at += bytes.len();
+    }
+
+    pub fn pad(&mut self, len: usize) {
+        self.buf[self.at..self.at + len].fill(0);
+        self.at += len;
+    }
+}
+
+/// Bounds checked cursor over a received message
+pub struct Reader<'a> {
+    buf: &'a [u8],
+    at: usize,
+}
+
+impl<'a> Reader<'a> {
+    pub fn new(buf: &'a [u8]) -> Self {
+        Reader { buf, at: 0 }
+    }
+
+    pub fn get<T: Scalar>(&mut self) -> Result<T, CodecError> {
+        Ok(T::read(self.get_bytes(T::SIZE)?))
+    }
+
+    pub fn get_bytes(&mut self, len: usize) -> Result<&'a [u8], CodecError> {
+        let bytes = self
+            .buf
+            .get(self.at..self.at + len)
+            .ok_or(CodecError::Truncated)?;
+        self.at += len;
+        Ok(bytes)
+    }
+
+    pub fn skip(&mut self, len: usize) -> Result<(), CodecError> {
+        self.get_bytes(len).map(|_| ())
+    }
+
+    /// Element count of a tail array, i.e. everything left in the buffer
+    pub fn tail_count(&self, elem_size: usize) -> Result<usize, CodecError> {
+        let rest = self.buf.len() - self.at;
+        let count = rest / elem_size;
+        if count * elem_size != rest {
+            return Err(CodecError::Truncated);
+        }
+        Ok(count)
+    }
+}
+
+include!(concat!(env!("OUT_DIR"), "/uavcan_messages.rs"));
+
+/// Round-trip timing of every generated message, run by `examples/roundtrip.rs`
+pub mod roundtrip {
+    use super::*;
+
+    include!(concat!(env!("OUT_DIR"), "/uavcan_roundtrip.rs"));
+}
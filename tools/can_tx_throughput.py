@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+"""
+Before/after CAN transmit throughput of a host build node over vcan.
+
+Runs the host build once with a single tx mailbox, which sends one frame at a time like
+csp_can_tx_frame() did before the software tx queue, and once with all three mailboxes
+pipelined. Each run is loaded by csp-bench with CSP ping requests that take several CAN
+frames, and the frames counted on the interface are reported per second. The node echoes
+every request at the same length, so half of the bus frames are its own transmits.
+
+    tools/can_tx_throughput.py --host-bin embedded-client/build-host/application_firmware_host \\
+        --bench-bin rust-server/csp-bench/target/release/csp-bench
+
+The interface has to be up first (ip link add dev vcan0 type vcan && ip link set up vcan0).
+These are host/vcan figures: vcan has no bit timing, so they show what the driver and the
+scheduler can push, not what a 1 Mbit/s bus carries.
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+MAILBOX_RUNS = ((1, "before (1 mailbox)"), (3, "after (3 mailboxes)"))
+
+
+def run_point(args, mailboxes):
+    node = subprocess.Popen([args.host_bin, "-i", args.iface, "-n", str(args.node), "-m", str(mailboxes)],
+                            stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    try:
+        # let the node bring its interface up before the first request
+        time.sleep(args.startup_s)
+        if node.poll() is not None:
+            sys.exit("%s exited with %d" % (args.host_bin, node.returncode))
+
+        fd, output = tempfile.mkstemp(suffix=".json")
+        os.close(fd)
+        try:
+            subprocess.run([args.bench_bin, "--iface", args.iface, "--nodes", str(args.node),
+                            "--sizes", str(args.size), "--concurrency", str(args.concurrency),
+                            "--duration-ms", str(args.duration_ms), "--output", output],
+                           check=True, stdout=subprocess.DEVNULL)
+            with open(output) as f:
+                report = json.load(f)
+        finally:
+            os.unlink(output)
+    finally:
+        node.terminate()
+        node.wait()
+
+    results = report.get("results") or []
+    if not results:
+        sys.exit("csp-bench reported no results")
+    return results[0]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--host-bin", required=True, help="application_firmware_host of the host build")
+    parser.add_argument("--bench-bin", required=True, help="csp-bench binary")
+    parser.add_argument("--iface", default="vcan0", help="vcan interface shared by both")
+    parser.add_argument("--node", type=int, default=11, help="CSP node id of the host build node")
+    parser.add_argument("--size", type=int, default=256, help="request size in bytes, 256 is a 33 frame train")
+    parser.add_argument("--concurrency", type=int, default=4, help="requests in flight")
+    parser.add_argument("--duration-ms", type=int, default=5000, help="measuring time of each run")
+    parser.add_argument("--startup-s", type=float, default=1.0, help="wait after starting the node")
+    args = parser.parse_args()
+
+    print("host/vcan, %d byte ping requests, %d in flight" % (args.size, args.concurrency))
+    print("%-22s %12s %16s %10s" % ("run", "bus frames/s", "node tx frames/s", "timeouts"))
+    for mailboxes, name in MAILBOX_RUNS:
+        point = run_point(args, mailboxes)
+        frames_per_s = point["can_frames"] / point["duration_s"] if point["duration_s"] else 0.0
+        print("%-22s %12.0f %16.0f %10d" % (name, frames_per_s, frames_per_s / 2, point["timeouts"]))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,187 @@
+#!/usr/bin/env python3
+"""
+RAM and flash budget report from a GNU ld map file.
+
+Every input section of the map is charged to the object it came from, members of
+archives as <archive>(<member>), and summed per module into RAM (.data, .bss and the
+reserved heap/stack) and flash (everything loaded into the FLASH region, including the
+load image of .data). The report lists the modules by RAM use, then the totals against
+the budgets, and the script exits non-zero when a budget is exceeded so the build fails.
+
+    tools/mem_budget.py --map build/application_firmware.map --config embedded-client/inc/mem_config.h
+
+The budgets are MEM_RAM_BUDGET and MEM_FLASH_BUDGET of the config header, --ram-budget and
+--flash-budget override them, both default to the length of the RAM and FLASH regions.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+RAM_REGION = "RAM"
+FLASH_REGION = "FLASH"
+
+HEX = r"0x[0-9a-fA-F]+"
+REGION_LINE = re.compile(r"^(\S+)\s+(" + HEX + r")\s+(" + HEX + r")")
+# a section line is "<name> <address> <size> ...", long names put the rest on the next line
+SECTION_LINE = re.compile(r"^(\S+)(?:\s+(" + HEX + r")\s+(" + HEX + r")\s*(.*))?$")
+CONTINUATION = re.compile(r"^\s+(" + HEX + r")\s+(" + HEX + r")\s*(.*)$")
+LOAD_ADDRESS = re.compile(r"load address\s+(" + HEX + r")")
+CONFIG_DEFINE = re.compile(r"^#define\s+(MEM_[A-Z_]+)\s+\(?(\d+)\)?")
+
+
+class Region:
+    def __init__(self, name, origin, length):
+        self.name = name
+        self.origin = origin
+        self.length = length
+
+    def contains(self, address):
+        return self.origin <= address < self.origin + self.length
+
+
+def module_name(path):
+    path = path.strip()
+    match = re.match(r"^(.*\.a)\((.*)\)$", path)
+    if match:
+        return "%s(%s)" % (os.path.basename(match.group(1)), match.group(2))
+    name = os.path.basename(path)
+    for suffix in (".obj", ".o"):
+        if name.endswith(suffix):
+            name = name[: -len(suffix)]
+    return name
+
+
+def parse_map(path):
+    """Returns the memory regions and {module: [ram, flash]} of the map file"""
+    with open(path, encoding="utf-8", errors="replace") as f:
+        lines = f.read().splitlines()
+
+    regions = {}
+    usage = {}
+    try:
+        start = lines.index("Memory Configuration")
+        layout = lines.index("Linker script and memory map")
+    except ValueError:
+        sys.exit("%s does not look like a GNU ld map file" % path)
+
+    for line in lines[start + 1 : layout]:
+        match = REGION_LINE.match(line)
+        if match and match.group(1) not in ("Name", "*default*"):
+            regions[match.group(1)] = Region(match.group(1), int(match.group(2), 16), int(match.group(3), 16))
+    if RAM_REGION not in regions or FLASH_REGION not in regions:
+        sys.exit("%s has no %s and %s regions" % (path, RAM_REGION, FLASH_REGION))
+    ram = regions[RAM_REGION]
+    flash = regions[FLASH_REGION]
+
+    def charge(module, address, size, load_address):
+        if size == 0:
+            return
+        entry = usage.setdefault(module, [0, 0])
+        if ram.contains(address):
+            entry[0] += size
+            # initialized data is also stored in flash and copied at startup
+            if load_address is not None and flash.contains(load_address):
+                entry[1] += size
+        elif flash.contains(address):
+            entry[1] += size
+
+    def sections():
+        """Yields (output, name, address, size, rest) for every output and input section"""
+        body = lines[layout + 1 :]
+        i = 0
+        while i < len(body):
+            line = body[i]
+            i += 1
+            if line.startswith("/DISCARD/"):
+                return
+            # deeper indented lines are symbols and linker script statements
+            if line.startswith("  "):
+                continue
+            output = not line.startswith(" ")
+            match = SECTION_LINE.match(line.strip())
+            if not match or not (match.group(1).startswith(".") or match.group(1) in ("COMMON", "*fill*")):
+                continue
+            name, address, size, rest = match.groups()
+            if address is None:
+                if i == len(body):
+                    return
+                match = CONTINUATION.match(body[i])
+                if not match:
+                    continue
+                i += 1
+                address, size, rest = match.groups()
+            yield output, name, int(address, 16), int(size, 16), rest
+
+    current = None
+    load_offset = None  # load address minus run address of the current output section
+    for output, name, address, size, rest in sections():
+        if output:
+            current = name
+            load = LOAD_ADDRESS.search(rest)
+            # zero initialized sections get a load address in the map but take no flash
+            zeroed = "bss" in name or "noinit" in name
+            load_offset = int(load.group(1), 16) - address if load and not zeroed else None
+            if name == "._user_heap_stack":
+                charge("(reserved heap and main stack)", address, size, None)
+            continue
+        if current == "._user_heap_stack":
+            continue
+
+        load = address + load_offset if load_offset is not None else None
+        if name == "*fill*":
+            charge("(alignment fill)", address, size, load)
+        elif rest:
+            charge(module_name(rest), address, size, load)
+
+    return ram, flash, usage
+
+
+def read_config(path):
+    budgets = {}
+    with open(path, encoding="utf-8") as f:
+        for line in f:
+            match = CONFIG_DEFINE.match(line)
+            if match:
+                budgets[match.group(1)] = int(match.group(2))
+    return budgets
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--map", required=True, help="GNU ld map file of the firmware")
+    parser.add_argument("--config", help="header with MEM_RAM_BUDGET and MEM_FLASH_BUDGET")
+    parser.add_argument("--ram-budget", type=int, help="RAM budget in bytes")
+    parser.add_argument("--flash-budget", type=int, help="flash budget in bytes")
+    parser.add_argument("--top", type=int, default=0, help="only list the N largest modules")
+    args = parser.parse_args()
+
+    ram, flash, usage = parse_map(args.map)
+    config = read_config(args.config) if args.config else {}
+    ram_budget = args.ram_budget or config.get("MEM_RAM_BUDGET") or ram.length
+    flash_budget = args.flash_budget or config.get("MEM_FLASH_BUDGET") or flash.length
+
+    modules = sorted(usage.items(), key=lambda item: (-item[1][0], -item[1][1], item[0]))
+    if args.top:
+        modules = modules[: args.top]
+    width = max([len(name) for name, _ in modules] + [len("module")])
+    print("%-*s %8s %8s" % (width, "module", "ram", "flash"))
+    for name, (ram_used, flash_used) in modules:
+        print("%-*s %8d %8d" % (width, name, ram_used, flash_used))
+
+    ram_total = sum(entry[0] for entry in usage.values())
+    flash_total = sum(entry[1] for entry in usage.values())
+    failed = False
+    for name, used, budget in (("RAM", ram_total, ram_budget), ("flash", flash_total, flash_budget)):
+        status = "ok"
+        if used > budget:
+            status = "OVER BUDGET by %d bytes" % (used - budget)
+            failed = True
+        print("%s: %d of %d bytes (%.1f%%), %s" % (name, used, budget, 100.0 * used / budget, status))
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,972 @@
+#!/usr/bin/env python3
+"""
+Serializer generator for the DSDL style message definitions under embedded-client/nodes.
+
+Every <id>.<Name>.uavcan file becomes a C struct with inline encode/decode functions for
+the firmware and a Rust type implementing uavcan_messages::Message for the server. A file
+with a '---' line is a service and yields a Request and a Response type.
+
+Supported field types are uintN/intN (N = 8, 16, 32, 64), bool, float32, float64, voidN
+padding and fixed (T[N]) or dynamic (T[<=N], T[<N]) arrays of those. Constants are
+written as 'type NAME = value'. Fields are byte aligned and little endian, a dynamic array
+carries its length in the smallest unsigned integer that holds its maximum, except as the
+last field where it takes the rest of the packet (tail array optimization). Nested types
+and sub-byte widths are rejected.
+
+    tools/uavcan_gen.py --nodes embedded-client/nodes --c-out embedded-client/generated_files
+    tools/uavcan_gen.py --nodes embedded-client/nodes --rust-out <dir>
+
+Outputs are only rewritten when their content changes, so builds stay incremental.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+SCALARS = {
+    # dsdl type: (bytes, C type, Rust type)
+    "bool": (1, "bool", "bool"),
+    "uint8": (1, "uint8_t", "u8"),
+    "uint16": (2, "uint16_t", "u16"),
+    "uint32": (4, "uint32_t", "u32"),
+    "uint64": (8, "uint64_t", "u64"),
+    "int8": (1, "int8_t", "i8"),
+    "int16": (2, "int16_t", "i16"),
+    "int32": (4, "int32_t", "i32"),
+    "int64": (8, "int64_t", "i64"),
+    "float32": (4, "float", "f32"),
+    "float64": (8, "double", "f64"),
+}
+
+# C accessor suffix of every scalar, see the helpers in C_PRELUDE
+C_SUFFIX = {
+    "bool": "bool",
+    "uint8": "u8",
+    "uint16": "u16",
+    "uint32": "u32",
+    "uint64": "u64",
+    "int8": "i8",
+    "int16": "i16",
+    "int32": "i32",
+    "int64": "i64",
+    "float32": "f32",
+    "float64": "f64",
+}
+
+FILE_RE = re.compile(r"^(\d+)\.([A-Z][A-Za-z0-9]*)\.uavcan$")
+FIELD_RE = re.compile(
+    r"^(?:(saturated|truncated)\s+)?([a-z]+[0-9]*)(?:\[(<=|<)?\s*(\d+)\])?\s+([A-Za-z_][A-Za-z0-9_]*)$"
+)
+CONST_RE = re.compile(r"^([a-z]+[0-9]*)\s+([A-Z_][A-Z0-9_]*)\s*=\s*(.+)$")
+VOID_RE = re.compile(r"^void(\d+)$")
+
+
+class GenError(Exception):
+    pass
+
+
+class Field:
+    def __init__(self, dtype, name, array=None, max_len=0):
+        self.dtype = dtype  # dsdl scalar type, or None for padding
+        self.name = name
+        self.array = array  # None, "fixed" or "dynamic"
+        self.max_len = max_len
+        self.padding = 0
+        self.tail = False  # dynamic array without length prefix
+
+    @property
+    def elem_size(self):
+        return SCALARS[self.dtype][0]
+
+    @property
+    def len_size(self):
+        if self.array != "dynamic" or self.tail:
+            return 0
+        return 1 if self.max_len <= 0xFF else 2
+
+    def max_size(self):
+        if self.dtype is None:
+            return self.padding
+        if self.array is None:
+            return self.elem_size
+        return self.len_size + self.max_len * self.elem_size
+
+
+class Constant:
+    def __init__(self, dtype, name, value):
+        self.dtype = dtype
+        self.name = name
+        self.value = value
+
+
+class Message:
+    def __init__(self, type_id, name, kind, fields, constants, path):
+        self.type_id = type_id
+        self.name = name  # e.g. StatusShareRequest
+        self.kind = kind  # "message", "request" or "response"
+        self.fields = fields
+        self.constants = constants
+        self.path = path
+
+        for f in fields[:-1]:
+            f.tail = False
+        if fields and fields[-1].array == "dynamic":
+            fields[-1].tail = True
+
+    @property
+    def snake(self):
+        return re.sub(r"(?<!^)(?=[A-Z])", "_", self.name).lower()
+
+    @property
+    def upper(self):
+        return self.snake.upper()
+
+    @property
+    def data_fields(self):
+        return [f for f in self.fields if f.dtype is not None]
+
+    def max_size(self):
+        return sum(f.max_size() for f in self.fields)
+
+    def min_size(self):
+        return sum(f.max_size() if f.array != "dynamic" else f.len_size for f in self.fields)
+
+
+def parse_section(lines, path, first_line):
+    fields, constants, names = [], [], set()
+
+    for offset, raw in enumerate(lines):
+        where = "%s:%d" % (path, first_line + offset)
+        line = raw.split("#", 1)[0].strip()
+        if not line:
+            continue
+        if line.startswith("@"):
+            raise GenError("%s: directive %s is not supported" % (where, line.split()[0]))
+
+        m = CONST_RE.match(line)
+        if m:
+            dtype, name, value = m.groups()
+            if dtype not in SCALARS or dtype == "bool":
+                raise GenError("%s: constant type %s is not supported" % (where, dtype))
+            constants.append(Constant(dtype, name, value.strip()))
+            continue
+
+        void = VOID_RE.match(line)
+        if void:
+            bits = int(void.group(1))
+            if bits % 8:
+                raise GenError("%s: void%d is not byte aligned" % (where, bits))
+            pad = Field(None, None)
+            pad.padding = bits // 8
+            fields.append(pad)
+            continue
+
+        m = FIELD_RE.match(line)
+        if not m:
+            raise GenError("%s: cannot parse '%s'" % (where, line))
+        _, dtype, bound, size, name = m.groups()
+        if dtype not in SCALARS:
+            raise GenError("%s: type %s is not supported (byte aligned scalars only)" % (where, dtype))
+        if name in names:
+            raise GenError("%s: duplicate field %s" % (where, name))
+        names.add(name)
+
+        if size is None:
+            fields.append(Field(dtype, name))
+            continue
+
+        max_len = int(size) - (1 if bound == "<" else 0)
+        if max_len <= 0 or max_len > 0xFFFF:
+            raise GenError("%s: array size %s out of range" % (where, size))
+        fields.append(Field(dtype, name, "dynamic" if bound else "fixed", max_len))
+
+    return fields, constants
+
+
+def parse_file(path):
+    m = FILE_RE.match(os.path.basename(path))
+    if not m:
+        raise GenError("%s: file name must be <id>.<TypeName>.uavcan" % path)
+    type_id, name = int(m.group(1)), m.group(2)
+
+    with open(path) as f:
+        lines = f.read().splitlines()
+
+    split = [i for i, l in enumerate(lines) if l.strip() == "---"]
+    if len(split) > 1:
+        raise GenError("%s: more than one '---'" % path)
+    if not split:
+        fields, constants = parse_section(lines, path, 1)
+        return [Message(type_id, name, "message", fields, constants, path)]
+
+    s = split[0]
+    req_fields, req_consts = parse_section(lines[:s], path, 1)
+    rsp_fields, rsp_consts = parse_section(lines[s + 1 :], path, s + 2)
+    return [
+        Message(type_id, name + "Request", "request", req_fields, req_consts, path),
+        Message(type_id, name + "Response", "response", rsp_fields, rsp_consts, path),
+    ]
+
+
+def load(nodes_dir):
+    messages = []
+    for root, dirs, files in os.walk(nodes_dir):
+        dirs.sort()
+        for name in sorted(files):
+            if name.endswith(".uavcan"):
+                messages.extend(parse_file(os.path.join(root, name)))
+
+    seen = {}
+    for msg in messages:
+        if msg.name in seen:
+            raise GenError("%s: %s already defined in %s" % (msg.path, msg.name, seen[msg.name]))
+        seen[msg.name] = msg.path
+    if not messages:
+        raise GenError("no .uavcan files under %s" % nodes_dir)
+    return messages
+
+
+def write_if_changed(path, text):
+    try:
+        with open(path) as f:
+            if f.read() == text:
+                return
+    except FileNotFoundError:
+        pass
+
+    os.makedirs(os.path.dirname(path) or ".", exist_ok=True)
+    with open(path, "w") as f:
+        f.write(text)
+
+
+def source_list(messages, nodes_dir):
+    paths = sorted({os.path.relpath(m.path, nodes_dir) for m in messages})
+    return ", ".join(paths)
+
+
+# ---------------------------------------------------------------------------- C
+
+C_PRELUDE = """\
+static inline uint8_t *uavcan_put_u8(uint8_t *p, uint8_t v) {
+    p[0] = v;
+    return p + 1;
+}
+
+static inline uint8_t *uavcan_put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    return p + 2;
+}
+
+static inline uint8_t *uavcan_put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+    return p + 4;
+}
+
+static inline uint8_t *uavcan_put_u64(uint8_t *p, uint64_t v) {
+    p = uavcan_put_u32(p, (uint32_t)v);
+    return uavcan_put_u32(p, (uint32_t)(v >> 32));
+}
+
+static inline const uint8_t *uavcan_get_u8(const uint8_t *p, uint8_t *v) {
+    *v = p[0];
+    return p + 1;
+}
+
+static inline const uint8_t *uavcan_get_u16(const uint8_t *p, uint16_t *v) {
+    *v = (uint16_t)(p[0] | ((uint16_t)p[1] << 8));
+    return p + 2;
+}
+
+static inline const uint8_t *uavcan_get_u32(const uint8_t *p, uint32_t *v) {
+    *v = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    return p + 4;
+}
+
+static inline const uint8_t *uavcan_get_u64(const uint8_t *p, uint64_t *v) {
+    uint32_t lo, hi;
+    p = uavcan_get_u32(p, &lo);
+    p = uavcan_get_u32(p, &hi);
+    *v = ((uint64_t)hi << 32) | lo;
+    return p;
+}
+
+static inline uint8_t *uavcan_put_bool(uint8_t *p, bool v) { return uavcan_put_u8(p, v ? 1 : 0); }
+static inline uint8_t *uavcan_put_i8(uint8_t *p, int8_t v) { return uavcan_put_u8(p, (uint8_t)v); }
+static inline uint8_t *uavcan_put_i16(uint8_t *p, int16_t v) { return uavcan_put_u16(p, (uint16_t)v); }
+static inline uint8_t *uavcan_put_i32(uint8_t *p, int32_t v) { return uavcan_put_u32(p, (uint32_t)v); }
+static inline uint8_t *uavcan_put_i64(uint8_t *p, int64_t v) { return uavcan_put_u64(p, (uint64_t)v); }
+
+static inline uint8_t *uavcan_put_f32(uint8_t *p, float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return uavcan_put_u32(p, bits);
+}
+
+static inline uint8_t *uavcan_put_f64(uint8_t *p, double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return uavcan_put_u64(p, bits);
+}
+
+static inline const uint8_t *uavcan_get_bool(const uint8_t *p, bool *v) {
+    *v = (p[0] != 0);
+    return p + 1;
+}
+
+static inline const uint8_t *uavcan_get_i8(const uint8_t *p, int8_t *v) { return uavcan_get_u8(p, (uint8_t *)v); }
+static inline const uint8_t *uavcan_get_i16(const uint8_t *p, int16_t *v) { return uavcan_get_u16(p, (uint16_t *)v); }
+static inline const uint8_t *uavcan_get_i32(const uint8_t *p, int32_t *v) { return uavcan_get_u32(p, (uint32_t *)v); }
+static inline const uint8_t *uavcan_get_i64(const uint8_t *p, int64_t *v) { return uavcan_get_u64(p, (uint64_t *)v); }
+
+static inline const uint8_t *uavcan_get_f32(const uint8_t *p, float *v) {
+    uint32_t bits;
+    p = uavcan_get_u32(p, &bits);
+    memcpy(v, &bits, sizeof(bits));
+    return p;
+}
+
+static inline const uint8_t *uavcan_get_f64(const uint8_t *p, double *v) {
+    uint64_t bits;
+    p = uavcan_get_u64(p, &bits);
+    memcpy(v, &bits, sizeof(bits));
+    return p;
+}
+"""
+
+
+def c_len_type(field):
+    return "uint8_t" if field.max_len <= 0xFF else "uint16_t"
+
+
+def c_struct(msg):
+    out = ["typedef struct {"]
+    for f in msg.data_fields:
+        ctype = SCALARS[f.dtype][1]
+        if f.array is None:
+            out.append("    %s %s;" % (ctype, f.name))
+        elif f.array == "fixed":
+            out.append("    %s %s[%d];" % (ctype, f.name, f.max_len))
+        else:
+            out.append("    %s %s_len;" % (c_len_type(f), f.name))
+            out.append("    %s %s[%d];" % (ctype, f.name, f.max_len))
+    if not msg.data_fields:
+        out.append("    uint8_t unused;")
+    out.append("} %s_s;" % msg.snake)
+    return out
+
+
+def len_terms(msg, count_expr):
+    """encoded length as a sum, fixed sizes folded into one constant"""
+    fixed, terms = 0, []
+    for f in msg.fields:
+        if f.array != "dynamic":
+            fixed += f.max_size()
+            continue
+        fixed += f.len_size
+        count = count_expr(f)
+        terms.append(count if f.elem_size == 1 else "%s * %d" % (count, f.elem_size))
+    if fixed or not terms:
+        terms.insert(0, str(fixed))
+    return terms
+
+
+def c_len_terms(msg):
+    return len_terms(msg, lambda f: "(size_t)msg->%s_len" % f.name)
+
+
+def c_functions(msg):
+    s, u = msg.snake, msg.upper
+    out = []
+
+    # encoded length
+    out.append("static inline size_t %s_encoded_len(const %s_s *msg) {" % (s, s))
+    terms = c_len_terms(msg)
+    if not any(f.array == "dynamic" for f in msg.fields):
+        out.append("    (void)msg;")
+    out.append("    return %s;" % " + ".join(terms))
+    out.append("}")
+    out.append("")
+
+    # encode
+    out.append("/* Returns the encoded length, or -1 when an array is over its bound or cap is too small */")
+    out.append("static inline int32_t %s_encode(const %s_s *msg, uint8_t *buf, size_t cap) {" % (s, s))
+    checks = ["msg->%s_len > %d" % (f.name, f.max_len) for f in msg.fields if f.array == "dynamic"]
+    if checks:
+        out.append("    if (%s) {" % " || ".join(checks))
+        out.append("        return -1;")
+        out.append("    }")
+        out.append("")
+    out.append("    size_t len = %s_encoded_len(msg);" % s)
+    out.append("    if (len > cap) {")
+    out.append("        return -1;")
+    out.append("    }")
+    out.append("")
+    if msg.fields:
+        out.append("    uint8_t *p = buf;")
+    for f in msg.fields:
+        if f.dtype is None:
+            out.append("    memset(p, 0, %d);" % f.padding)
+            out.append("    p += %d;" % f.padding)
+            continue
+        sfx = C_SUFFIX[f.dtype]
+        if f.array is None:
+            out.append("    p = uavcan_put_%s(p, msg->%s);" % (sfx, f.name))
+            continue
+        count = "msg->%s_len" % f.name if f.array == "dynamic" else str(f.max_len)
+        if f.len_size == 1:
+            out.append("    p = uavcan_put_u8(p, msg->%s_len);" % f.name)
+        elif f.len_size == 2:
+            out.append("    p = uavcan_put_u16(p, msg->%s_len);" % f.name)
+        if f.elem_size == 1 and f.dtype != "bool":
+            out.append("    memcpy(p, msg->%s, %s);" % (f.name, count))
+            out.append("    p += %s;" % count)
+        else:
+            out.append("    for (size_t i = 0; i < %s; i++) {" % count)
+            out.append("        p = uavcan_put_%s(p, msg->%s[i]);" % (sfx, f.name))
+            out.append("    }")
+    if msg.fields:
+        out.append("    (void)p;")
+    else:
+        out.append("    (void)msg;")
+        out.append("    (void)buf;")
+    out.append("    return (int32_t)len;")
+    out.append("}")
+    out.append("")
+
+    # decode
+    out.append("/* Returns 0, or -1 when buf is too short or an array is over its bound. Bytes past the")
+    out.append(" * last field are ignored, unless it is a tail array: that one takes the rest of buf. */")
+    out.append("static inline int %s_decode(%s_s *msg, const uint8_t *buf, size_t len) {" % (s, s))
+    if not msg.fields:
+        out.append("    (void)msg;")
+        out.append("    (void)buf;")
+        out.append("    (void)len;")
+        out.append("    return 0;")
+        out.append("}")
+        return out
+    out.append("    const uint8_t *p = buf;")
+    if any(f.array == "dynamic" for f in msg.fields):
+        out.append("    const uint8_t *end = buf + len;")
+    out.append("")
+    if msg.min_size() > 0:
+        out.append("    if (len < %s_MIN_SIZE) {" % u)
+        out.append("        return -1;")
+        out.append("    }")
+    # everything up to the first dynamic array is covered by the MIN_SIZE check
+    checked = True
+    for f in msg.fields:
+        if f.dtype is None:
+            if not checked:
+                out.append("    if ((size_t)(end - p) < %d) {" % f.padding)
+                out.append("        return -1;")
+                out.append("    }")
+            out.append("    p += %d;" % f.padding)
+            continue
+        sfx = C_SUFFIX[f.dtype]
+        if f.array is None:
+            if not checked:
+                out.append("    if ((size_t)(end - p) < %d) {" % f.elem_size)
+                out.append("        return -1;")
+                out.append("    }")
+            out.append("    p = uavcan_get_%s(p, &msg->%s);" % (sfx, f.name))
+            continue
+
+        if f.array == "fixed":
+            count = str(f.max_len)
+            if not checked:
+                out.append("    if ((size_t)(end - p) < %d) {" % f.max_size())
+                out.append("        return -1;")
+                out.append("    }")
+        elif f.tail:
+            out.append("    if ((size_t)(end - p) %% %d != 0 || (size_t)(end - p) / %d > %d) {"
+                       % (f.elem_size, f.elem_size, f.max_len) if f.elem_size > 1 else
+                       "    if ((size_t)(end - p) > %d) {" % f.max_len)
+            out.append("        return -1;")
+            out.append("    }")
+            rest = "(size_t)(end - p)" if f.elem_size == 1 else "(size_t)(end - p) / %d" % f.elem_size
+            out.append("    msg->%s_len = (%s)(%s);" % (f.name, c_len_type(f), rest))
+            count = "msg->%s_len" % f.name
+            checked = False
+        else:
+            if not checked:
+                out.append("    if ((size_t)(end - p) < %d) {" % f.len_size)
+                out.append("        return -1;")
+                out.append("    }")
+            if f.len_size == 1:
+                out.append("    p = uavcan_get_u8(p, &msg->%s_len);" % f.name)
+            else:
+                out.append("    p = uavcan_get_u16(p, &msg->%s_len);" % f.name)
+            need = "(size_t)msg->%s_len" % f.name
+            if f.elem_size > 1:
+                need += " * %d" % f.elem_size
+            out.append("    if (msg->%s_len > %d || (size_t)(end - p) < %s) {" % (f.name, f.max_len, need))
+            out.append("        return -1;")
+            out.append("    }")
+            count = "msg->%s_len" % f.name
+            checked = False
+
+        if f.elem_size == 1 and f.dtype != "bool":
+            out.append("    memcpy(msg->%s, p, %s);" % (f.name, count))
+            out.append("    p += %s;" % count)
+        else:
+            out.append("    for (size_t i = 0; i < %s; i++) {" % count)
+            out.append("        p = uavcan_get_%s(p, &msg->%s[i]);" % (sfx, f.name))
+            out.append("    }")
+    out.append("    (void)p;")
+    out.append("    return 0;")
+    out.append("}")
+    return out
+
+
+def c_value(dtype, value):
+    if dtype.startswith("float"):
+        return value if dtype == "float64" else value + "f"
+    if dtype.startswith("uint"):
+        return value + "u"
+    return value
+
+
+def gen_c_header(messages, nodes_dir):
+    out = [
+        "/* Generated by tools/uavcan_gen.py from %s, do not edit */" % source_list(messages, nodes_dir),
+        "#ifndef UAVCAN_MESSAGES_H",
+        "#define UAVCAN_MESSAGES_H",
+        "",
+        "#include <stdbool.h>",
+        "#include <stddef.h>",
+        "#include <stdint.h>",
+        "#include <string.h>",
+        "",
+        "/*",
+        " * Byte aligned little endian layout. Encode straight into a CSP buffer:",
+        " *",
+        " *   int32_t len = node_ping_encode(&ping, packet->data, sizeof(packet->data));",
+        " *   if (len >= 0) packet->length = (uint16_t)len;",
+        " */",
+        "",
+        C_PRELUDE,
+    ]
+
+    done_ids = set()
+    overall = 0
+    for msg in messages:
+        u = msg.upper
+        base = re.sub(r"_(REQUEST|RESPONSE)$", "", u) if msg.kind != "message" else u
+        out.append("/* %s */" % os.path.relpath(msg.path, nodes_dir))
+        if base not in done_ids:
+            out.append("#define %s_ID (%d)" % (base, msg.type_id))
+            done_ids.add(base)
+        out.append("#define %s_MAX_SIZE (%d)" % (u, msg.max_size()))
+        out.append("#define %s_MIN_SIZE (%d)" % (u, msg.min_size()))
+        for c in msg.constants:
+            out.append("#define %s_%s (%s)" % (u, c.name, c_value(c.dtype, c.value)))
+        out.append("")
+        out.extend(c_struct(msg))
+        out.append("")
+        out.extend(c_functions(msg))
+        out.append("")
+        overall = max(overall, msg.max_size())
+
+    out.append("/* largest encoded message, for sizing scratch buffers */")
+    out.append("#define UAVCAN_MESSAGES_MAX_SIZE (%d)" % overall)
+    out.append("")
+    out.append("typedef void (*uavcan_bench_report_f)(const char *name, int32_t size, uint32_t iterations,")
+    out.append("                                      uint32_t encode_cycles, uint32_t decode_cycles, int ok);")
+    out.append("")
+    out.append("/* Encodes and decodes every message at its maximum size `iterations` times and reports")
+    out.append(" * the cycles spent in total. Returns the number of messages that did not survive the trip. */")
+    out.append("int uavcan_messages_bench(uint32_t iterations, uavcan_bench_report_f report);")
+    out.append("")
+    out.append("#endif // UAVCAN_MESSAGES_H")
+    return "\n".join(out) + "\n"
+
+
+def sample_value(dtype, i):
+    """deterministic non-trivial value for element i, as (C literal, Rust literal)"""
+    if dtype == "bool":
+        v = "true" if i % 2 == 0 else "false"
+        return v, v
+    if dtype.startswith("float"):
+        v = "%d.5" % (i + 1)
+        return c_value(dtype, v), v
+    size = SCALARS[dtype][0]
+    if dtype.startswith("uint"):
+        v = (0x5A + 37 * i) & ((1 << (8 * size)) - 1)
+        return "%du" % v, "%d" % v
+    v = -(i + 3)
+    return "%d" % v, "%d" % v
+
+
+def gen_c_bench(messages, nodes_dir):
+    out = [
+        "/* Generated by tools/uavcan_gen.py from %s, do not edit */" % source_list(messages, nodes_dir),
+        '#include "uavcan_messages.h"',
+        '#include "cpu_load.h"',
+        "",
+    ]
+
+    for msg in messages:
+        s = msg.snake
+        out.append("static void %s_fill(%s_s *msg) {" % (s, s))
+        if not msg.data_fields:
+            out.append("    (void)msg;")
+        for f in msg.data_fields:
+            if f.array is None:
+                out.append("    msg->%s = %s;" % (f.name, sample_value(f.dtype, 0)[0]))
+                continue
+            if f.array == "dynamic":
+                out.append("    msg->%s_len = %d;" % (f.name, f.max_len))
+            out.append("    for (size_t i = 0; i < %d; i++) {" % f.max_len)
+            if f.dtype == "bool":
+                out.append("        msg->%s[i] = (i %% 2) == 0;" % f.name)
+            elif f.dtype.startswith("float"):
+                out.append("        msg->%s[i] = (%s)i + 0.5;" % (f.name, SCALARS[f.dtype][1]))
+            else:
+                out.append("        msg->%s[i] = (%s)(0x5A + 37 * i);" % (f.name, SCALARS[f.dtype][1]))
+            out.append("    }")
+        out.append("}")
+        out.append("")
+
+    out.append("int uavcan_messages_bench(uint32_t iterations, uavcan_bench_report_f report) {")
+    out.append("    uint8_t buf[UAVCAN_MESSAGES_MAX_SIZE > 0 ? UAVCAN_MESSAGES_MAX_SIZE : 1];")
+    out.append("    int failures = 0;")
+    out.append("")
+    out.append("    if (iterations == 0) {")
+    out.append("        iterations = 1;")
+    out.append("    }")
+    for msg in messages:
+        s = msg.snake
+        out.append("")
+        out.append("    {")
+        out.append("        %s_s in, out;" % s)
+        out.append("        int32_t len = -1;")
+        out.append("        int ret = 0;")
+        out.append("")
+        out.append("        /* zeroed so padding and unused array tails compare equal */")
+        out.append("        memset(&in, 0, sizeof(in));")
+        out.append("        memset(&out, 0, sizeof(out));")
+        out.append("        %s_fill(&in);" % s)
+        out.append("")
+        out.append("        uint32_t start = cpu_cycles();")
+        out.append("        for (uint32_t i = 0; i < iterations; i++) {")
+        out.append("            len = %s_encode(&in, buf, sizeof(buf));" % s)
+        out.append('            __asm volatile("" ::: "memory");')
+        out.append("        }")
+        out.append("        uint32_t encode_cycles = cpu_cycles() - start;")
+        out.append("")
+        out.append("        start = cpu_cycles();")
+        out.append("        for (uint32_t i = 0; i < iterations && len >= 0; i++) {")
+        out.append("            ret |= %s_decode(&out, buf, (size_t)len);" % s)
+        out.append('            __asm volatile("" ::: "memory");')
+        out.append("        }")
+        out.append("        uint32_t decode_cycles = cpu_cycles() - start;")
+        out.append("")
+        out.append("        int ok = len == %s_MAX_SIZE && ret == 0 && memcmp(&in, &out, sizeof(in)) == 0;" % msg.upper)
+        out.append("        failures += !ok;")
+        out.append("        if (report) {")
+        out.append('            report("%s", len, iterations, encode_cycles, decode_cycles, ok);'
+                   % msg.name)
+        out.append("        }")
+        out.append("    }")
+    out.append("")
+    out.append("    return failures;")
+    out.append("}")
+    return "\n".join(out) + "\n"
+
+
+# ------------------------------------------------------------------------- Rust
+
+def rust_field_type(f):
+    rtype = SCALARS[f.dtype][2]
+    if f.array is None:
+        return rtype
+    if f.array == "fixed":
+        return "[%s; %d]" % (rtype, f.max_len)
+    return "BoundedArray<%s, %d>" % (rtype, f.max_len)
+
+
+def rust_default(f):
+    rtype = SCALARS[f.dtype][2]
+    zero = "false" if rtype == "bool" else ("0.0" if rtype.startswith("f") else "0")
+    if f.array is None:
+        return zero
+    if f.array == "fixed":
+        return "[%s; %d]" % (zero, f.max_len)
+    return "BoundedArray::new()"
+
+
+def gen_rust_messages(messages, nodes_dir):
+    out = [
+        "// Generated by tools/uavcan_gen.py from %s, do not edit" % source_list(messages, nodes_dir),
+        "",
+    ]
+
+    overall = 0
+    for msg in messages:
+        n = msg.name
+        overall = max(overall, msg.max_size())
+        # std only has Default for arrays up to 32 elements
+        derive_default = all(f.array != "fixed" or f.max_len <= 32 for f in msg.data_fields)
+        out.append("/// %s" % os.path.relpath(msg.path, nodes_dir))
+        out.append("#[derive(Debug, Clone, Copy, PartialEq%s)]" % (", Default" if derive_default else ""))
+        if msg.data_fields:
+            out.append("pub struct %s {" % n)
+            for f in msg.data_fields:
+                out.append("    pub %s: %s," % (f.name, rust_field_type(f)))
+            out.append("}")
+        else:
+            out.append("pub struct %s;" % n)
+        out.append("")
+
+        if not derive_default:
+            out.append("impl Default for %s {" % n)
+            out.append("    fn default() -> Self {")
+            out.append("        %s {" % n)
+            for f in msg.data_fields:
+                out.append("            %s: %s," % (f.name, rust_default(f)))
+            out.append("        }")
+            out.append("    }")
+            out.append("}")
+            out.append("")
+
+        if msg.constants:
+            out.append("impl %s {" % n)
+            for c in msg.constants:
+                out.append("    pub const %s: %s = %s;" % (c.name, SCALARS[c.dtype][2], c.value))
+            out.append("}")
+            out.append("")
+
+        out.append("impl Message for %s {" % n)
+        out.append("    const ID: u16 = %d;" % msg.type_id)
+        out.append("    const MAX_SIZE: usize = %d;" % msg.max_size())
+        out.append("    const MIN_SIZE: usize = %d;" % msg.min_size())
+        out.append("")
+
+        # encoded_len
+        out.append("    fn encoded_len(&self) -> usize {")
+        terms = len_terms(msg, lambda f: "self.%s.len()" % f.name)
+        out.append("        %s" % " + ".join(terms))
+        out.append("    }")
+        out.append("")
+
+        # encode
+        out.append("    fn encode(&self, buf: &mut [u8]) -> Result<usize, CodecError> {")
+        out.append("        let len = self.encoded_len();")
+        if not msg.fields:
+            out.append("        buf.get_mut(..len).ok_or(CodecError::BufferTooSmall)?;")
+        else:
+            out.append("        let mut w = Writer::new(buf.get_mut(..len).ok_or(CodecError::BufferTooSmall)?);")
+        for f in msg.fields:
+            if f.dtype is None:
+                out.append("        w.pad(%d);" % f.padding)
+                continue
+            if f.array is None:
+                out.append("        w.put(self.%s);" % f.name)
+                continue
+            slice_expr = "self.%s.as_slice()" % f.name if f.array == "dynamic" else "&self.%s" % f.name
+            if f.len_size == 1:
+                out.append("        w.put(self.%s.len() as u8);" % f.name)
+            elif f.len_size == 2:
+                out.append("        w.put(self.%s.len() as u16);" % f.name)
+            if f.dtype == "uint8":
+                out.append("        w.put_bytes(%s);" % slice_expr)
+            else:
+                out.append("        for v in %s {" % slice_expr)
+                out.append("            w.put(*v);")
+                out.append("        }")
+        out.append("        Ok(len)")
+        out.append("    }")
+        out.append("")
+
+        # decode
+        out.append("    fn decode(buf: &[u8]) -> Result<Self, CodecError> {")
+        if not msg.fields:
+            out.append("        let _ = buf;")
+            out.append("        Ok(%s)" % n)
+            out.append("    }")
+            out.append("}")
+            out.append("")
+            continue
+        if msg.min_size() > 0:
+            out.append("        if buf.len() < Self::MIN_SIZE {")
+            out.append("            return Err(CodecError::Truncated);")
+            out.append("        }")
+        out.append("        let mut r = Reader::new(buf);")
+        for f in msg.fields:
+            if f.dtype is None:
+                out.append("        r.skip(%d)?;" % f.padding)
+                continue
+            rtype = SCALARS[f.dtype][2]
+            if f.array is None:
+                out.append("        let %s: %s = r.get()?;" % (f.name, rtype))
+                continue
+            if f.array == "fixed":
+                out.append("        let mut %s = [%s; %d];" % (f.name, rust_default(Field(f.dtype, "")), f.max_len))
+                if f.dtype == "uint8":
+                    out.append("        %s.copy_from_slice(r.get_bytes(%d)?);" % (f.name, f.max_len))
+                else:
+                    out.append("        for v in %s.iter_mut() {" % f.name)
+                    out.append("            *v = r.get()?;")
+                    out.append("        }")
+                continue
+            if f.tail:
+                out.append("        let count = r.tail_count(%d)?;" % f.elem_size)
+            elif f.len_size == 1:
+                out.append("        let count = r.get::<u8>()? as usize;")
+            else:
+                out.append("        let count = r.get::<u16>()? as usize;")
+            if f.dtype == "uint8":
+                out.append("        let %s = BoundedArray::from_slice(r.get_bytes(count)?)" % f.name)
+                out.append("            .ok_or(CodecError::ArrayTooLong)?;")
+            else:
+                out.append("        if count > %d {" % f.max_len)
+                out.append("            return Err(CodecError::ArrayTooLong);")
+                out.append("        }")
+                out.append("        let mut %s = BoundedArray::new();" % f.name)
+                out.append("        for _ in 0..count {")
+                out.append("            %s.push(r.get()?).map_err(|_| CodecError::ArrayTooLong)?;" % f.name)
+                out.append("        }")
+        out.append("        Ok(%s {" % n)
+        for f in msg.data_fields:
+            out.append("            %s," % f.name)
+        out.append("        })")
+        out.append("    }")
+        out.append("}")
+        out.append("")
+
+    out.append("/// Largest encoded message, for sizing scratch buffers")
+    out.append("pub const MESSAGES_MAX_SIZE: usize = %d;" % overall)
+    return "\n".join(out) + "\n"
+
+
+def rust_fill(msg):
+    """body of fill_<name>(), scalars set in the initializer and arrays filled to their bound"""
+    scalars = ["%s: %s" % (f.name, sample_value(f.dtype, 0)[1]) for f in msg.data_fields if f.array is None]
+    arrays = [f for f in msg.data_fields if f.array is not None]
+
+    if not arrays:
+        return ["    %s { %s }" % (msg.name, ", ".join(scalars)) if scalars else "    %s" % msg.name]
+
+    if scalars:
+        out = ["    let mut msg = %s {" % msg.name]
+        out.extend("        %s," % v for v in scalars)
+        out.append("        ..Default::default()")
+        out.append("    };")
+    else:
+        out = ["    let mut msg = %s::default();" % msg.name]
+
+    for f in arrays:
+        rtype = SCALARS[f.dtype][2]
+        if f.dtype == "bool":
+            elem = "i % 2 == 0"
+        elif rtype.startswith("f"):
+            elem = "i as %s + 0.5" % rtype
+        else:
+            elem = "(0x5A + 37 * i) as %s" % rtype
+        if f.array == "fixed":
+            out.append("    for (i, v) in msg.%s.iter_mut().enumerate() {" % f.name)
+            out.append("        *v = %s;" % elem)
+            out.append("    }")
+        else:
+            out.append("    for i in 0..%d {" % f.max_len)
+            out.append("        let _ = msg.%s.push(%s);" % (f.name, elem))
+            out.append("    }")
+    out.append("    msg")
+    return out
+
+
+def gen_rust_bench(messages, nodes_dir):
+    out = [
+        "// Generated by tools/uavcan_gen.py from %s, do not edit" % source_list(messages, nodes_dir),
+        "",
+        "use std::hint::black_box;",
+        "use std::time::Instant;",
+        "",
+        "/// Mean cost of one encode and one decode at the maximum message size",
+        "#[derive(Debug, Clone)]",
+        "pub struct RoundTrip {",
+        "    pub name: &'static str,",
+        "    pub size: usize,",
+        "    pub encode_ns: f64,",
+        "    pub decode_ns: f64,",
+        "    pub ok: bool,",
+        "}",
+        "",
+        "fn round_trip<M: Message>(name: &'static str, msg: M, iterations: u32) -> RoundTrip {",
+        "    let iterations = iterations.max(1);",
+        "    let mut buf = [0u8; MESSAGES_MAX_SIZE];",
+        "    let mut len = Ok(0);",
+        "",
+        "    let start = Instant::now();",
+        "    for _ in 0..iterations {",
+        "        len = black_box(&msg).encode(black_box(&mut buf));",
+        "    }",
+        "    let encode_ns = start.elapsed().as_nanos() as f64 / iterations as f64;",
+        "",
+        "    let size = *len.as_ref().unwrap_or(&0);",
+        "    let mut decoded = Err(CodecError::Truncated);",
+        "    let start = Instant::now();",
+        "    for _ in 0..iterations {",
+        "        decoded = M::decode(black_box(&buf[..size]));",
+        "    }",
+        "    let decode_ns = start.elapsed().as_nanos() as f64 / iterations as f64;",
+        "",
+        "    RoundTrip {",
+        "        name,",
+        "        size,",
+        "        encode_ns,",
+        "        decode_ns,",
+        "        ok: len.is_ok() && size == M::MAX_SIZE && decoded.as_ref() == Ok(&msg),",
+        "    }",
+        "}",
+        "",
+    ]
+
+    for msg in messages:
+        out.append("fn fill_%s() -> %s {" % (msg.snake, msg.name))
+        out.extend(rust_fill(msg))
+        out.append("}")
+        out.append("")
+
+    out.append("/// Round trips every generated message `iterations` times.")
+    out.append("pub fn run(iterations: u32) -> Vec<RoundTrip> {")
+    out.append("    vec![")
+    for msg in messages:
+        out.append('        round_trip("%s", fill_%s(), iterations),' % (msg.name, msg.snake))
+    out.append("    ]")
+    out.append("}")
+    return "\n".join(out) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generates C and Rust serializers from .uavcan files.")
+    parser.add_argument("--nodes", required=True, help="directory searched for .uavcan files")
+    parser.add_argument("--c-out", help="directory for uavcan_messages.h and uavcan_messages_bench.c")
+    parser.add_argument("--rust-out", help="directory for uavcan_messages.rs and uavcan_roundtrip.rs")
+    args = parser.parse_args()
+
+    if not args.c_out and not args.rust_out:
+        parser.error("nothing to do, pass --c-out and/or --rust-out")
+
+    try:
+        messages = load(args.nodes)
+    except (GenError, OSError) as e:
+        print("uavcan_gen: %s" % e, file=sys.stderr)
+        return 1
+
+    if args.c_out:
+        write_if_changed(os.path.join(args.c_out, "uavcan_messages.h"), gen_c_header(messages, args.nodes))
+        write_if_changed(os.path.join(args.c_out, "uavcan_messages_bench.c"), gen_c_bench(messages, args.nodes))
+    if args.rust_out:
+        write_if_changed(os.path.join(args.rust_out, "uavcan_messages.rs"), gen_rust_messages(messages, args.nodes))
+        write_if_changed(os.path.join(args.rust_out, "uavcan_roundtrip.rs"), gen_rust_bench(messages, args.nodes))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())